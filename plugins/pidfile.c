@@ -100,6 +100,7 @@ static void pidfile_update_conds(char *dir, char *name, uint32_t mask)
 				_d("Forking service %s changed PID from %d to %d",
 				   svc->cmd, svc->pid, pid);
 				svc->pid = pid;
+				service_track(svc);
 			}
 		}
 
@@ -27,6 +27,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sys/param.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <lite/lite.h>
@@ -37,16 +38,31 @@
 #include "cond.h"
 #include "conf.h"
 #include "helpers.h"
+#include "latency.h"
 #include "log.h"
+#include "logmux.h"
 #include "plugin.h"
 #include "private.h"
 #include "sig.h"
 #include "service.h"
+#include "sock.h"
+#include "timeline.h"
+#include "trace.h"
 #include "util.h"
 
 extern svc_t *wdog;
 static uev_t api_watcher;
 
+/* Snapshot being sent to an initctl client, see api_reply() */
+struct reply {
+	uev_t   watcher;
+	int     sd;
+	char   *buf;
+	size_t  len;		/* total size of buf */
+	size_t  off;		/* sent so far */
+	size_t  chunk;		/* whole records per message */
+};
+
 static int call(int (*action)(svc_t *), char *buf, size_t len)
 {
 	return svc_parse_jobstr(buf, len, action, NULL);
@@ -63,6 +79,22 @@ static int stop(svc_t *svc)
 	return 0;
 }
 
+/*
+ * First half of initctl restart, the service is blocked as restarting
+ * instead of stopped by the user, so a socket activated service keeps
+ * its listening sockets for the next instance.
+ */
+static int stop_restart(svc_t *svc)
+{
+	if (!svc)
+		return 1;
+
+	svc_restarting(svc);
+	service_step(svc);
+
+	return 0;
+}
+
 static int start(svc_t *svc)
 {
 	if (!svc)
@@ -106,6 +138,7 @@ static int reload(svc_t *svc)
 }
 
 static int do_stop   (char *buf, size_t len) { return call(stop,    buf, len); }
+static int do_stop_restart(char *buf, size_t len) { return call(stop_restart, buf, len); }
 static int do_start  (char *buf, size_t len) { return call(start,   buf, len); }
 static int do_restart(char *buf, size_t len) { return call(restart, buf, len); }
 static int do_reload (char *buf, size_t len) { return call(reload,  buf, len); }
@@ -268,13 +301,243 @@ static void send_svc(int sd, svc_t *svc)
 		_d("Failed sending svc_t to client");
 }
 
+/* Close fds sent along with a request that does not take them */
+static void drop_fds(int fds[], int *num)
+{
+	while (*num > 0)
+		close(fds[--(*num)]);
+}
+
+/*
+ * Read request from client, any descriptors passed with the request,
+ * using SCM_RIGHTS, are returned in @fds.  Used by INIT_CMD_FDSTORE*.
+ * Descriptors beyond %MAX_NUM_FDSTORE are closed.
+ */
+static ssize_t recv_rq(int sd, struct init_request *rq, int fds[], int *num)
+{
+	char cbuf[CMSG_SPACE(sizeof(int) * MAX_NUM_FDSTORE)];
+	struct iovec iov = {
+		.iov_base = rq,
+		.iov_len  = sizeof(*rq),
+	};
+	struct msghdr msg = {
+		.msg_iov        = &iov,
+		.msg_iovlen     = 1,
+		.msg_control    = cbuf,
+		.msg_controllen = sizeof(cbuf),
+	};
+	struct cmsghdr *cmsg;
+	ssize_t len;
+
+	*num = 0;
+	len = recvmsg(sd, &msg, MSG_CMSG_CLOEXEC);
+	if (len <= 0)
+		return len;
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		size_t n;
+
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+
+		n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (size_t i = 0; i < n; i++) {
+			int fd;
+
+			memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+			if (*num < MAX_NUM_FDSTORE)
+				fds[(*num)++] = fd;
+			else
+				close(fd);
+		}
+	}
+
+	return len;
+}
+
+/*
+ * Look up the service of the client connected on @sd from its peer
+ * credentials.  A process started by the service is also accepted,
+ * since all services run in their own process group.
+ */
+static svc_t *do_find_peer(int sd, pid_t *pid)
+{
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+	svc_t *svc;
+	pid_t pgid;
+
+	*pid = 0;
+	if (getsockopt(sd, SOL_SOCKET, SO_PEERCRED, &cred, &len)) {
+		_pe("Failed reading peer credentials");
+		return NULL;
+	}
+
+	*pid = cred.pid;
+	svc = svc_find_by_pid(cred.pid);
+	if (!svc) {
+		pgid = getpgid(cred.pid);
+		if (pgid > 1)
+			svc = svc_find_by_pid(pgid);
+	}
+	if (!svc || !svc_is_daemon(svc))
+		return NULL;
+
+	return svc;
+}
+
+/*
+ * A service hands over descriptors to be kept by Finit until the next
+ * instance of the same NAME:ID is started.  With INIT_CMD_FDSTORE_CLEAR
+ * the store is first emptied, i.e., replaced by any @fds sent along.
+ */
+static int do_fdstore(int sd, struct init_request *rq, int fds[], int num)
+{
+	svc_t *svc;
+	pid_t pid;
+
+	svc = do_find_peer(sd, &pid);
+	if (!svc) {
+		logit(LOG_WARNING, "fdstore: PID %d is not a service, ignoring.", pid);
+		goto fail;
+	}
+
+	if (rq->cmd == INIT_CMD_FDSTORE_CLEAR) {
+		_d("fdstore: clearing store of %s", svc_ident(svc, NULL, 0));
+		sock_store_clear(svc);
+	}
+
+	return sock_store(svc, fds, num);
+fail:
+	drop_fds(fds, &num);
+
+	return 1;
+}
+
+/*
+ * Watchdog keepalive, either from the service itself, or any process
+ * in its process group, or on behalf of NAME[:ID] given in @rq.
+ */
+static int do_keepalive(int sd, struct init_request *rq)
+{
+	svc_t *svc;
+	pid_t pid;
+
+	if (rq->data[0]) {
+		svc = do_find(rq->data, sizeof(rq->data));
+		if (!svc) {
+			_d("keepalive: no such service %s", rq->data);
+			return 1;
+		}
+	} else {
+		svc = do_find_peer(sd, &pid);
+		if (!svc) {
+			logit(LOG_WARNING, "keepalive: PID %d is not a service, ignoring.", pid);
+			return 1;
+		}
+	}
+
+	return service_keepalive(svc);
+}
+
+static void reply_free(struct reply *r)
+{
+	uev_io_stop(&r->watcher);
+	close(r->sd);
+	free(r->buf);
+	free(r);
+}
+
+/*
+ * Send as much of @r as the socket takes.  Returns zero when done, one
+ * if the socket is full, and -1 on error, e.g., a short write.
+ */
+static int reply_send(struct reply *r)
+{
+	while (r->off < r->len) {
+		size_t n = MIN(r->chunk, r->len - r->off);
+		ssize_t rc;
+
+		rc = send(r->sd, &r->buf[r->off], n, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (rc == -1) {
+			if (errno == EINTR)
+				continue;
+			return errno == EAGAIN ? 1 : -1;
+		}
+		if ((size_t)rc != n)
+			return -1;
+
+		r->off += n;
+	}
+
+	return 0;
+}
+
+static void reply_cb(uev_t *w, void *arg, int events)
+{
+	static struct latency lat = { .stat.name = "reply_cb" };
+	struct reply *r = (struct reply *)arg;
+	struct timespec start;
+
+	latency_start(&start);
+	if (UEV_ERROR != events && reply_send(r) == 1)
+		goto done;	/* wait for more room in the socket */
+
+	reply_free(r);
+done:
+	latency_stop(&lat, &start);
+}
+
+/**
+ * api_reply - Send a snapshot of records to an initctl client
+ * @sd:  Client socket, closed when done
+ * @buf: Array of @num records of @sz bytes, from malloc(), freed when done
+ * @num: Number of records
+ * @sz:  Size of each record
+ *
+ * Each message holds whole records, at most %INIT_LOG_CHUNK bytes.  What
+ * does not fit in the socket right away is sent from the event loop, so
+ * a slow reader never blocks PID 1.
+ */
+void api_reply(int sd, void *buf, size_t num, size_t sz)
+{
+	struct reply *r;
+	int rc;
+
+	r = calloc(1, sizeof(*r));
+	if (!r) {
+		free(buf);
+		close(sd);
+		return;
+	}
+
+	r->sd    = sd;
+	r->buf   = buf;
+	r->len   = num * sz;
+	r->chunk = MAX(INIT_LOG_CHUNK / sz, 1) * sz;
+
+	rc = reply_send(r);
+	if (rc == 1 && !uev_io_init(ctx, &r->watcher, reply_cb, r, sd, UEV_WRITE))
+		return;
+	if (rc)
+		_d("Failed sending reply, error %d: %s", errno, strerror(errno));
+
+	close(sd);
+	free(buf);
+	free(r);
+}
+
 static void api_cb(uev_t *w, void *arg, int events)
 {
+	static struct latency lat = { .stat.name = "api_cb" };
 	static svc_t *iter = NULL;
 	struct init_request rq;
-	int sd, lvl;
+	int fds[MAX_NUM_FDSTORE];
+	int sd, lvl, num;
 	svc_t *svc;
+	struct timespec start;
 
+	latency_start(&start);
 	sd = accept(w->fd, NULL, NULL);
 	if (sd < 0) {
 		_pe("Failed serving API request");
@@ -285,7 +548,7 @@ static void api_cb(uev_t *w, void *arg, int events)
 		int result = 0;
 		ssize_t len;
 
-		len = read(sd, &rq, sizeof(rq));
+		len = recv_rq(sd, &rq, fds, &num);
 		if (len <= 0) {
 			if (-1 == len) {
 				if (EINTR == errno)
@@ -302,9 +565,19 @@ static void api_cb(uev_t *w, void *arg, int events)
 
 		if (rq.magic != INIT_MAGIC || len != sizeof(rq)) {
 			_e("Invalid initctl request");
+			drop_fds(fds, &num);
 			break;
 		}
 
+		if (rq.cmd == INIT_CMD_FDSTORE || rq.cmd == INIT_CMD_FDSTORE_CLEAR) {
+			_d("fdstore, %d fds", num);
+			result = do_fdstore(sd, &rq, fds, num);
+			num = 0;
+		}
+
+		/* Drop any fds sent along with other requests */
+		drop_fds(fds, &num);
+
 		switch (rq.cmd) {
 		case INIT_CMD_RUNLVL:
 			switch (rq.runlevel) {
@@ -352,9 +625,12 @@ static void api_cb(uev_t *w, void *arg, int events)
 			break;
 
 		case INIT_CMD_STOP_SVC:
-			_d("stop %s", rq.data);
+			_d("stop %s%s", rq.data, rq.runlevel == 1 ? ", restart" : "");
 			strterm(rq.data, sizeof(rq.data));
-			result = do_stop(rq.data, sizeof(rq.data));
+			if (rq.runlevel == 1)
+				result = do_stop_restart(rq.data, sizeof(rq.data));
+			else
+				result = do_stop(rq.data, sizeof(rq.data));
 			break;
 
 		case INIT_CMD_RELOAD_SVC:
@@ -439,6 +715,69 @@ static void api_cb(uev_t *w, void *arg, int events)
 			send_svc(sd, do_find_byc(rq.data, sizeof(rq.data)));
 			goto leave;
 
+		case INIT_CMD_SVC_KEEPALIVE:
+			strterm(rq.data, sizeof(rq.data));
+			result = do_keepalive(sd, &rq);
+			break;
+
+		case INIT_CMD_SVC_LOG:
+			_d("svc log: %s", rq.data);
+			strterm(rq.data, sizeof(rq.data));
+			svc = do_find(rq.data, sizeof(rq.data));
+			if (!svc || !logmux_has_ring(svc)) {
+				result = 1;
+				break;
+			}
+
+			rq.cmd = INIT_CMD_ACK;
+			if (write(sd, &rq, sizeof(rq)) != sizeof(rq))
+				goto leave;
+
+			/* closes sd, or keeps it for follow mode */
+			logmux_tail(sd, svc, rq.runlevel, rq.sleeptime);
+			goto done;
+
+		case INIT_CMD_LOG_STATS:
+			_d("log stats");
+			rq.cmd = INIT_CMD_ACK;
+			if (write(sd, &rq, sizeof(rq)) != sizeof(rq))
+				goto leave;
+
+			logmux_stats(sd);
+			goto done;
+
+		case INIT_CMD_TRACE:
+			_d("trace, follow: %d", rq.runlevel);
+			rq.cmd = INIT_CMD_ACK;
+			if (write(sd, &rq, sizeof(rq)) != sizeof(rq))
+				goto leave;
+
+			/* closes sd when done, or keeps it for follow mode */
+			trace_send(sd, rq.runlevel);
+			goto done;
+
+		case INIT_CMD_LATENCY:
+			_d("latency stats");
+			rq.cmd = INIT_CMD_ACK;
+			if (write(sd, &rq, sizeof(rq)) != sizeof(rq))
+				goto leave;
+
+			latency_stats(sd);
+			goto done;
+
+		case INIT_CMD_TIMELINE:
+			_d("boot timeline");
+			rq.cmd = INIT_CMD_ACK;
+			if (write(sd, &rq, sizeof(rq)) != sizeof(rq))
+				goto leave;
+
+			timeline_send(sd);
+			goto done;
+
+		case INIT_CMD_FDSTORE:
+		case INIT_CMD_FDSTORE_CLEAR:
+			break;	/* Handled above */
+
 		default:
 			_d("Unsupported cmd: %d", rq.cmd);
 			break;
@@ -455,13 +794,16 @@ static void api_cb(uev_t *w, void *arg, int events)
 
 leave:
 	close(sd);
+done:
 	if (UEV_ERROR == events)
 		goto error;
-	return;
+	goto out;
 error:
 	api_exit();
 	if (api_init(w->ctx))
 		_e("Unrecoverable error on API socket");
+out:
+	latency_stop(&lat, &start);
 }
 
 int api_init(uev_ctx_t *ctx)
@@ -22,6 +22,9 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <lite/lite.h>
@@ -32,20 +35,63 @@
 #include "cgroup.h"
 #include "finit.h"
 #include "iwatch.h"
+#include "latency.h"
 #include "log.h"
+#include "service.h"
 #include "util.h"
 
+/* Buckets in the name and inotify wd indexes, power of two */
+#define CG_HASH_SIZE 512
+
+struct cg;
+
+struct cgleaf {
+	TAILQ_ENTRY(cgleaf) link;
+	LIST_ENTRY(cgleaf)  by_name;
+	LIST_ENTRY(cgleaf)  by_wd;
+
+	struct cg *cg;		/* top-level group */
+	char *name;		/* leaf group name, e.g. service */
+	char *applied;		/* settings written to the kernel */
+	int   cpuset;		/* cpuset.cpus or .mems written */
+	int   fd;		/* open leaf directory */
+	int   evfd;		/* open cgroup.events, or -1 */
+	int   wd;		/* inotify watch of cgroup.events, or -1 */
+};
+
 struct cg {
 	TAILQ_ENTRY(cg) link;
+	LIST_ENTRY(cg)  by_name;
 
 	char *name;		/* top-level group name */
 	char *cfg;		/* kernel settings */
+	char *applied;		/* settings written to the kernel */
+	int   fd;		/* open top-level directory, or -1 */
+	int   evfd;		/* open cgroup.events, or -1 */
+
+	TAILQ_HEAD(, cgleaf) leaves;
 
 	int  active;		/* for mark & sweep */
 	int  is_protected;	/* for init/, user/, & system/ */
 };
 
+/* Services claiming a leaf name, see cgroup_leaf_claim() */
+struct cgclaim {
+	LIST_ENTRY(cgclaim) by_name;
+
+	struct svc **owners;	/* claimants, owners[0] is the owner if refs:1 */
+	int   size;		/* allocated slots in owners[] */
+	int   refs;		/* number of claimants */
+	char  name[];		/* leaf group name */
+};
+
 static TAILQ_HEAD(, cg) cgroups = TAILQ_HEAD_INITIALIZER(cgroups);
+static int cgfd = -1;		/* FINIT_CGPATH */
+
+static LIST_HEAD(, cg)     cg_by_name[CG_HASH_SIZE];
+static LIST_HEAD(, cgleaf) leaf_by_name[CG_HASH_SIZE];
+static LIST_HEAD(, cgleaf) leaf_by_wd[CG_HASH_SIZE];
+static LIST_HEAD(, cgclaim) claim_by_name[CG_HASH_SIZE];
 
 static char controllers[256];
 
@@ -53,21 +99,120 @@ static struct iwatch iw_cgroup;
 static uev_t cgw;
 
 
-static void cgset(const char *path, char *ctrl, char *prop)
+/* Bucket of top-level group @group and, optionally, leaf @name */
+static unsigned int cghash(const char *group, const char *name)
+{
+	uint32_t hash = strhash(group);
+
+	if (name)
+		hash = hash * 31 + strhash(name);
+
+	return hash & (CG_HASH_SIZE - 1);
+}
+
+static struct cg *cgroup_find(char *name)
+{
+	struct cg *cg;
+
+	LIST_FOREACH(cg, &cg_by_name[cghash(name, NULL)], by_name) {
+		if (!strcmp(cg->name, name))
+			return cg;
+	}
+
+	return NULL;
+}
+
+static struct cgleaf *leaf_find(struct cg *cg, const char *name)
+{
+	struct cgleaf *leaf;
+
+	LIST_FOREACH(leaf, &leaf_by_name[cghash(cg->name, name)], by_name) {
+		if (leaf->cg == cg && !strcmp(leaf->name, name))
+			return leaf;
+	}
+
+	return NULL;
+}
+
+static struct cgleaf *leaf_find_wd(int wd)
+{
+	struct cgleaf *leaf;
+
+	LIST_FOREACH(leaf, &leaf_by_wd[wd & (CG_HASH_SIZE - 1)], by_wd) {
+		if (leaf->wd == wd)
+			return leaf;
+	}
+
+	return NULL;
+}
+
+static struct cgclaim *claim_find(const char *name)
 {
+	struct cgclaim *claim;
+
+	LIST_FOREACH(claim, &claim_by_name[cghash(name, NULL)], by_name) {
+		if (!strcmp(claim->name, name))
+			return claim;
+	}
+
+	return NULL;
+}
+
+/* Read populated state from an open cgroup.events, no need to reopen it */
+static int events_populated(int evfd)
+{
+	char buf[128], *ptr;
+	ssize_t len;
+
+	if (evfd == -1)
+		return 0;
+
+	len = pread(evfd, buf, sizeof(buf) - 1, 0);
+	if (len <= 0)
+		return 0;
+	buf[len] = 0;
+
+	ptr = strstr(buf, "populated ");
+	if (!ptr)
+		return 0;
+
+	return atoi(&ptr[10]);
+}
+
+/* Write @val to @file in the cgroup directory @dirfd */
+static int cgwrite(int dirfd, const char *file, const char *val)
+{
+	ssize_t len = strlen(val);
+	int fd, rc = 0;
+
+	fd = openat(dirfd, file, O_WRONLY | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+
+	if (write(fd, val, len) != len)
+		rc = -1;
+	close(fd);
+
+	return rc;
+}
+
+/* Returns POSIX OK(0) if the setting was written, non-zero otherwise */
+static int cgset(int dirfd, const char *path, char *ctrl, char *prop)
+{
+	char file[128];
 	char *val;
 
 	_d("path %s, ctrl %s, prop %s", path ?: "NIL", ctrl ?: "NIL", prop ?: "NIL");
 	if (!path || !ctrl) {
 		_e("Missing path or controller, skipping!");
-		return;
+		return 1;
 	}
 
 	if (!prop) {
 		prop = strchr(ctrl, '.');
 		if (!prop) {
 			_e("Invalid cgroup ctrl syntax: %s", ctrl);
-			return;
+			return 1;
 		}
 
 		*prop++ = 0;
@@ -76,67 +221,299 @@ static void cgset(const char *path, char *ctrl, char *prop)
 	val = strchr(prop, ':');
 	if (!val) {
 		_e("Missing cgroup ctrl value, prop %s", prop);
-		return;
+		return 1;
 	}
 	*val++ = 0;
 
-	/* disallow sneaky relative paths */
-	if (strstr(ctrl, "..") || strstr(prop, "..")) {
-		_e("Possible security violation; '..' not allowed in cgroup config!");
-		return;
+	/* disallow sneaky relative, or absolute, paths */
+	if (strstr(ctrl, "..") || strstr(prop, "..") || strchr(ctrl, '/') || strchr(prop, '/')) {
+		_e("Possible security violation; '..' and '/' not allowed in cgroup config!");
+		return 1;
 	}
 
 	_d("%s/%s.%s <= %s", path, ctrl, prop, val);
-	if (fnwrite(val, "%s/%s.%s", path, ctrl, prop))
-		_pe("Failed setting %s/%s.%s = %s", path, ctrl, prop, val);
+	snprintf(file, sizeof(file), "%s.%s", ctrl, prop);
+	if (cgwrite(dirfd, file, val)) {
+		_pe("Failed setting %s/%s = %s", path, file, val);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Is @setting, e.g., cpu.weight:100, in the comma separated @cfg? */
+static int cfg_has(const char *cfg, const char *setting)
+{
+	size_t len = strlen(setting);
+	const char *ptr = cfg;
+
+	while (ptr && (ptr = strstr(ptr, setting))) {
+		if ((ptr == cfg || ptr[-1] == ',') && (!ptr[len] || ptr[len] == ','))
+			return 1;
+		ptr += len;
+	}
+
+	return 0;
 }
 
 /*
- * Settings for a cgroup are on the form: cpu.weight:1234,mem.max:4321,...
- * Finit supports the short-form 'mem.', replacing it with 'memory.' when
- * writing the setting to the file system.
+ * Open, or create, group @name in the cgroup directory @dirfd.  The
+ * detected controllers are enabled on new domain groups.
  */
-static void group_init(char *path, int leaf, const char *cfg)
+static int group_open(int dirfd, const char *path, const char *name, int leaf)
 {
-	char *ptr, *s;
+	int fd;
 
-	_d("path %s, leaf %d, cfg %s", path, leaf, cfg ?: "NIL");
-	if (!fisdir(path)) {
-		if (mkdir(path, 0755)) {
-			_pe("Failed creating cgroup %s", path);
-			return;
-		}
+	fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd != -1)
+		return fd;
 
-		/* enable detected controllers on domain groups */
-		if (!leaf && fnwrite(controllers, "%s/cgroup.subtree_control", path))
-			_pe("Failed enabling %s for %s", controllers, path);
+	if (mkdirat(dirfd, name, 0755) && errno != EEXIST) {
+		_pe("Failed creating cgroup %s", path);
+		return -1;
 	}
 
+	fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd == -1) {
+		_pe("Failed opening cgroup %s", path);
+		return -1;
+	}
+
+	if (!leaf && cgwrite(fd, "cgroup.subtree_control", controllers))
+		_pe("Failed enabling %s for %s", controllers, path);
+
+	return fd;
+}
+
+/*
+ * Settings for a cgroup are on the form: cpu.weight:1234,mem.max:4321,...
+ * Finit supports the short-form 'mem.', replacing it with 'memory.' when
+ * writing the setting to the file system.  Only settings that differ
+ * from the last @applied are written, and only those that were written
+ * successfully are recorded in @applied, so failed ones are retried.
+ */
+static void group_init(int fd, const char *path, const char *cfg, char **applied)
+{
+	char *ptr, *s, *done = NULL;
+	size_t len = 0;
+
+	_d("path %s, cfg %s, applied %s", path, cfg ?: "NIL", *applied ?: "NIL");
 	if (!cfg || !cfg[0])
-		return;
+		goto done;
 
 	s = strdupa(cfg);
-	if (!s) {
+	done = calloc(1, strlen(cfg) + 1);
+	if (!s || !done) {
 		_pe("Failed activating cgroup cfg for %s", path);
+		free(done);
 		return;
 	}
 
 	_d("%s <=> %s", path, s);
 	ptr = strtok(s, ",");
 	while (ptr) {
+		char *setting = strdupa(ptr);	/* cgset() modifies ptr */
+		int rc = 0;
+
 		_d("ptr: %s", ptr);
-		if (!strncmp("mem.", ptr, 4))
-			cgset(path, "memory", &ptr[4]);
+		if (cfg_has(*applied, ptr))
+			;	/* unchanged since last time */
+		else if (!strncmp("mem.", ptr, 4))
+			rc = cgset(fd, path, "memory", &ptr[4]);
 		else
-			cgset(path, ptr, NULL);
+			rc = cgset(fd, path, ptr, NULL);
+
+		if (!rc)
+			len += snprintf(&done[len], strlen(cfg) + 1 - len, "%s%s", len ? "," : "", setting);
 
 		ptr = strtok(NULL, ",");
 	}
+done:
+	free(*applied);
+	*applied = done && done[0] ? done : NULL;
+	if (!*applied)
+		free(done);
+}
+
+/*
+ * Find cached leaf @name in top-level group @cg, or open/create it.
+ * New leaves are watched for cgroup.events changes.  Leaves are kept
+ * when they become empty, to be reused when the service is restarted.
+ */
+static struct cgleaf *leaf_get(struct cg *cg, char *name, char *path)
+{
+	struct cgleaf *leaf;
+	char fn[256];
+	int fd;
+
+	leaf = leaf_find(cg, name);
+	if (leaf)
+		return leaf;
+
+	fd = group_open(cg->fd, path, name, 1);
+	if (fd == -1)
+		return NULL;
+
+	leaf = calloc(1, sizeof(*leaf));
+	if (!leaf || !(leaf->name = strdup(name))) {
+		_pe("Failed allocating cgroup leaf %s", path);
+		free(leaf);
+		close(fd);
+		return NULL;
+	}
+	leaf->cg   = cg;
+	leaf->fd   = fd;
+	leaf->evfd = openat(fd, "cgroup.events", O_RDONLY | O_CLOEXEC);
+	TAILQ_INSERT_TAIL(&cg->leaves, leaf, link);
+	LIST_INSERT_HEAD(&leaf_by_name[cghash(cg->name, name)], leaf, by_name);
+
+	snprintf(fn, sizeof(fn), "%s/cgroup.events", path);
+	leaf->wd = inotify_add_watch(iw_cgroup.fd, fn, IN_MODIFY);
+	if (leaf->wd < 0)
+		_pe("Failed adding watcher for %s", fn);
+	else
+		LIST_INSERT_HEAD(&leaf_by_wd[leaf->wd & (CG_HASH_SIZE - 1)], leaf, by_wd);
+
+	return leaf;
 }
 
-static int cgroup_leaf_init(char *group, char *name, int pid, const char *cfg)
+static void leaf_unwatch(struct cgleaf *leaf)
 {
+	if (leaf->wd < 0)
+		return;
+
+	LIST_REMOVE(leaf, by_wd);
+	inotify_rm_watch(iw_cgroup.fd, leaf->wd);
+	leaf->wd = -1;
+}
+
+static void leaf_free(struct cgleaf *leaf)
+{
+	leaf_unwatch(leaf);
+	LIST_REMOVE(leaf, by_name);
+	TAILQ_REMOVE(&leaf->cg->leaves, leaf, link);
+
+	if (leaf->evfd != -1)
+		close(leaf->evfd);
+	close(leaf->fd);
+	free(leaf->applied);
+	free(leaf->name);
+	free(leaf);
+}
+
+/*
+ * Remove all empty leaves of @cg, e.g., of stopped or removed services.
+ * Returns the number of leaves remaining.
+ */
+static int leaf_prune(struct cg *cg)
+{
+	struct cgleaf *leaf, *tmp;
+	int num = 0;
+
+	TAILQ_FOREACH_SAFE(leaf, &cg->leaves, link, tmp) {
+		if (events_populated(leaf->evfd) ||
+		    (unlinkat(cg->fd, leaf->name, AT_REMOVEDIR) && errno != ENOENT)) {
+			num++;
+			continue;
+		}
+
+		leaf_free(leaf);
+	}
+
+	return num;
+}
+
+/*
+ * Find top-level group, and optionally leaf, from a path in the cgroup
+ * file system, e.g. /sys/fs/cgroup/system/foo
+ */
+static struct cg *cgroup_find_path(const char *path, struct cgleaf **leaf)
+{
+	char group[64], *name;
+	struct cg *cg;
+	size_t len;
+
+	*leaf = NULL;
+
+	len = strlen(FINIT_CGPATH);
+	if (strncmp(path, FINIT_CGPATH, len) || path[len] != '/')
+		return NULL;
+
+	strlcpy(group, &path[len + 1], sizeof(group));
+	name = strchr(group, '/');
+	if (name)
+		*name++ = 0;
+
+	cg = cgroup_find(group);
+	if (!cg || !name)
+		return cg;
+
+	*leaf = leaf_find(cg, name);
+
+	return cg;
+}
+
+/*
+ * Open @file in the cgroup @path, relative to the cached directory
+ * descriptor if we have one.
+ */
+static int cgroup_open(const char *path, const char *file, int flags)
+{
+	struct cgleaf *leaf;
+	char fn[256];
+
+	if (cgroup_find_path(path, &leaf) && leaf)
+		return openat(leaf->fd, file, flags | O_CLOEXEC);
+
+	snprintf(fn, sizeof(fn), "%s/%s", path, file);
+
+	return open(fn, flags | O_CLOEXEC);
+}
+
+static FILE *cgroup_fopen(const char *path, const char *file)
+{
+	FILE *fp;
+	int fd;
+
+	fd = cgroup_open(path, file, O_RDONLY);
+	if (fd == -1)
+		return NULL;
+
+	fp = fdopen(fd, "r");
+	if (!fp)
+		close(fd);
+
+	return fp;
+}
+
+/*
+ * The cpuset of a leaf is set before any process is moved to it, the
+ * kernel resets the CPU affinity of tasks moved into a cpuset cgroup.
+ * An empty value, here a newline, means inherit from the parent.
+ */
+static void cpuset_init(struct cgleaf *leaf, const char *path, struct cgroup *cg)
+{
+	const char *cpus = cg && cg->cpus[0] ? cg->cpus : "\n";
+	const char *mems = cg && cg->mems[0] ? cg->mems : "\n";
+
+	if (!leaf->cpuset && cpus[0] == '\n' && mems[0] == '\n')
+		return;
+
+	/* mems first, cpuset.cpus may be empty if mems are not set */
+	if (cgwrite(leaf->fd, "cpuset.mems", mems))
+		_pe("Failed setting %s/cpuset.mems = %s", path, mems);
+	if (cgwrite(leaf->fd, "cpuset.cpus", cpus))
+		_pe("Failed setting %s/cpuset.cpus = %s", path, cpus);
+
+	leaf->cpuset = cpus[0] != '\n' || mems[0] != '\n';
+}
+
+static int cgroup_leaf_init(char *group, char *name, int pid, struct cgroup *cgrp)
+{
+	const char *cfg = cgrp ? cgrp->cfg : NULL;
+	struct cgleaf *leaf;
 	char path[256];
+	struct cg *cg;
 
 	_d("group %s, name %s, pid %d, cfg %s", group, name, pid, cfg ?: "NIL");
 	if (pid < 0 || pid == 1) {
@@ -144,17 +521,29 @@ static int cgroup_leaf_init(char *group, char *name, int pid, const char *cfg)
 		return 1;
 	}
 
-	/* create and initialize new group */
-	snprintf(path, sizeof(path), "/sys/fs/cgroup/%s/%s", group, name);
-	group_init(path, 1, cfg);
+	cg = cgroup_find(group);
+	if (!cg || cg->fd == -1) {
+		errno = ENOENT;
+		return 1;
+	}
+
+	/* find, or create, and initialize group */
+	snprintf(path, sizeof(path), FINIT_CGPATH "/%s/%s", group, name);
+	leaf = leaf_get(cg, name, path);
+	if (!leaf)
+		return 1;
+	group_init(leaf->fd, path, cfg, &leaf->applied);
+	cpuset_init(leaf, path, cgrp);
+	if (!pid)
+		return 0;	/* process enters it itself, see cgroup_enter() */
 
 	/* move process to new group */
-	if (fnwrite(str("%d", pid), "%s/cgroup.procs", path))
+	if (cgwrite(leaf->fd, "cgroup.procs", str("%d", pid))) {
 		_pe("Failed moving pid %d to group %s", pid, path);
+		return 1;
+	}
 
-	strlcat(path, "/cgroup.events", sizeof(path));
-
-	return iwatch_add(&iw_cgroup, path, 0);
+	return 0;
 }
 
 int cgroup_user(char *name, int pid)
@@ -162,25 +551,419 @@ int cgroup_user(char *name, int pid)
 	return cgroup_leaf_init("user", name, pid, NULL);
 }
 
+static char *cgroup_group(struct cgroup *cg)
+{
+	struct cg *top;
+
+	if (!cg || !cg->name[0])
+		return "system";
+
+	top = cgroup_find(cg->name);
+	if (!top || top->fd == -1)
+		return "system";
+
+	return cg->name;
+}
+
+/**
+ * cgroup_service - Move a service process to its cgroup
+ * @name: Name of the leaf
+ * @pid:  Process to move, or zero to only create and set up the leaf
+ * @cg:   Service cgroup settings
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero on error.
+ */
 int cgroup_service(char *name, int pid, struct cgroup *cg)
 {
-	char *group = "system";
+	if (!pid && cg && (!strcmp(cg->name, "root") || !strcmp(cg->name, "init")))
+		return 0;
 
 	if (cg && cg->name[0]) {
-		char path[256];
+		struct cg *init;
 
 		if (!strcmp(cg->name, "root"))
-			return fnwrite(str("%d", pid), FINIT_CGPATH "/cgroup.procs");
+			return cgwrite(cgfd, "cgroup.procs", str("%d", pid));
 
-		if (!strcmp(cg->name, "init"))
-			return fnwrite(str("%d", pid), FINIT_CGPATH "/init/cgroup.procs");
+		if (!strcmp(cg->name, "init")) {
+			init = cgroup_find("init");
+			if (!init || init->fd == -1)
+				return 1;
 
-		snprintf(path, sizeof(path), "/sys/fs/cgroup/%s", cg->name);
-		if (fisdir(path))
-			group = cg->name;
+			return cgwrite(init->fd, "cgroup.procs", str("%d", pid));
+		}
 	}
 
-	return cgroup_leaf_init(group, name, pid, cg ? cg->cfg : NULL);
+	return cgroup_leaf_init(cgroup_group(cg), name, pid, cg);
+}
+
+/**
+ * cgroup_enter - Move the calling process to its service cgroup
+ * @name: Name of the leaf, set up by cgroup_service() with pid zero
+ * @cg:   Service cgroup settings
+ *
+ * Called in the child after fork(), before its CPU affinity is set, the
+ * kernel resets the affinity of tasks moved into a cpuset cgroup.
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero on error.
+ */
+int cgroup_enter(char *name, struct cgroup *cg)
+{
+	struct cgleaf *leaf = NULL;
+	struct cg *top;
+	int fd = -1;
+
+	if (cg && !strcmp(cg->name, "root"))
+		fd = cgfd;
+	else if (cg && !strcmp(cg->name, "init")) {
+		top = cgroup_find("init");
+		if (top)
+			fd = top->fd;
+	} else {
+		top = cgroup_find(cgroup_group(cg));
+		if (top)
+			leaf = leaf_find(top, name);
+		if (leaf)
+			fd = leaf->fd;
+	}
+
+	if (fd == -1) {
+		errno = ENOENT;
+		return 1;
+	}
+
+	return cgwrite(fd, "cgroup.procs", "0");
+}
+
+/**
+ * cgroup_leaf - Find path to the leaf cgroup of a service
+ * @name: Name of the leaf, same as for cgroup_service()
+ * @cg:   Service cgroup settings
+ * @path: Buffer to write the path to
+ * @len:  Size of @path
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero if the service runs in the shared
+ * root or init groups, i.e., has no leaf of its own.
+ */
+int cgroup_leaf(char *name, struct cgroup *cg, char *path, size_t len)
+{
+	if (cg && (!strcmp(cg->name, "root") || !strcmp(cg->name, "init")))
+		return 1;
+
+	snprintf(path, len, FINIT_CGPATH "/%s/%s", cgroup_group(cg), name);
+
+	return 0;
+}
+
+/**
+ * cgroup_leaf_claim - Register @owner as a user of leaf @name
+ * @name:  Leaf name, e.g., from the .conf file of the service
+ * @owner: Service claiming the leaf
+ *
+ * Services declared in the same .conf file share a leaf.  The claimants
+ * are kept per leaf so cgroup_leaf_shared() and cgroup_leaf_owner() do
+ * not have to scan all services.  Claiming a leaf twice is a no-op.
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero on error.
+ */
+int cgroup_leaf_claim(const char *name, struct svc *owner)
+{
+	struct cgclaim *claim;
+	size_t len;
+	int i;
+
+	claim = claim_find(name);
+	if (!claim) {
+		len = strlen(name) + 1;
+		claim = calloc(1, sizeof(*claim) + len);
+		if (!claim) {
+			_pe("Failed allocating cgroup leaf claim %s", name);
+			return 1;
+		}
+		memcpy(claim->name, name, len);
+		LIST_INSERT_HEAD(&claim_by_name[cghash(name, NULL)], claim, by_name);
+	}
+
+	for (i = 0; i < claim->refs; i++) {
+		if (claim->owners[i] == owner)
+			return 0;
+	}
+
+	if (claim->refs == claim->size) {
+		struct svc **owners;
+		int size;
+
+		size = claim->size ? claim->size * 2 : 2;
+		owners = realloc(claim->owners, size * sizeof(*owners));
+		if (!owners) {
+			_pe("Failed allocating cgroup leaf claim %s", name);
+			if (!claim->refs) {
+				LIST_REMOVE(claim, by_name);
+				free(claim);
+			}
+			return 1;
+		}
+		claim->owners = owners;
+		claim->size   = size;
+	}
+	claim->owners[claim->refs++] = owner;
+
+	return 0;
+}
+
+/**
+ * cgroup_leaf_release - Drop claim of @owner on leaf @name
+ * @name:  Leaf name, as given to cgroup_leaf_claim()
+ * @owner: Service releasing the leaf
+ *
+ * Releasing a leaf not claimed by @owner, e.g., twice, is a no-op.
+ */
+void cgroup_leaf_release(const char *name, struct svc *owner)
+{
+	struct cgclaim *claim;
+	int i;
+
+	claim = claim_find(name);
+	if (!claim)
+		return;
+
+	for (i = 0; i < claim->refs; i++) {
+		if (claim->owners[i] == owner)
+			break;
+	}
+	if (i == claim->refs)
+		return;
+
+	claim->owners[i] = claim->owners[--claim->refs];
+	if (claim->refs > 0)
+		return;
+
+	LIST_REMOVE(claim, by_name);
+	free(claim->owners);
+	free(claim);
+}
+
+/**
+ * cgroup_leaf_shared - Check if more than one service claims leaf @name
+ * @name: Leaf name, as given to cgroup_leaf_claim()
+ *
+ * Returns:
+ * %TRUE(1) if the leaf is shared, otherwise %FALSE(0).
+ */
+int cgroup_leaf_shared(const char *name)
+{
+	struct cgclaim *claim;
+
+	claim = claim_find(name);
+
+	return claim && claim->refs > 1;
+}
+
+/**
+ * cgroup_leaf_owner - Find the service owning leaf @name
+ * @name: Leaf name, as given to cgroup_leaf_claim()
+ *
+ * Returns:
+ * The service, or %NULL if the leaf is shared or not claimed.
+ */
+struct svc *cgroup_leaf_owner(const char *name)
+{
+	struct cgclaim *claim;
+
+	claim = claim_find(name);
+	if (!claim || claim->refs != 1)
+		return NULL;
+
+	return claim->owners[0];
+}
+
+static pid_t ppid_of(pid_t pid)
+{
+	char fn[32], buf[256], *ptr;
+	pid_t ppid = 0;
+	FILE *fp;
+
+	snprintf(fn, sizeof(fn), "/proc/%d/stat", pid);
+	fp = fopen(fn, "r");
+	if (!fp)
+		return 0;
+
+	/* pid (comm) state ppid ..., where comm may contain spaces */
+	if (fgets(buf, sizeof(buf), fp)) {
+		ptr = strrchr(buf, ')');
+		if (ptr)
+			sscanf(ptr + 1, " %*c %d", &ppid);
+	}
+	fclose(fp);
+
+	return ppid;
+}
+
+/**
+ * cgroup_main_pid - Find main PID of the processes in a leaf cgroup
+ * @path: Path to leaf cgroup, from cgroup_leaf()
+ *
+ * The main PID is the oldest, i.e., lowest PID, of the processes in the
+ * group that does not have its parent in the same group.  For a forking
+ * daemon this is the process that was re-parented to us when the daemon
+ * detached from its launcher.
+ *
+ * Returns:
+ * Main PID, or zero if the group is empty or cannot be read.
+ */
+pid_t cgroup_main_pid(const char *path)
+{
+	pid_t pids[64], mpid = 0;
+	FILE *fp;
+	int i, j, num = 0;
+
+	fp = cgroup_fopen(path, "cgroup.procs");
+	if (!fp)
+		return 0;
+
+	while (num < (int)NELEMS(pids) && fscanf(fp, "%d", &pids[num]) == 1)
+		num++;
+	fclose(fp);
+
+	for (i = 0; i < num; i++) {
+		pid_t ppid = ppid_of(pids[i]);
+
+		for (j = 0; j < num; j++) {
+			if (pids[j] == ppid)
+				break;
+		}
+		if (j < num)
+			continue;	/* parent in same group */
+
+		if (!mpid || pids[i] < mpid)
+			mpid = pids[i];
+	}
+
+	if (!mpid && num > 0)
+		mpid = pids[0];
+
+	return mpid;
+}
+
+/**
+ * cgroup_populated - Check if a leaf cgroup has any processes left
+ * @path: Path to leaf cgroup, from cgroup_leaf()
+ *
+ * Returns:
+ * %TRUE(1) if populated, %FALSE(0) if empty or missing.
+ */
+int cgroup_populated(const char *path)
+{
+	struct cgleaf *leaf;
+	int populated = 0;
+	char buf[80];
+	FILE *fp;
+
+	if (cgroup_find_path(path, &leaf) && leaf && leaf->evfd != -1)
+		return events_populated(leaf->evfd);
+
+	fp = cgroup_fopen(path, "cgroup.events");
+	if (!fp)
+		return 0;
+
+	while (fgets(buf, sizeof(buf), fp)) {
+		if (strncmp(buf, "populated ", 10))
+			continue;
+
+		populated = atoi(&buf[10]);
+		break;
+	}
+	fclose(fp);
+
+	return populated;
+}
+
+/**
+ * cgroup_signal - Send a signal to all processes in a leaf cgroup
+ * @path:  Path to leaf cgroup, from cgroup_leaf()
+ * @signo: Signal to send
+ *
+ * Unlike a process group, this also reaches processes that have called
+ * setsid(), or otherwise left the process group of the service.
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero on error, e.g., no such group.
+ */
+int cgroup_signal(const char *path, int signo)
+{
+	FILE *fp;
+	pid_t pid;
+
+	fp = cgroup_fopen(path, "cgroup.procs");
+	if (!fp)
+		return 1;
+
+	while (fscanf(fp, "%d", &pid) == 1) {
+		if (pid > 1)
+			kill(pid, signo);
+	}
+	fclose(fp);
+
+	return 0;
+}
+
+/**
+ * cgroup_kill - Send SIGKILL to all processes in a leaf cgroup
+ * @path: Path to leaf cgroup, from cgroup_leaf()
+ *
+ * Uses cgroup.kill, Linux 5.14, which also reaches processes forked
+ * while killing.  On older kernels each process in cgroup.procs is
+ * sent SIGKILL, see cgroup_signal().
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero on error, e.g., no such group.
+ */
+int cgroup_kill(const char *path)
+{
+	int fd;
+
+	fd = cgroup_open(path, "cgroup.kill", O_WRONLY);
+	if (fd != -1) {
+		ssize_t len = write(fd, "1", 1);
+
+		close(fd);
+		if (len == 1)
+			return 0;
+	}
+
+	return cgroup_signal(path, SIGKILL);
+}
+
+/**
+ * cgroup_oom_kills - Number of processes in a cgroup killed by the OOM killer
+ * @path: Path to leaf cgroup, from cgroup_leaf()
+ *
+ * Returns:
+ * The oom_kill counter from memory.events, or zero if not available.
+ */
+int cgroup_oom_kills(const char *path)
+{
+	char buf[80];
+	int num = 0;
+	FILE *fp;
+
+	fp = cgroup_fopen(path, "memory.events");
+	if (!fp)
+		return 0;
+
+	while (fgets(buf, sizeof(buf), fp)) {
+		if (strncmp(buf, "oom_kill ", 9))
+			continue;
+
+		num = atoi(&buf[9]);
+		break;
+	}
+	fclose(fp);
+
+	return num;
 }
 
 static void append_ctrl(char *ctrl)
@@ -192,70 +975,83 @@ static void append_ctrl(char *ctrl)
 	strlcat(controllers, ctrl, sizeof(controllers));
 }
 
+/*
+ * A leaf cgroup is no longer populated, tell the service.  The empty
+ * leaf is kept for reuse when the service is restarted.
+ */
+static void leaf_event(struct cgleaf *leaf, uint32_t mask)
+{
+	struct cg *cg = leaf->cg;
+	char path[256];
+
+	_d("leaf: %s/%s, mask: %08x", cg->name, leaf->name, mask);
+	if (mask & IN_IGNORED) {
+		/* removed behind our back, forget it */
+		if (leaf->wd >= 0)
+			LIST_REMOVE(leaf, by_wd);
+		leaf->wd = -1;
+		leaf_free(leaf);
+		return;
+	}
+
+	if (!(mask & IN_MODIFY) || events_populated(leaf->evfd))
+		return;
+
+	snprintf(path, sizeof(path), FINIT_CGPATH "/%s/%s", cg->name, leaf->name);
+	service_cgroup_empty(path);
+
+	/* try with top-level group, we may get events out-of-order *sigh* */
+	if (!cg->active) {
+		snprintf(path, sizeof(path), FINIT_CGPATH "/%s", cg->name);
+		cgroup_del(path);
+	}
+}
+
+/* Top-level group no longer populated, remove it if inactive */
 static void cgroup_handle_event(char *event, uint32_t mask)
 {
 	char path[strlen(event) + 1];
-	char buf[80];
+	struct cgleaf *leaf;
+	struct cg *cg;
 	char *ptr;
-	FILE *fp;
 
 	_d("event: '%s', mask: %08x", event, mask);
 	if (!(mask & IN_MODIFY))
 		return;
 
-	fp = fopen(event, "r");
-	if (!fp) {
-		_d("Failed opening %s, skipping ...", event);
+	strlcpy(path, event, sizeof(path));
+	ptr = strrchr(path, '/');
+	if (!ptr)
 		return;
-	}
-
-	while (fgets(buf, sizeof(buf), fp)) {
-		if (strncmp(buf, "populated", 9))
-			continue;
-
-		chomp(buf);
-		if (atoi(&buf[10]))
-			break;
-
-		strlcpy(path, event, sizeof(path));
-		ptr = strrchr(path, '/');
-		if (ptr) {
-			*ptr = 0;
-			if (!cgroup_del(path)) {
-				/*
-				 * try with parent, top-level group, we
-				 * may get events out-of-order *sigh*
-				 */
-				ptr = strrchr(path, '/');
-				if (!ptr)
-					break;
-				*ptr = 0;
-				cgroup_del(path);
-			}
-		}
+	*ptr = 0;
 
-		break;
-	}
+	cg = cgroup_find_path(path, &leaf);
+	if (!cg || leaf || events_populated(cg->evfd))
+		return;
 
-	fclose(fp);
+	cgroup_del(path);
 }
 
 static void cgroup_events_cb(uev_t *w, void *arg, int events)
 {
+	static struct latency lat = { .stat.name = "cgroup_events_cb" };
 	static char ev_buf[8 *(sizeof(struct inotify_event) + NAME_MAX + 1) + 1];
 	struct inotify_event *ev;
 	ssize_t sz;
 	size_t off;
+	struct timespec start;
 
+	latency_start(&start);
 	sz = read(w->fd, ev_buf, sizeof(ev_buf) - 1);
 	if (sz <= 0) {
 		_pe("invalid inotify event");
-		return;
+		goto done;
 	}
 	ev_buf[sz] = 0;
 
 	for (off = 0; off < (size_t)sz; off += sizeof(*ev) + ev->len) {
 		struct iwatch_path *iwp;
+		struct cgleaf *leaf;
 
 		if (off + sizeof(*ev) > (size_t)sz)
 			break;
@@ -267,6 +1063,12 @@ static void cgroup_events_cb(uev_t *w, void *arg, int events)
 		if (!ev->mask)
 			continue;
 
+		leaf = leaf_find_wd(ev->wd);
+		if (leaf) {
+			leaf_event(leaf, ev->mask);
+			continue;
+		}
+
 		/* Find base path for this event */
 		iwp = iwatch_find_by_wd(&iw_cgroup, ev->wd);
 		if (!iwp || !iwp->path)
@@ -279,20 +1081,8 @@ static void cgroup_events_cb(uev_t *w, void *arg, int events)
 	if (conf_any_change())
 		service_reload_dynamic();
 #endif
-}
-
-static struct cg *cgroup_find(char *name)
-{
-	struct cg *cg;
-
-	TAILQ_FOREACH(cg, &cgroups, link) {
-		if (strcmp(cg->name, name))
-			continue;
-
-		return cg;
-	}
-
-	return NULL;
+done:
+	latency_stop(&lat, &start);
 }
 
 /*
@@ -311,7 +1101,7 @@ void cgroup_mark_all(void)
 }
 
 /*
- * Remove (try to) all unused cgroups
+ * Remove (try to) all unused cgroups, and all empty leaves
  */
 void cgroup_cleanup(void)
 {
@@ -319,8 +1109,10 @@ void cgroup_cleanup(void)
 	char path[256];
 
 	TAILQ_FOREACH_SAFE(cg, &cgroups, link, tmp) {
-		if (cg->active)
+		if (cg->active) {
+			leaf_prune(cg);
 			continue;
+		}
 
 		snprintf(path, sizeof(path), FINIT_CGPATH "/%s", cg->name);
 		cgroup_del(path);
@@ -341,11 +1133,13 @@ int cgroup_add(char *name, char *cfg, int is_protected)
 
 	cg = cgroup_find(name);
 	if (!cg) {
-		cg = malloc(sizeof(struct cg));
+		cg = calloc(1, sizeof(struct cg));
 		if (!cg) {
 			_pe("Failed allocating 'struct cg' for %s", name);
 			return -1;
 		}
+		cg->fd = cg->evfd = -1;
+		TAILQ_INIT(&cg->leaves);
 		cg->name = strdup(name);
 		if (!cg->name) {
 			_pe("Failed setting cgroup name %s", name);
@@ -353,6 +1147,7 @@ int cgroup_add(char *name, char *cfg, int is_protected)
 			return -1;
 		}
 		TAILQ_INSERT_TAIL(&cgroups, cg, link);
+		LIST_INSERT_HEAD(&cg_by_name[cghash(name, NULL)], cg, by_name);
 	} else
 		free(cg->cfg);
 
@@ -360,6 +1155,7 @@ int cgroup_add(char *name, char *cfg, int is_protected)
 	if (!cg->cfg) {
 		_pe("Failed add/update of cgroup %s", name);
 		TAILQ_REMOVE(&cgroups, cg, link);
+		LIST_REMOVE(cg, by_name);
 		free(cg->name);
 		free(cg);
 		return -1;
@@ -371,22 +1167,21 @@ int cgroup_add(char *name, char *cfg, int is_protected)
 }
 
 /*
- * Remove inactive top-level cgroup
+ * Remove leaf cgroup, or inactive top-level cgroup
  */
 int cgroup_del(char *dir)
 {
+	struct cgleaf *leaf;
 	struct cg *cg;
-	char path[256];
-
-	TAILQ_FOREACH(cg, &cgroups, link) {
-		snprintf(path, sizeof(path), FINIT_CGPATH "/%s", cg->name);
-		if (strcmp(path, dir))
-			continue;
 
+	cg = cgroup_find_path(dir, &leaf);
+	if (cg && !leaf) {
 		if (cg->active)
 			return -1;
 
-		break;
+		/* empty leaves kept for reuse must go first */
+		if (cg->fd != -1)
+			leaf_prune(cg);
 	}
 
 	if (rmdir(dir) && errno != ENOENT) {
@@ -394,8 +1189,19 @@ int cgroup_del(char *dir)
 		return -1;
 	}
 
-	if (cg) {
+	if (leaf) {
+		leaf_free(leaf);
+	} else if (cg) {
+		while ((leaf = TAILQ_FIRST(&cg->leaves)))
+			leaf_free(leaf);
+
 		TAILQ_REMOVE(&cgroups, cg, link);
+		LIST_REMOVE(cg, by_name);
+		if (cg->evfd != -1)
+			close(cg->evfd);
+		if (cg->fd != -1)
+			close(cg->fd);
+		free(cg->applied);
 		free(cg->name);
 		free(cg->cfg);
 		free(cg);
@@ -409,6 +1215,9 @@ void cgroup_config(void)
 {
 	struct cg *cg;
 
+	if (cgfd == -1)
+		return;
+
 	TAILQ_FOREACH(cg, &cgroups, link) {
 		char path[256];
 		int leaf = 0;
@@ -419,10 +1228,19 @@ void cgroup_config(void)
 			leaf = 1;	/* reserved */
 
 		snprintf(path, sizeof(path), "%s/%s", FINIT_CGPATH, cg->name);
-		group_init(path, leaf, cg->cfg);
+		if (cg->fd == -1) {
+			char fn[256];
 
-		strlcat(path, "/cgroup.events", sizeof(path));
-		iwatch_add(&iw_cgroup, path, 0);
+			cg->fd = group_open(cgfd, path, cg->name, leaf);
+			if (cg->fd == -1)
+				continue;
+			cg->evfd = openat(cg->fd, "cgroup.events", O_RDONLY | O_CLOEXEC);
+
+			snprintf(fn, sizeof(fn), "%s/cgroup.events", path);
+			iwatch_add(&iw_cgroup, fn, 0);
+		}
+
+		group_init(cg->fd, path, cg->cfg, &cg->applied);
 	}
 }
 
@@ -432,6 +1250,7 @@ void cgroup_config(void)
 void cgroup_init(uev_ctx_t *ctx)
 {
 	int opts = MS_NODEV | MS_NOEXEC | MS_NOSUID;
+	struct cg *cg;
 	char buf[80];
 	FILE *fp;
 	int fd;
@@ -441,8 +1260,14 @@ void cgroup_init(uev_ctx_t *ctx)
 		return;
 	}
 
+	cgfd = open(FINIT_CGPATH, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (cgfd == -1) {
+		_pe("Failed opening %s", FINIT_CGPATH);
+		return;
+	}
+
 	/* Find available controllers */
-	fp = fopen(FINIT_CGPATH "/cgroup.controllers", "r");
+	fp = cgroup_fopen(FINIT_CGPATH, "cgroup.controllers");
 	if (!fp) {
 		_pe("Failed opening %s", FINIT_CGPATH "/cgroup.controllers");
 		return;
@@ -461,9 +1286,16 @@ void cgroup_init(uev_ctx_t *ctx)
 	fclose(fp);
 
 	/* Enable all controllers */
-	if (fnwrite(controllers, FINIT_CGPATH "/cgroup.subtree_control"))
+	if (cgwrite(cgfd, "cgroup.subtree_control", controllers))
 		_pe("Failed enabling %s for %s", controllers, FINIT_CGPATH "/cgroup.subtree_control");
 
+	/* prepare cgroup.events watcher, before any groups are added */
+	fd = iwatch_init(&iw_cgroup);
+	if (uev_io_init(ctx, &cgw, cgroup_events_cb, NULL, fd, UEV_READ)) {
+		_pe("Failed setting up cgroup.events watcher");
+		close(fd);
+	}
+
 	/* Default (protected) groups, PID 1, services, and user/login processes */
 	cgroup_add("init",   "cpu.weight:100",  1);
 	cgroup_add("system", "cpu.weight:9800", 1);
@@ -471,15 +1303,9 @@ void cgroup_init(uev_ctx_t *ctx)
 	cgroup_config();
 
 	/* Move ourselves to init (best effort, otherwise run in 'root' group */
-	if (fnwrite("1", FINIT_CGPATH "/init/cgroup.procs"))
+	cg = cgroup_find("init");
+	if (!cg || cg->fd == -1 || cgwrite(cg->fd, "cgroup.procs", "1"))
 		_pe("Failed moving PID 1 to cgroup ", FINIT_CGPATH "/init");
-
-	/* prepare cgroup.events watcher */
-	fd = iwatch_init(&iw_cgroup);
-	if (uev_io_init(ctx, &cgw, cgroup_events_cb, NULL, fd, UEV_READ)) {
-		_pe("Failed setting up cgroup.events watcher");
-		close(fd);
-	}
 }
 
 /**
@@ -24,11 +24,17 @@
 #ifndef FINIT_CGROUP_H_
 #define FINIT_CGROUP_H_
 
+#include <sys/types.h>
 #include <uev/uev.h>
 
+struct svc;
+
 struct cgroup {
 	char name[16];
 	char cfg[128];
+	char cpus[64];		/* cpuset.cpus, from cpus:LIST or numa:NODES */
+	char mems[32];		/* cpuset.mems, from numa:NODES */
+	char leaf[64];		/* leaf name, see cgroup_leaf_claim() */
 };
 
 void cgroup_mark_all(void);
@@ -42,5 +48,16 @@ void cgroup_init    (uev_ctx_t *ctx);
 
 int  cgroup_user    (char *name, int pid);
 int  cgroup_service (char *name, int pid, struct cgroup *cg);
+int  cgroup_enter   (char *name, struct cgroup *cg);
+int  cgroup_leaf    (char *name, struct cgroup *cg, char *path, size_t len);
+int  cgroup_leaf_claim  (const char *name, struct svc *owner);
+void cgroup_leaf_release(const char *name, struct svc *owner);
+int  cgroup_leaf_shared (const char *name);
+struct svc *cgroup_leaf_owner(const char *name);
+pid_t cgroup_main_pid(const char *path);
+int  cgroup_populated(const char *path);
+int  cgroup_signal  (const char *path, int signo);
+int  cgroup_kill    (const char *path);
+int  cgroup_oom_kills(const char *path);
 
 #endif /* FINIT_CGROUP_H_ */
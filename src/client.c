@@ -24,6 +24,7 @@
 #include <err.h>
 #include <errno.h>
 #include <poll.h>
+#include <string.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 
@@ -63,12 +64,43 @@ int client_disconnect(void)
 	return rc;
 }
 
-int client_send(struct init_request *rq, ssize_t len)
+/*
+ * Send request and wait for reply, any descriptors in @fds are passed
+ * along with the request using SCM_RIGHTS, e.g. for INIT_CMD_FDSTORE
+ */
+int client_send_fds(struct init_request *rq, ssize_t len, int fds[], int num)
 {
+	char cbuf[CMSG_SPACE(sizeof(int) * MAX_NUM_FDSTORE)] = { 0 };
+	struct iovec iov = {
+		.iov_base = rq,
+		.iov_len  = len,
+	};
+	struct msghdr msg = {
+		.msg_iov    = &iov,
+		.msg_iovlen = 1,
+	};
 	struct pollfd pfd = { 0 };
 	int sd, result = 255;
 	int rc;
 
+	if (num > MAX_NUM_FDSTORE) {
+		errno = E2BIG;
+		return -1;
+	}
+
+	if (num > 0) {
+		struct cmsghdr *cmsg;
+
+		msg.msg_control    = cbuf;
+		msg.msg_controllen = CMSG_SPACE(sizeof(int) * num);
+
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type  = SCM_RIGHTS;
+		cmsg->cmsg_len   = CMSG_LEN(sizeof(int) * num);
+		memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * num);
+	}
+
 	sd = client_connect();
 	if (-1 == sd)
 		return -1;
@@ -80,7 +112,7 @@ int client_send(struct init_request *rq, ssize_t len)
 		goto exit;
 	}
 
-	if (write(sd, rq, len) != len) {
+	if (sendmsg(sd, &msg, 0) != len) {
 		warn("Failed communicating with Finit, errno %d", errno);
 		goto exit;
 	}
@@ -110,6 +142,11 @@ exit:
 	return result;
 }
 
+int client_send(struct init_request *rq, ssize_t len)
+{
+	return client_send_fds(rq, len, NULL, 0);
+}
+
 svc_t *client_svc_iterator(int first)
 {
 	int sd = -1;
@@ -30,6 +30,8 @@
 #include "cond.h"
 #include "pid.h"
 #include "service.h"
+#include "timeline.h"
+#include "trace.h"
 
 /*
  * The service condition name is constructed from the 'pid/' prefix and
@@ -160,6 +162,12 @@ int cond_set_path(const char *path, enum cond_state next)
 		return 0;
 	}
 
+	if (next != prev) {
+		trace_cond(path, prev, next);
+		if (next == COND_ON)
+			timeline_mark(TIMELINE_COND, cond_name(path));
+	}
+
 	return next != prev;
 }
 
@@ -220,6 +228,7 @@ int cond_set_oneshot_noupdate(const char *name)
 		_pe("Failed creating onshot cond %s", name);
 		return 1;
 	}
+	timeline_mark(TIMELINE_COND, name);
 
 	return 0;
 }
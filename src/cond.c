@@ -50,6 +50,18 @@ const char *cond_path(const char *name)
 	return pid_runpath(tmp, path, sizeof(path));
 }
 
+/* Name of condition from its path, reverse of cond_path() */
+const char *cond_name(const char *path)
+{
+	const char *name;
+
+	name = strstr(path, COND_BASE "/");
+	if (!name)
+		return path;
+
+	return name + strlen(COND_BASE "/");
+}
+
 unsigned int cond_get_gen(const char *file)
 {
 	char *ptr, path[256];
@@ -25,6 +25,7 @@ typedef enum cond_state {
 char           *mkcond       (svc_t *svc, char *buf, size_t len);
 const char     *condstr      (enum cond_state s);
 const char     *cond_path    (const char *name);
+const char     *cond_name    (const char *path);
 unsigned int    cond_get_gen (const char *path);
 enum cond_state cond_get_path(const char *path);
 enum cond_state cond_get     (const char *name);
@@ -36,6 +36,9 @@
 #include "finit.h"
 #include "cond.h"
 #include "iwatch.h"
+#include "latency.h"
+#include "logstore.h"
+#include "pressure.h"
 #include "service.h"
 #include "tty.h"
 #include "helpers.h"
@@ -48,6 +51,8 @@
 int logfile_size_max = 200000;	/* 200 kB */
 int logfile_count_max = 5;
 
+extern int logrotate_codec(char *name, int lvl);
+
 struct rlimit initial_rlimit[RLIMIT_NLIMITS];
 struct rlimit global_rlimit[RLIMIT_NLIMITS];
 
@@ -503,8 +508,9 @@ static void parse_static(char *line, int is_rcsd)
 	}
 
 	if (MATCH_CMD(line, "log ", x)) {
-		char *tok;
+		char *tok, *codec = "gzip";
 		static int size = 200000, count = 5;
+		int level = 0;
 
 		tok = strtok(x, ":= ");
 		while (tok) {
@@ -512,6 +518,10 @@ static void parse_static(char *line, int is_rcsd)
 				size = strtobytes(strtok(NULL, ":= "));
 			else if (!strncmp(tok, "count", 5))
 				count = strtobytes(strtok(NULL, ":= "));
+			else if (!strncmp(tok, "compress", 8))
+				codec = strtok(NULL, ":= ") ?: "gzip";
+			else if (!strncmp(tok, "level", 5))
+				level = atoi(strtok(NULL, ":= ") ?: "0");
 
 			tok = strtok(NULL, ":= ");
 		}
@@ -520,6 +530,54 @@ static void parse_static(char *line, int is_rcsd)
 			logfile_size_max = size;
 		if (count >= 0)
 			logfile_count_max = count;
+		if (logrotate_codec(codec, level)) {
+			logit(LOG_WARNING, "Unsupported log compress:%s level:%d, using none", codec, level);
+			logrotate_codec("none", 0);
+		}
+	}
+
+	/* Indexed binary store of service output, for initctl log --since */
+	if (MATCH_CMD(line, "logstore ", x)) {
+		logstore_parse(strip_line(x));
+		return;
+	}
+
+	/*
+	 * Overall deadline for stopping all services and processes at
+	 * shutdown/reboot, remaining processes are then killed.
+	 */
+	if (MATCH_CMD(line, "shutdown-timeout ", x)) {
+		const char *err = NULL;
+		int tmo;
+
+		tmo = strtonum(strip_line(x), 1, 300, &err);
+		if (err)
+			_e("Invalid shutdown-timeout %s: %s", x, err);
+		else
+			sdown_tmo = tmo;
+		return;
+	}
+
+	/*
+	 * Log callbacks, hooks, and run commands that keep PID 1 from
+	 * handling other events for longer than this, zero disables.
+	 */
+	if (MATCH_CMD(line, "latency-warn ", x)) {
+		const char *err = NULL;
+		int msec;
+
+		msec = strtonum(strip_line(x), 0, 3600000, &err);
+		if (err)
+			_e("Invalid latency-warn %s: %s", x, err);
+		else
+			latency_warn = msec;
+		return;
+	}
+
+	/* Defer service starts while system is under pressure */
+	if (MATCH_CMD(line, "pressure ", x)) {
+		pressure_parse(strip_line(x));
+		return;
 	}
 
 	if (MATCH_CMD(line, "shutdown ", x)) {
@@ -672,6 +730,10 @@ int conf_reload(void)
 	 */
 	memcpy(global_rlimit, initial_rlimit, sizeof(global_rlimit));
 
+	/* Settings not in any .conf file revert to defaults */
+	logstore_reset();
+	pressure_reset();
+
 	if (rescue) {
 		int rc;
 		char line[80] = "tty [12345] rescue";
@@ -748,6 +810,12 @@ done:
 	/* Remove all unused top-level cgroups */
 	cgroup_cleanup();
 
+	/* Enable, move, or disable the log store */
+	logstore_config();
+
+	/* Re-arm changed pressure thresholds, disable removed ones */
+	pressure_config();
+
 	/* Drop record of all .conf changes */
 	drop_changes();
 
@@ -859,15 +927,18 @@ int conf_changed(char *file)
 
 static void conf_cb(uev_t *w, void *arg, int events)
 {
+	static struct latency lat = { .stat.name = "conf_cb" };
 	static char ev_buf[8 *(sizeof(struct inotify_event) + NAME_MAX + 1) + 1];
 	struct inotify_event *ev;
 	ssize_t sz;
 	size_t off;
+	struct timespec start;
 
+	latency_start(&start);
 	sz = read(w->fd, ev_buf, sizeof(ev_buf) - 1);
 	if (sz <= 0) {
 		_pe("invalid inotify event");
-		return;
+		goto done;
 	}
 	ev_buf[sz] = 0;
 
@@ -901,6 +972,8 @@ static void conf_cb(uev_t *w, void *arg, int events)
 	if (conf_any_change())
 		service_reload_dynamic();
 #endif
+done:
+	latency_stop(&lat, &start);
 }
 
 /*
@@ -0,0 +1,231 @@
+/* Deadlines of all services on one shared timer, min-heap ordered
+ *
+ * Copyright (c) 2021  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+#include <uev/uev.h>
+
+#include "finit.h"
+#include "deadline.h"
+#include "latency.h"
+#include "log.h"
+
+/*
+ * With one timerfd per service for each of health probe interval, probe
+ * timeout, and watchdog, the number of descriptors in the event loop
+ * grew with the number of services.  Instead, all deadlines are kept in
+ * a binary min-heap and a single timer is armed for the earliest one.
+ */
+static struct deadline **heap;
+static int heap_len;
+static int heap_max;
+static uev_t timer;
+static int timer_init;
+
+static void deadline_cb(uev_t *w, void *arg, int events);
+
+static long long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Heap helpers, 1-based so that parent of N is N/2, children 2N, 2N+1 */
+static void place(struct deadline *dl, int pos)
+{
+	heap[pos] = dl;
+	dl->pos = pos;
+}
+
+static void sift_up(int pos)
+{
+	struct deadline *dl = heap[pos];
+
+	while (pos > 1 && heap[pos / 2]->expires > dl->expires) {
+		place(heap[pos / 2], pos);
+		pos /= 2;
+	}
+	place(dl, pos);
+}
+
+static void sift_down(int pos)
+{
+	struct deadline *dl = heap[pos];
+
+	while (2 * pos <= heap_len) {
+		int child = 2 * pos;
+
+		if (child < heap_len && heap[child + 1]->expires < heap[child]->expires)
+			child++;
+		if (heap[child]->expires >= dl->expires)
+			break;
+
+		place(heap[child], pos);
+		pos = child;
+	}
+	place(dl, pos);
+}
+
+/* Remove @dl from the heap, the last entry takes its place */
+static void heap_del(struct deadline *dl)
+{
+	int pos = dl->pos;
+	struct deadline *last;
+
+	last = heap[heap_len--];
+	dl->pos = 0;
+	if (last == dl)
+		return;
+
+	place(last, pos);
+	if (pos > 1 && heap[pos / 2]->expires > last->expires)
+		sift_up(pos);
+	else
+		sift_down(pos);
+}
+
+/* Arm the shared timer for the earliest deadline, if any */
+static void rearm(void)
+{
+	long long msec;
+
+	if (!heap_len) {
+		if (timer_init)
+			uev_timer_stop(&timer);
+		return;
+	}
+
+	/* timeout 0 disarms a timerfd, expired deadlines are due now */
+	msec = heap[1]->expires - now_ms();
+	if (msec < 1)
+		msec = 1;
+
+	if (!timer_init) {
+		if (uev_timer_init(ctx, &timer, deadline_cb, NULL, (int)msec, 0)) {
+			_pe("Failed creating deadline timer");
+			return;
+		}
+		timer_init = 1;
+	} else
+		uev_timer_set(&timer, (int)msec, 0);
+}
+
+/*
+ * Call all expired deadlines.  Each one is removed before its callback,
+ * which may re-arm it, or arm and stop any others.
+ */
+static void deadline_cb(uev_t *w, void *arg, int events)
+{
+	static struct latency lat = { .stat.name = "deadline_cb" };
+	long long now = now_ms();
+	struct timespec start;
+
+	latency_start(&start);
+	while (heap_len && heap[1]->expires <= now) {
+		struct deadline *dl = heap[1];
+
+		heap_del(dl);
+		dl->cb(dl->arg);
+	}
+
+	rearm();
+
+	latency_stop(&lat, &start);
+}
+
+/**
+ * deadline_arm - Arm, or re-arm, a deadline
+ * @dl:   Deadline, zeroed or previously armed
+ * @msec: Time from now until @cb is called
+ * @cb:   Callback, called once, from the event loop
+ * @arg:  Argument to @cb
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero on error.
+ */
+int deadline_arm(struct deadline *dl, int msec, void (*cb)(void *), void *arg)
+{
+	dl->expires = now_ms() + msec;
+	dl->cb      = cb;
+	dl->arg     = arg;
+
+	if (dl->pos) {
+		int pos = dl->pos;
+
+		if (pos > 1 && heap[pos / 2]->expires > dl->expires)
+			sift_up(pos);
+		else
+			sift_down(pos);
+	} else {
+		if (heap_len + 1 >= heap_max) {
+			int max = heap_max ? heap_max * 2 : 64;
+			struct deadline **tmp;
+
+			tmp = realloc(heap, max * sizeof(*heap));
+			if (!tmp) {
+				_pe("Failed growing deadline heap");
+				return errno = ENOMEM;
+			}
+			heap = tmp;
+			heap_max = max;
+		}
+
+		heap[++heap_len] = dl;
+		sift_up(heap_len);
+	}
+
+	if (dl->pos == 1)
+		rearm();
+
+	return 0;
+}
+
+/**
+ * deadline_stop - Disarm a deadline
+ * @dl: Deadline, may already be disarmed
+ */
+void deadline_stop(struct deadline *dl)
+{
+	int first;
+
+	if (!dl->pos)
+		return;
+
+	first = dl->pos == 1;
+	heap_del(dl);
+	if (first)
+		rearm();
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,53 @@
+/* Deadlines of all services on one shared timer, min-heap ordered
+ *
+ * Copyright (c) 2021  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef FINIT_DEADLINE_H_
+#define FINIT_DEADLINE_H_
+
+/*
+ * A deadline, e.g., a health probe interval or a watchdog keepalive, is
+ * embedded in its owner.  Zeroed means not armed, so no init is needed.
+ */
+struct deadline {
+	long long      expires;		/* msec, CLOCK_MONOTONIC */
+	int            pos;		/* 1-based position in heap, 0: not armed */
+	void         (*cb)(void *arg);
+	void          *arg;
+};
+
+int  deadline_arm   (struct deadline *dl, int msec, void (*cb)(void *), void *arg);
+void deadline_stop  (struct deadline *dl);
+
+static inline int deadline_active(struct deadline *dl)
+{
+	return dl->pos > 0;
+}
+
+#endif /* FINIT_DEADLINE_H_ */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -40,6 +40,7 @@
 #include "cgroup.h"
 #include "conf.h"
 #include "helpers.h"
+#include "latency.h"
 #include "sig.h"
 #include "util.h"
 #include "utmp-api.h"
@@ -70,6 +71,7 @@ int run(char *cmd)
 {
 	int status, result, i = 0;
 	char *args[NUM_ARGS + 1], *arg, *backup;
+	struct timespec start;
 	pid_t pid;
 
 	/* We must create a copy that is possible to modify. */
@@ -104,6 +106,7 @@ int run(char *cmd)
 		return 1;
 	}
 
+	latency_start(&start);
 	pid = fork();
 	if (0 == pid) {
 		FILE *fp;
@@ -131,7 +134,9 @@ int run(char *cmd)
 		return -1;
 	}
 
+	/* PID 1 is blocked until the command completes */
 	status = complete(args[0], pid);
+	latency_stop(latency_get("run:%s", basename(args[0])), &start);
 	if (-1 == status) {
 		free(backup);
 		return 1;
@@ -48,6 +48,7 @@
 #include "service.h"
 #include "sig.h"
 #include "sm.h"
+#include "timeline.h"
 #include "tty.h"
 #include "util.h"
 #include "utmp-api.h"
@@ -62,6 +63,7 @@ int   rescue    = 0;		/* rescue mode from kernel cmdline */
 int   single    = 0;		/* single user mode from kernel cmdline */
 int   bootstrap = 1;		/* set while bootrapping (for TTYs) */
 char *sdown     = NULL;
+int   sdown_tmo = 10;		/* shutdown deadline, in sec */
 char *network   = NULL;
 char *hostname  = NULL;
 char *rcsd      = FINIT_RCSD;
@@ -115,7 +117,8 @@ static int fsck(int pass)
 	}
 
 	while ((fs = getfsent())) {
-		char cmd[80];
+		struct timespec start;
+		char cmd[80], name[64];
 		struct stat st;
 		int fsck_rc = 0;
 
@@ -140,7 +143,10 @@ static int fsck(int pass)
 #else
 		snprintf(cmd, sizeof(cmd), "fsck -a %s", fs->fs_spec);
 #endif
+		clock_gettime(CLOCK_MONOTONIC, &start);
 		fsck_rc = run_interactive(cmd, "Checking filesystem %.13s", fs->fs_spec);
+		snprintf(name, sizeof(name), "fsck pass %d %s", pass, fs->fs_spec);
+		timeline_span(name, &start);
 		/*
 		 * "failure" is defined as exiting with a return code of
 		 * 2 or larger.  A return code of 1 indicates that filesystem
@@ -316,13 +322,19 @@ static void fs_finalize(void)
 
 static void fs_mount_all(void)
 {
+	struct timespec start;
+	int rc;
+
 	if (!rescue)
 		fs_remount_root(fsck_all());
 
 	_d("Root FS up, calling hooks ...");
 	plugin_run_hooks(HOOK_ROOTFS_UP);
 
-	if (run_interactive("mount -na", "Mounting filesystems"))
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	rc = run_interactive("mount -na", "Mounting filesystems");
+	timeline_span("mount -na", &start);
+	if (rc)
 		plugin_run_hooks(HOOK_MOUNT_ERROR);
 
 	_d("Calling extra mount hook, after mount -a ...");
@@ -352,8 +364,11 @@ static void fs_init(void)
 		{ "devtmpfs", "/dev",  "devtmpfs" },
 		{ "sysfs",    "/sys",  "sysfs"    },
 	};
+	struct timespec start;
 	size_t i;
 
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
 	/* mask writable bit for g and o */
 	umask(022);
 
@@ -369,6 +384,8 @@ static void fs_init(void)
 
 		fs_mount(fs[i].spec, fs[i].file, fs[i].type, 0, NULL);
 	}
+
+	timeline_span("fs_init", &start);
 }
 
 
@@ -76,7 +76,7 @@
 #define INIT_CMD_DEBUG          8    /* Toggle Finit debug */
 #define INIT_CMD_RELOAD         9    /* Reload *.conf in /etc/finit.d/ */
 #define INIT_CMD_START_SVC      10   /* START service */
-#define INIT_CMD_STOP_SVC       11
+#define INIT_CMD_STOP_SVC       11   /* STOP service, runlevel:1 for restart */
 #define INIT_CMD_RELOAD_SVC     12   /* SIGHUP service */
 #define INIT_CMD_RESTART_SVC    13   /* START service, clearing blocks */
 #define INIT_CMD_UNUSED2        14   /* Unused, was INIT_CMD_QUERY_INETD */
@@ -91,6 +91,14 @@
 #define INIT_CMD_SVC_QUERY      130
 #define INIT_CMD_SVC_FIND       131
 #define INIT_CMD_SVC_FIND_BYC   132
+#define INIT_CMD_FDSTORE        133  /* Store fds (SCM_RIGHTS) for next instance */
+#define INIT_CMD_SVC_KEEPALIVE  134  /* Watchdog keepalive, from service or for NAME[:ID] */
+#define INIT_CMD_SVC_LOG        135  /* Recent output of NAME[:ID], optionally follow */
+#define INIT_CMD_LOG_STATS      136  /* Log counters and rate limiting, all services */
+#define INIT_CMD_TRACE          137  /* Trace ring, runlevel:1 to follow */
+#define INIT_CMD_LATENCY        138  /* Time spent in callbacks, hooks, and run() */
+#define INIT_CMD_TIMELINE       139  /* Boot timeline, for initctl analyze */
+#define INIT_CMD_FDSTORE_CLEAR  140  /* Clear fd store, then store any fds sent along */
 #define INIT_CMD_NACK           254
 #define INIT_CMD_ACK            255
 
@@ -103,6 +111,9 @@ struct init_request {
 	char	data[368];
 };
 
+/* Max size of each message after the reply to INIT_CMD_SVC_LOG et al */
+#define INIT_LOG_CHUNK          4096
+
 extern int    runlevel;
 extern int    cfglevel;
 extern int    prevlevel;
@@ -112,6 +123,7 @@ extern int    single;
 extern int    bootstrap;
 extern char  *rcsd;
 extern char  *sdown;
+extern int    sdown_tmo;
 extern char  *network;
 extern char  *hostname;
 extern char  *runparts;
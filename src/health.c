@@ -0,0 +1,510 @@
+/* Health check probes, run by Finit on behalf of services
+ *
+ * Copyright (c) 2021  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <paths.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sysexits.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <lite/lite.h>
+#include <uev/uev.h>
+
+#include "finit.h"
+#include "cond.h"
+#include "deadline.h"
+#include "health.h"
+#include "helpers.h"
+#include "latency.h"
+#include "log.h"
+#include "service.h"
+#include "sig.h"
+
+/* Buckets in the PID index of exec: probes in progress, power of two */
+#define HEALTH_HASH 64
+
+static LIST_HEAD(, svc_health) probes[HEALTH_HASH];
+
+static svc_t *probe_svc(struct svc_health *h)
+{
+	return (svc_t *)((char *)h - offsetof(svc_t, health));
+}
+
+static void probe_add(struct svc_health *h, pid_t pid)
+{
+	h->pid = pid;
+	LIST_INSERT_HEAD(&probes[pid & (HEALTH_HASH - 1)], h, link);
+}
+
+static void probe_del(struct svc_health *h)
+{
+	if (h->pid <= 0)
+		return;
+
+	LIST_REMOVE(h, link);
+	h->pid = 0;
+}
+
+static int parse_sec(svc_t *svc, char *key, char *val, int min, int max, int *msec)
+{
+	const char *errstr;
+	long long sec;
+
+	sec = strtonum(val, min, max, &errstr);
+	if (errstr) {
+		_e("%s: health %s:%s is %s (%d-%d)", svc->cmd, key, val, errstr, min, max);
+		return 1;
+	}
+
+	*msec = (int)(sec * 1000);
+	return 0;
+}
+
+/**
+ * health_parse - Parse health:PROBE[,OPT:VAL,...] service option
+ * @svc: Service to set up health check for
+ * @arg: Probe and options, or %NULL to disable health checks
+ *
+ * The probe is one of exec:/path/to/check, tcp:[ADDR:]PORT, where ADDR
+ * defaults to localhost, or unix:/path/to/sock.  Options:
+ *
+ *   interval:SEC   time between probes, default 10 sec
+ *   timeout:SEC    max time for a probe to complete, default 3 sec
+ *   retries:NUM    consecutive failures before action, default 3
+ *   fail:restart   kill and restart the service, default
+ *   fail:cond      withdraw the pid/ condition of the service
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero on error, health checks disabled.
+ */
+int health_parse(svc_t *svc, char *arg)
+{
+	struct svc_health *h = &svc->health;
+	int interval = HEALTH_INTERVAL;
+	int timeout  = HEALTH_TIMEOUT;
+	int retries  = HEALTH_RETRIES;
+	int action   = HEALTH_ACTION_RESTART;
+	char buf[CMD_SIZE] = "";
+	char *probe = buf, *opt;
+	int rc = 0;
+
+	if (!arg || !arg[0])
+		goto done;
+
+	strlcpy(buf, arg, sizeof(buf));
+	probe = strtok(buf, ",");
+	if (!probe)
+		goto fail;
+
+	if (!strncmp(probe, "exec:", 5)) {
+		if (probe[5] != '/') {
+			_e("%s: health probe %s must use an absolute path", svc->cmd, probe);
+			goto fail;
+		}
+		if (access(&probe[5], X_OK))
+			logit(LOG_WARNING, "%s: health probe %s is missing or not executable.", svc->cmd, &probe[5]);
+	} else if (strncmp(probe, "tcp:", 4) && strncmp(probe, "unix:", 5)) {
+		_e("%s: unsupported health probe %s", svc->cmd, probe);
+		goto fail;
+	}
+
+	while ((opt = strtok(NULL, ","))) {
+		char *val = strchr(opt, ':');
+
+		if (!val) {
+			_e("%s: invalid health option %s", svc->cmd, opt);
+			goto fail;
+		}
+		*val++ = 0;
+
+		if (!strcmp(opt, "interval")) {
+			if (parse_sec(svc, opt, val, 1, 86400, &interval))
+				goto fail;
+		} else if (!strcmp(opt, "timeout")) {
+			if (parse_sec(svc, opt, val, 1, 3600, &timeout))
+				goto fail;
+		} else if (!strcmp(opt, "retries")) {
+			const char *errstr;
+
+			retries = (int)strtonum(val, 1, 100, &errstr);
+			if (errstr) {
+				_e("%s: health retries:%s is %s (1-100)", svc->cmd, val, errstr);
+				goto fail;
+			}
+		} else if (!strcmp(opt, "fail")) {
+			if (!strcmp(val, "restart"))
+				action = HEALTH_ACTION_RESTART;
+			else if (!strcmp(val, "cond"))
+				action = HEALTH_ACTION_COND;
+			else {
+				_e("%s: invalid health fail:%s, must be restart or cond", svc->cmd, val);
+				goto fail;
+			}
+		} else {
+			_e("%s: unknown health option %s", svc->cmd, opt);
+			goto fail;
+		}
+	}
+
+	/* A probe must always complete before the next one is due */
+	if (timeout >= interval)
+		timeout = interval / 2;
+	goto done;
+fail:
+	logit(LOG_WARNING, "%s: health check disabled.", svc->cmd);
+	probe = "";
+	rc = 1;
+done:
+	/* Unchanged on reload, keep going */
+	if (!strcmp(h->spec, probe) && h->interval == interval && h->timeout == timeout &&
+	    h->retries == retries && h->action == action)
+		return rc;
+
+	if (h->failed && svc->state == SVC_RUNNING_STATE) {
+		char cond[MAX_COND_LEN];
+
+		cond_set(mkcond(svc, cond, sizeof(cond)));
+	}
+	health_stop(svc);
+
+	strlcpy(h->spec, probe, sizeof(h->spec));
+	h->interval = interval;
+	h->timeout  = timeout;
+	h->retries  = retries;
+	h->action   = action;
+
+	/* Reload of a running service, pick up the change right away */
+	if (svc->state == SVC_RUNNING_STATE && svc->pid > 1)
+		health_start(svc);
+
+	return rc;
+}
+
+/* Abort any probe in progress, the result is ignored */
+static void health_abort(svc_t *svc)
+{
+	struct svc_health *h = &svc->health;
+
+	deadline_stop(&h->tmo);
+	if (h->fd >= 0) {
+		uev_io_stop(&h->watcher);
+		close(h->fd);
+		h->fd = -1;
+	}
+	if (h->pid > 1)
+		kill(-h->pid, SIGKILL);
+	probe_del(h);
+}
+
+static void health_result(svc_t *svc, int ok, const char *why)
+{
+	struct svc_health *h = &svc->health;
+	char cond[MAX_COND_LEN];
+
+	health_abort(svc);
+
+	if (ok) {
+		h->failures = 0;
+		if (!h->failed)
+			return;
+
+		h->failed = 0;
+		logit(LOG_NOTICE, "Service %s[%d] passes health check %s again.",
+		      svc_ident(svc, NULL, 0), svc->pid, h->spec);
+		cond_set(mkcond(svc, cond, sizeof(cond)));
+		return;
+	}
+
+	if (h->failed)
+		return;
+
+	h->failures++;
+	logit(LOG_WARNING, "Service %s[%d] failed health check %s (%d/%d): %s",
+	      svc_ident(svc, NULL, 0), svc->pid, h->spec, h->failures, h->retries, why);
+	if (h->failures < h->retries)
+		return;
+
+	h->failures = 0;
+	if (h->action == HEALTH_ACTION_COND) {
+		mkcond(svc, cond, sizeof(cond));
+		logit(LOG_CONSOLE | LOG_WARNING, "Service %s[%d] is unhealthy, withdrawing %s.",
+		      svc_ident(svc, NULL, 0), svc->pid, cond);
+		h->failed = 1;
+		cond_clear(cond);
+		return;
+	}
+
+	logit(LOG_CONSOLE | LOG_WARNING, "Service %s[%d] is unhealthy, killing it.",
+	      svc_ident(svc, NULL, 0), svc->pid);
+	service_kill_hung(svc);
+}
+
+static void health_timeout(void *arg)
+{
+	health_result(arg, 0, "timeout");
+}
+
+static void health_connect_cb(uev_t *w, void *arg, int events)
+{
+	static struct latency lat = { .stat.name = "health_connect_cb" };
+	socklen_t len = sizeof(int);
+	int err = 0;
+	struct timespec start;
+
+	latency_start(&start);
+	if (UEV_ERROR == events)
+		err = EIO;
+	else if (getsockopt(w->fd, SOL_SOCKET, SO_ERROR, &err, &len))
+		err = errno;
+
+	health_result(arg, !err, strerror(err));
+
+	latency_stop(&lat, &start);
+}
+
+static int health_addr(char *spec, struct sockaddr_storage *ss, socklen_t *len)
+{
+	struct addrinfo hints = {
+		.ai_family   = AF_UNSPEC,
+		.ai_socktype = SOCK_STREAM,
+		.ai_flags    = AI_NUMERICHOST | AI_NUMERICSERV,
+	}, *ai;
+	char buf[MAX_ARG_LEN];
+	char *addr, *port;
+
+	if (!strncmp(spec, "unix:", 5)) {
+		struct sockaddr_un *sun = (struct sockaddr_un *)ss;
+
+		sun->sun_family = AF_UNIX;
+		if (strlcpy(sun->sun_path, &spec[5], sizeof(sun->sun_path)) >= sizeof(sun->sun_path))
+			return -1;
+		*len = sizeof(*sun);
+
+		return 0;
+	}
+
+	strlcpy(buf, &spec[4], sizeof(buf));
+	addr = buf;
+	port = strrchr(addr, ':');
+	if (port) {
+		*port++ = 0;
+		if (addr[0] == '[') {
+			char *end = strchr(++addr, ']');
+
+			if (end)
+				*end = 0;
+		}
+	} else {
+		port = addr;
+		addr = NULL;	/* localhost */
+	}
+
+	if (getaddrinfo(addr, port, &hints, &ai))
+		return -1;
+
+	memcpy(ss, ai->ai_addr, ai->ai_addrlen);
+	*len = ai->ai_addrlen;
+	freeaddrinfo(ai);
+
+	return 0;
+}
+
+/* Non-blocking connect, completion or failure is reported by uev */
+static int health_connect(svc_t *svc)
+{
+	struct svc_health *h = &svc->health;
+	struct sockaddr_storage ss = { 0 };
+	socklen_t len;
+	int sd;
+
+	if (health_addr(h->spec, &ss, &len)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	sd = socket(ss.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (sd == -1)
+		return -1;
+
+	if (!connect(sd, (struct sockaddr *)&ss, len)) {
+		close(sd);
+		return 1;
+	}
+
+	if (errno != EINPROGRESS) {
+		int err = errno;
+
+		close(sd);
+		errno = err;
+		return -1;
+	}
+
+	h->fd = sd;
+	if (uev_io_init(ctx, &h->watcher, health_connect_cb, svc, sd, UEV_WRITE)) {
+		close(sd);
+		h->fd = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Run probe as the same user:group, and with the same env:file, as svc */
+static int health_exec(svc_t *svc)
+{
+	struct svc_health *h = &svc->health;
+	pid_t pid;
+
+	pid = service_fork(svc, NULL);
+	if (pid < 0)
+		return -1;
+
+	if (pid == 0) {
+		char *path = &h->spec[5];
+		int fd;
+
+		setsid();
+		fd = open(_PATH_DEVNULL, O_RDWR);
+		if (fd >= 0) {
+			dup2(fd, STDIN_FILENO);
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+			if (fd > STDERR_FILENO)
+				close(fd);
+		}
+
+		setenv("SERVICE_IDENT", svc_ident(svc, NULL, 0), 1);
+		sig_unblock();
+
+		execl(path, path, NULL);
+		_exit(EX_OSERR);
+	}
+
+	probe_add(h, pid);
+
+	return 0;
+}
+
+static void health_probe(void *arg)
+{
+	svc_t *svc = arg;
+	struct svc_health *h = &svc->health;
+	int rc;
+
+	deadline_arm(&h->timer, h->interval, health_probe, svc);
+
+	/* Not up yet, start-timeout:SEC covers that */
+	if (svc->state != SVC_RUNNING_STATE || svc->pid <= 1 || svc_is_starting(svc))
+		return;
+
+	if (h->pid > 0 || h->fd >= 0)
+		return;		/* Still in progress */
+
+	if (!strncmp(h->spec, "exec:", 5))
+		rc = health_exec(svc);
+	else
+		rc = health_connect(svc);
+
+	if (rc) {
+		health_result(svc, rc > 0, strerror(errno));
+		return;
+	}
+
+	deadline_arm(&h->tmo, h->timeout, health_timeout, svc);
+}
+
+/**
+ * health_start - Start periodic health check of a service
+ * @svc: Service that has been started
+ */
+void health_start(svc_t *svc)
+{
+	struct svc_health *h = &svc->health;
+
+	if (!h->spec[0])
+		return;
+
+	health_abort(svc);
+	h->failures = 0;
+	h->failed = 0;
+	deadline_arm(&h->timer, h->interval, health_probe, svc);
+}
+
+/**
+ * health_stop - Stop health check of a service
+ * @svc: Service that is stopping, or has stopped
+ */
+void health_stop(svc_t *svc)
+{
+	struct svc_health *h = &svc->health;
+
+	deadline_stop(&h->timer);
+	health_abort(svc);
+	h->failures = 0;
+	h->failed = 0;
+}
+
+/**
+ * health_collect - Check if a collected PID is an exec: health probe
+ * @pid:    PID collected by SIGCHLD handler
+ * @status: Exit status of @pid
+ *
+ * Returns:
+ * %TRUE(1) if @pid was a health probe, otherwise %FALSE(0).
+ */
+int health_collect(pid_t pid, int status)
+{
+	struct svc_health *h;
+	char why[32];
+
+	LIST_FOREACH(h, &probes[pid & (HEALTH_HASH - 1)], link) {
+		if (h->pid == pid)
+			break;
+	}
+	if (!h)
+		return 0;
+
+	probe_del(h);
+	if (WIFEXITED(status))
+		snprintf(why, sizeof(why), "exit code %d", WEXITSTATUS(status));
+	else
+		snprintf(why, sizeof(why), "killed by signal %d", WTERMSIG(status));
+	health_result(probe_svc(h), WIFEXITED(status) && !WEXITSTATUS(status), why);
+
+	return 1;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,48 @@
+/* Health check probes, run by Finit on behalf of services
+ *
+ * Copyright (c) 2021  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef FINIT_HEALTH_H_
+#define FINIT_HEALTH_H_
+
+#include "svc.h"
+
+#define HEALTH_ACTION_RESTART  0	/* Kill and restart service */
+#define HEALTH_ACTION_COND     1	/* Withdraw pid/ condition */
+
+#define HEALTH_INTERVAL        10000	/* msec */
+#define HEALTH_TIMEOUT         3000	/* msec */
+#define HEALTH_RETRIES         3
+
+int  health_parse  (svc_t *svc, char *arg);
+void health_start  (svc_t *svc);
+void health_stop   (svc_t *svc);
+int  health_collect(pid_t pid, int status);
+
+#endif /* FINIT_HEALTH_H_ */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -26,13 +26,17 @@
 #include <err.h>
 #include <ftw.h>
 #include <ctype.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <inttypes.h>
 #include <paths.h>
 #include <signal.h>
 #include <stdio.h>
 #include <time.h>
 #include <utmp.h>
 #include <arpa/inet.h>
+#include <sys/param.h>
+#include <sys/stat.h>
 #include <lite/lite.h>
 
 #include "client.h"
@@ -40,6 +44,12 @@
 #include "serv.h"
 #include "service.h"
 #include "cgutil.h"
+#include "latency.h"
+#include "sm.h"
+#include "logmux.h"
+#include "logstore.h"
+#include "timeline.h"
+#include "trace.h"
 #include "util.h"
 #include "utmp-api.h"
 
@@ -51,6 +61,10 @@ struct cmd {
 
 int icreate  = 0;
 int iforce   = 0;
+int ifollow  = 0;
+int ilines   = 10;
+char *isince = NULL;
+char *iuntil = NULL;
 int ionce    = 0;
 int debug    = 0;
 int heading  = 1;
@@ -145,17 +159,918 @@ static int toggle_debug(char *arg)
 	return client_send(&rq, sizeof(rq));
 }
 
-static int do_log(char *svc)
+/*
+ * Recent output of services with log enabled is kept by Finit, so we
+ * do not have to search through the syslog.  Returns non-zero if Finit
+ * has nothing for @ident, e.g., service without log, or not started.
+ */
+static int log_ring(char *ident)
+{
+	struct init_request rq = {
+		.magic     = INIT_MAGIC,
+		.cmd       = INIT_CMD_SVC_LOG,
+		.runlevel  = ilines,
+		.sleeptime = ifollow,
+	};
+	char buf[INIT_LOG_CHUNK];
+	ssize_t len;
+	int sd;
+
+	sd = client_connect();
+	strlcpy(rq.data, ident, sizeof(rq.data));
+	if (write(sd, &rq, sizeof(rq)) != sizeof(rq) ||
+	    read(sd, &rq, sizeof(rq)) != sizeof(rq) ||
+	    rq.cmd != INIT_CMD_ACK) {
+		client_disconnect();
+		return 1;
+	}
+
+	while ((len = read(sd, buf, sizeof(buf))) > 0) {
+		fwrite(buf, len, 1, stdout);
+		fflush(stdout);
+	}
+	client_disconnect();
+
+	return 0;
+}
+
+#define LOG_BLOCK    4096
+#define LOG_LINE     1024
+#define LOG_SCAN_MAX (64 * 1024 * 1024)	/* Max bytes searched for @match */
+
+static int log_match(char *line, size_t len, char *match)
+{
+	if (!match)
+		return len > 0;
+
+	return memmem(line, len, match, strlen(match)) != NULL;
+}
+
+/*
+ * Find the offset of the @num last lines in @fd matching @match, or
+ * any line, by reading backwards from the end of the file.
+ */
+static off_t log_offset(int fd, char *match, int num)
+{
+	char buf[LOG_BLOCK + LOG_LINE];
+	off_t end, pos, start;
+	size_t carry = 0;
+
+	end = lseek(fd, 0, SEEK_END);
+	if (end <= 0)
+		return 0;
+
+	start = pos = end;
+	while (pos > 0) {
+		size_t n = MIN(LOG_BLOCK, pos);
+		size_t len, i;
+
+		if (match && end - pos > LOG_SCAN_MAX)
+			return start;
+
+		/* beginning of a line in the previous block goes last */
+		pos -= n;
+		memmove(buf + n, buf, carry);
+		if (pread(fd, buf, n, pos) != (ssize_t)n)
+			return start;
+
+		len = n + carry;
+		for (i = len; i > 0; i--) {
+			if (buf[i - 1] != '\n')
+				continue;
+
+			if (log_match(&buf[i], len - i, match)) {
+				start = pos + i;
+				if (--num == 0)
+					return start;
+			}
+			len = i - 1;
+		}
+
+		carry = MIN(len, LOG_LINE);
+	}
+
+	if (log_match(buf, carry, match))
+		start = 0;
+
+	return start;
+}
+
+/*
+ * Fallback for services without log, their output is in syslog, or
+ * they log to a file of their own.  Unlike tail(1) the lines to show
+ * are found by seeking backwards, so we never read a large file from
+ * the beginning.
+ */
+static int log_file(char *file, char *match)
+{
+	struct stat st, cur;
+	char *line = NULL;
+	size_t len = 0;
+	off_t start;
+	FILE *fp;
+
+	fp = fopen(file, "r");
+	if (!fp)
+		err(1, "Failed opening %s", file);
+
+	start = log_offset(fileno(fp), match, ilines > 0 ? ilines : INT_MAX);
+	fseeko(fp, start, SEEK_SET);
+
+	while (1) {
+		while (getline(&line, &len, fp) != -1) {
+			if (match && !strstr(line, match))
+				continue;
+			fputs(line, stdout);
+		}
+		if (!ifollow)
+			break;
+
+		fflush(stdout);
+		sleep(1);
+
+		/* rotated or truncated, start over */
+		if (!stat(file, &st) && !fstat(fileno(fp), &cur) &&
+		    (st.st_ino != cur.st_ino || st.st_size < ftello(fp))) {
+			FILE *fn;
+
+			fn = fopen(file, "r");
+			if (fn) {
+				fclose(fp);
+				fp = fn;
+			}
+		}
+		clearerr(fp);
+	}
+
+	free(line);
+	fclose(fp);
+
+	return 0;
+}
+
+/*
+ * Accepts YYYY-MM-DD [HH:MM[:SS]], HH:MM[:SS] today, @EPOCH, or a time
+ * relative to now, -NUM[smhd].  Returns usec since the epoch.
+ */
+static int64_t log_time(char *arg)
+{
+	const char *fmt[] = {
+		"%Y-%m-%d %H:%M:%S", "%Y-%m-%dT%H:%M:%S", "%Y-%m-%d %H:%M",
+		"%Y-%m-%d", "%H:%M:%S", "%H:%M",
+	};
+	time_t now = time(NULL);
+	struct tm tm;
+	char *ptr;
+	long val;
+
+	if (arg[0] == '@' || arg[0] == '-') {
+		val = strtol(&arg[1], &ptr, 10);
+		if (ptr == &arg[1])
+			goto fail;
+
+		if (arg[0] == '@' && !*ptr)
+			return (int64_t)val * 1000000;
+
+		switch (*ptr) {
+		case 'd':
+			val *= 24;
+			/* fallthrough */
+		case 'h':
+			val *= 60;
+			/* fallthrough */
+		case 'm':
+			val *= 60;
+			/* fallthrough */
+		case 's':
+		case 0:
+			if (arg[0] == '-' && (!*ptr || !ptr[1]))
+				return (int64_t)(now - val) * 1000000;
+			break;
+		}
+		goto fail;
+	}
+
+	for (size_t i = 0; i < NELEMS(fmt); i++) {
+		localtime_r(&now, &tm);
+		tm.tm_sec = 0;
+		if (fmt[i][1] == 'Y')
+			tm.tm_hour = tm.tm_min = 0;
+
+		ptr = strptime(arg, fmt[i], &tm);
+		if (!ptr || *ptr)
+			continue;
+
+		tm.tm_isdst = -1;
+		return (int64_t)mktime(&tm) * 1000000;
+	}
+fail:
+	errx(1, "Invalid time %s, see 'initctl help'", arg);
+}
+
+static void log_rec(struct logstore_rec *rec, char *ident, char *msg)
+{
+	time_t sec = rec->time / 1000000;
+	char ts[32];
+
+	strftime(ts, sizeof(ts), "%b %e %H:%M:%S", localtime(&sec));
+	printf("%s %s: %s\n", ts, ident, msg);
+}
+
+/*
+ * The log store is optional, see logstore in finit.conf, Finit links
+ * to it from /run/finit/logstore when enabled.
+ */
+static int log_store(char *ident)
+{
+	int64_t since = 0, until = 0;
+
+	if (isince)
+		since = log_time(isince);
+	if (iuntil)
+		until = log_time(iuntil);
+
+	if (!fisdir(LOGSTORE_LINK))
+		errx(1, "No log store, enable with 'logstore /path' in " FINIT_CONF);
+
+	if (logstore_query(LOGSTORE_LINK, ident, since, until, log_rec))
+		err(1, "Failed reading log store %s", LOGSTORE_LINK);
+
+	return 0;
+}
+
+static int do_log(char *arg)
 {
 	char *logfile = "/var/log/syslog";
+	char *match = "finit";
+	svc_t *svc;
+
+	if (isince || iuntil)
+		return log_store(arg && arg[0] ? arg : NULL);
+
+	if (arg && arg[0]) {
+		match = arg;
+
+		svc = client_svc_find(arg);
+		if (svc) {
+			if (!log_ring(svc_ident(svc, NULL, 0)))
+				return 0;
+
+			if (svc->log.file[0] == '/')
+				return log_file(svc->log.file, NULL);
 
-	if (!svc || !svc[0])
-		svc = "finit";
+			match = basename(svc->cmd);
+			if (svc->log.ident[0])
+				match = svc->log.ident;
+			match = strdupa(match);
+		}
+	}
 
 	if (!fexist(logfile))
 		logfile = "/var/log/messages";
 
-	return systemf("cat %s | grep %s | tail -10", logfile, svc);
+	return log_file(logfile, match);
+}
+
+static int stat_cmp(const void *a, const void *b)
+{
+	const struct logmux_stat *x = a, *y = b;
+
+	return x->bytes < y->bytes ? 1 : x->bytes > y->bytes ? -1 : 0;
+}
+
+/* Log counters of all services, noisiest first */
+static int do_logstat(char *arg)
+{
+	struct init_request rq = {
+		.magic = INIT_MAGIC,
+		.cmd   = INIT_CMD_LOG_STATS,
+	};
+	struct logmux_stat *st = NULL, *ptr;
+	size_t num = 0, max = 0;
+	char buf[INIT_LOG_CHUNK];
+	ssize_t len;
+	int sd;
+
+	sd = client_connect();
+	if (write(sd, &rq, sizeof(rq)) != sizeof(rq) ||
+	    read(sd, &rq, sizeof(rq)) != sizeof(rq) ||
+	    rq.cmd != INIT_CMD_ACK) {
+		client_disconnect();
+		errx(1, "Failed reading log counters from Finit");
+	}
+
+	while ((len = read(sd, buf, sizeof(buf))) > 0) {
+		size_t n = len / sizeof(*st);
+
+		if (num + n > max) {
+			max = num + n + 64;
+			ptr = realloc(st, max * sizeof(*st));
+			if (!ptr)
+				err(1, "Failed allocating memory");
+			st = ptr;
+		}
+		memcpy(&st[num], buf, n * sizeof(*st));
+		num += n;
+	}
+	client_disconnect();
+
+	if (!st)
+		return 0;
+	qsort(st, num, sizeof(*st), stat_cmp);
+
+	if (heading)
+		print_header("%-20s %10s %8s %10s %9s", "IDENT", "LINES", "BYTES", "SUPPRESSED", "THROTTLED");
+	for (size_t i = 0; i < num; i++) {
+		char sz[16];
+
+		printf("%-20s %10" PRIu64 " %8s %10" PRIu64 " %7" PRIu64 ".%" PRIu64 "s\n",
+		       st[i].ident, st[i].lines, memsz(st[i].bytes, sz, sizeof(sz)),
+		       st[i].suppressed, st[i].throttled / 1000, st[i].throttled % 1000 / 100);
+	}
+	free(st);
+
+	return 0;
+}
+
+static int lat_cmp(const void *a, const void *b)
+{
+	const struct latency_stat *x = a, *y = b;
+
+	return x->max < y->max ? 1 : x->max > y->max ? -1 : 0;
+}
+
+/* Upper bound of histogram bucket with the @pct percentile */
+static uint64_t lat_pct(struct latency_stat *st, int pct)
+{
+	uint64_t sum = 0, n = (st->count * pct + 99) / 100;
+
+	for (int i = 0; i < LATENCY_BUCKETS; i++) {
+		sum += st->hist[i];
+		if (sum >= n)
+			return MIN(1ULL << i, st->max);
+	}
+
+	return st->max;
+}
+
+static char *lat_str(uint64_t usec, char *buf, size_t len)
+{
+	if (usec < 1000)
+		snprintf(buf, len, "%" PRIu64 "us", usec);
+	else if (usec < 1000000)
+		snprintf(buf, len, "%.1fms", usec / 1000.0);
+	else
+		snprintf(buf, len, "%.2fs", usec / 1000000.0);
+
+	return buf;
+}
+
+/* Time spent in PID 1 callbacks, hooks, and commands, worst first */
+static int do_latency(char *arg)
+{
+	struct init_request rq = {
+		.magic = INIT_MAGIC,
+		.cmd   = INIT_CMD_LATENCY,
+	};
+	struct latency_stat *st = NULL, *ptr;
+	size_t num = 0, max = 0;
+	char buf[INIT_LOG_CHUNK];
+	ssize_t len;
+	int sd;
+
+	sd = client_connect();
+	if (write(sd, &rq, sizeof(rq)) != sizeof(rq) ||
+	    read(sd, &rq, sizeof(rq)) != sizeof(rq) ||
+	    rq.cmd != INIT_CMD_ACK) {
+		client_disconnect();
+		errx(1, "Failed reading latency counters from Finit");
+	}
+
+	while ((len = read(sd, buf, sizeof(buf))) > 0) {
+		size_t n = len / sizeof(*st);
+
+		if (num + n > max) {
+			max = num + n + 64;
+			ptr = realloc(st, max * sizeof(*st));
+			if (!ptr)
+				err(1, "Failed allocating memory");
+			st = ptr;
+		}
+		memcpy(&st[num], buf, n * sizeof(*st));
+		num += n;
+	}
+	client_disconnect();
+
+	if (!st)
+		return 0;
+	qsort(st, num, sizeof(*st), lat_cmp);
+
+	if (heading)
+		print_header("%-32s %8s %8s %8s %8s %8s", "NAME", "COUNT", "TOTAL", "P50", "P99", "MAX");
+	for (size_t i = 0; i < num; i++) {
+		char t[16], p50[16], p99[16], m[16];
+
+		st[i].name[sizeof(st[i].name) - 1] = 0;
+		printf("%-32s %8" PRIu64 " %8s %8s %8s %8s\n", st[i].name, st[i].count,
+		       lat_str(st[i].total, t, sizeof(t)),
+		       lat_str(lat_pct(&st[i], 50), p50, sizeof(p50)),
+		       lat_str(lat_pct(&st[i], 99), p99, sizeof(p99)),
+		       lat_str(st[i].max, m, sizeof(m)));
+	}
+	free(st);
+
+	return 0;
+}
+
+/* Boot timeline, from Finit, and the services in it */
+static struct timeline_ev *tl;
+static size_t tl_num;
+
+struct tl_svc {
+	char    *ident;
+	uint64_t wait;		/* usec, waiting for conditions */
+	uint64_t fork;
+	uint64_t ready;		/* pid/NAME asserted, or run/task done */
+};
+
+static struct tl_svc *tl_svcs;
+static size_t tl_nsvcs;
+
+static struct tl_svc *tl_svc(const char *ident, int create)
+{
+	struct tl_svc *s;
+
+	for (size_t i = 0; i < tl_nsvcs; i++) {
+		if (!strcmp(tl_svcs[i].ident, ident))
+			return &tl_svcs[i];
+	}
+	if (!create)
+		return NULL;
+
+	s = realloc(tl_svcs, (tl_nsvcs + 1) * sizeof(*s));
+	if (!s)
+		err(1, "Failed allocating memory");
+	tl_svcs = s;
+
+	s = &tl_svcs[tl_nsvcs++];
+	memset(s, 0, sizeof(*s));
+	s->ident = (char *)ident;
+
+	return s;
+}
+
+/* Last time @cond was asserted, before @when, or zero */
+static uint64_t tl_cond(const char *cond, uint64_t when)
+{
+	uint64_t at = 0;
+
+	for (size_t i = 0; i < tl_num; i++) {
+		struct timeline_ev *ev = &tl[i];
+
+		if (ev->type != TIMELINE_COND || ev->start / 1000 > when)
+			continue;
+		if (!strcmp(ev->name, cond))
+			at = ev->start / 1000;
+	}
+
+	return at;
+}
+
+static struct timeline_ev *tl_span(const char *name)
+{
+	for (size_t i = 0; i < tl_num; i++) {
+		if (tl[i].type == TIMELINE_SPAN && !strcmp(tl[i].name, name))
+			return &tl[i];
+	}
+
+	return NULL;
+}
+
+static void tl_fetch(void)
+{
+	struct init_request rq = {
+		.magic = INIT_MAGIC,
+		.cmd   = INIT_CMD_TIMELINE,
+	};
+	char buf[INIT_LOG_CHUNK];
+	size_t max = 0;
+	ssize_t len;
+	int sd;
+
+	sd = client_connect();
+	if (write(sd, &rq, sizeof(rq)) != sizeof(rq) ||
+	    read(sd, &rq, sizeof(rq)) != sizeof(rq) ||
+	    rq.cmd != INIT_CMD_ACK) {
+		client_disconnect();
+		errx(1, "Failed reading boot timeline from Finit");
+	}
+
+	while ((len = read(sd, buf, sizeof(buf))) > 0) {
+		size_t n = len / sizeof(*tl);
+		void *ptr;
+
+		if (tl_num + n > max) {
+			max = tl_num + n + 256;
+			ptr = realloc(tl, max * sizeof(*tl));
+			if (!ptr)
+				err(1, "Failed allocating memory");
+			tl = ptr;
+		}
+		memcpy(&tl[tl_num], buf, n * sizeof(*tl));
+		tl_num += n;
+	}
+	client_disconnect();
+
+	if (!tl_num)
+		errx(1, "No boot timeline recorded");
+
+	/* first start, and readiness after it, of each service */
+	for (size_t i = 0; i < tl_num; i++) {
+		struct timeline_ev *ev = &tl[i];
+		struct tl_svc *s;
+
+		ev->name[sizeof(ev->name) - 1] = 0;
+		switch (ev->type) {
+		case TIMELINE_SVC_WAIT:
+			s = tl_svc(ev->name, 1);
+			if (!s->wait)
+				s->wait = ev->start / 1000;
+			break;
+
+		case TIMELINE_SVC_FORK:
+			s = tl_svc(ev->name, 1);
+			if (!s->fork)
+				s->fork = ev->start / 1000;
+			break;
+
+		case TIMELINE_SVC_DONE:
+			s = tl_svc(ev->name, 0);
+			if (s && s->fork && !s->ready)
+				s->ready = ev->start / 1000;
+			break;
+
+		case TIMELINE_COND:
+			if (strncmp(ev->name, "pid/", 4))
+				break;
+			s = tl_svc(&ev->name[4], 0);
+			if (s && s->fork && !s->ready)
+				s->ready = ev->start / 1000;
+			break;
+		}
+	}
+}
+
+struct tl_blame {
+	const char *name;
+	uint64_t    at;
+	uint64_t    time;
+};
+
+static int blame_cmp(const void *a, const void *b)
+{
+	const struct tl_blame *x = a, *y = b;
+
+	return x->time < y->time ? 1 : x->time > y->time ? -1 : 0;
+}
+
+/* Services and boot steps, slowest first */
+static int do_analyze_blame(char *arg)
+{
+	uint64_t first = UINT64_MAX, last = 0;
+	char t[16], a[16], u[16];
+	struct tl_blame *list;
+	size_t num = 0;
+
+	tl_fetch();
+
+	list = calloc(tl_num + tl_nsvcs, sizeof(*list));
+	if (!list)
+		err(1, "Failed allocating memory");
+
+	for (size_t i = 0; i < tl_num; i++) {
+		struct timeline_ev *ev = &tl[i];
+
+		first = MIN(first, ev->start / 1000);
+		last  = MAX(last, MAX(ev->start, ev->end) / 1000);
+		if (ev->type != TIMELINE_SPAN)
+			continue;
+
+		list[num++] = (struct tl_blame){ ev->name, ev->start / 1000, (ev->end - ev->start) / 1000 };
+	}
+	for (size_t i = 0; i < tl_nsvcs; i++) {
+		struct tl_svc *s = &tl_svcs[i];
+
+		if (!s->ready)
+			continue;
+		list[num++] = (struct tl_blame){ s->ident, s->fork, s->ready - s->fork };
+	}
+	qsort(list, num, sizeof(*list), blame_cmp);
+
+	printf("Startup finished in %s (kernel) + %s (userspace)\n\n",
+	       lat_str(first, t, sizeof(t)), lat_str(last - first, u, sizeof(u)));
+
+	if (heading)
+		print_header("%8s %8s  %-40s", "TIME", "AT", "NAME");
+	for (size_t i = 0; i < num; i++)
+		printf("%8s %8s  %s\n", lat_str(list[i].time, t, sizeof(t)),
+		       lat_str(list[i].at, a, sizeof(a)), list[i].name);
+	free(list);
+
+	return 0;
+}
+
+/*
+ * Walk back from @arg, or the service ready last, through the condition
+ * each service waited for the longest, i.e., the last one asserted
+ * before it was started.  A pid/NAME condition leads to service NAME.
+ */
+static int do_analyze_critical(char *arg)
+{
+	char ident[MAX_IDENT_LEN], cond[MAX_COND_LEN], at[16], dur[16];
+	struct tl_svc *s = NULL;
+	int depth = 0;
+
+	tl_fetch();
+
+	if (arg) {
+		s = tl_svc(arg, 0);
+		if (!s || !s->fork)
+			errx(1, "%s not started during boot", arg);
+	} else {
+		for (size_t i = 0; i < tl_nsvcs; i++) {
+			if (!s || tl_svcs[i].ready > s->ready)
+				s = &tl_svcs[i];
+		}
+		if (!s || !s->ready)
+			errx(1, "No service ready during boot");
+	}
+
+	while (s && depth++ < 32) {
+		char *ptr, *blocker = NULL;
+		uint64_t last = 0;
+		svc_t *svc;
+
+		printf("%*s%s @%s", (depth - 1) * 3, "", s->ident, lat_str(s->fork, at, sizeof(at)));
+		if (s->ready)
+			printf(" +%s", lat_str(s->ready - s->fork, dur, sizeof(dur)));
+		puts("");
+
+		strlcpy(ident, s->ident, sizeof(ident));
+		svc = client_svc_find(ident);
+		if (!svc || !svc->cond[0])
+			break;
+
+		strlcpy(cond, svc->cond, sizeof(cond));
+		for (ptr = strtok(cond, ","); ptr; ptr = strtok(NULL, ",")) {
+			uint64_t when;
+
+			if (*ptr == '!')
+				ptr++;
+			when = tl_cond(ptr, s->fork);
+			if (when > last) {
+				last    = when;
+				blocker = ptr;
+			}
+		}
+		if (!blocker)
+			break;
+
+		printf("%*s%s %s @%s", (depth - 1) * 3, "", plain ? "`-" : "└─", blocker,
+		       lat_str(last, at, sizeof(at)));
+		if (!strncmp(blocker, "pid/", 4)) {
+			puts("");
+			s = tl_svc(&blocker[4], 0);
+		} else {
+			struct timeline_ev *ev = tl_span(blocker);
+
+			if (ev)
+				printf(" +%s", lat_str((ev->end - ev->start) / 1000, dur, sizeof(dur)));
+			puts("");
+			s = NULL;
+		}
+	}
+
+	return 0;
+}
+
+static void json_str(const char *str)
+{
+	putchar('"');
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			printf("\\%c", *str);
+		else if ((unsigned char)*str < 0x20)
+			printf("\\u%04x", *str);
+		else
+			putchar(*str);
+	}
+	putchar('"');
+}
+
+/* Complete event, or instant if @dur is negative */
+static void json_ev(const char *name, const char *cat, uint64_t ts, int64_t dur, int tid)
+{
+	printf(",\n  {\"name\": ");
+	json_str(name);
+	printf(", \"cat\": \"%s\", \"pid\": 1, \"tid\": %d, \"ts\": %" PRIu64, cat, tid, ts);
+	if (dur < 0)
+		printf(", \"ph\": \"i\", \"s\": \"t\"}");
+	else
+		printf(", \"ph\": \"X\", \"dur\": %" PRId64 "}", dur);
+}
+
+static void json_row(const char *name, int tid)
+{
+	printf("%s\n  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+	       "\"args\": {\"name\": ", tid > 1 ? "," : "", tid);
+	json_str(name);
+	printf("}}");
+}
+
+/* Chrome trace-event format, for chrome://tracing or Perfetto */
+static int do_analyze_json(char *arg)
+{
+	tl_fetch();
+
+	printf("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+	json_row("finit", 1);
+
+	for (size_t i = 0; i < tl_num; i++) {
+		struct timeline_ev *ev = &tl[i];
+
+		if (ev->type == TIMELINE_SPAN)
+			json_ev(ev->name, "boot", ev->start / 1000, (ev->end - ev->start) / 1000, 1);
+		else if (ev->type == TIMELINE_COND)
+			json_ev(ev->name, "cond", ev->start / 1000, -1, 1);
+	}
+
+	/* one row per service: waiting for conditions, then starting */
+	for (size_t i = 0; i < tl_nsvcs; i++) {
+		struct tl_svc *s = &tl_svcs[i];
+		int tid = i + 2;
+
+		json_row(s->ident, tid);
+		if (s->wait && s->fork >= s->wait)
+			json_ev("wait", "wait", s->wait, s->fork - s->wait, tid);
+		if (s->fork)
+			json_ev(s->ident, "service", s->fork, s->ready ? (int64_t)(s->ready - s->fork) : -1, tid);
+	}
+	printf("\n]}\n");
+
+	return 0;
+}
+
+static const char *svcstr(int state)
+{
+	static const char *strs[] = {
+		[SVC_HALTED_STATE]   = "halted",
+		[SVC_DONE_STATE]     = "done",
+		[SVC_STOPPING_STATE] = "stopping",
+		[SVC_CLEANUP_STATE]  = "cleanup",
+		[SVC_SETUP_STATE]    = "setup",
+		[SVC_WAITING_STATE]  = "waiting",
+		[SVC_READY_STATE]    = "ready",
+		[SVC_RUNNING_STATE]  = "running",
+	};
+
+	if ((size_t)state >= NELEMS(strs))
+		return "unknown";
+
+	return strs[state];
+}
+
+static const char *smstr(int state)
+{
+	static const char *strs[] = {
+		[SM_BOOTSTRAP_STATE]       = "bootstrap",
+		[SM_RUNNING_STATE]         = "running",
+		[SM_RUNLEVEL_CHANGE_STATE] = "runlevel/change",
+		[SM_RUNLEVEL_WAIT_STATE]   = "runlevel/wait",
+		[SM_RELOAD_CHANGE_STATE]   = "reload/change",
+		[SM_RELOAD_WAIT_STATE]     = "reload/wait",
+	};
+
+	if ((size_t)state >= NELEMS(strs))
+		return "unknown";
+
+	return strs[state];
+}
+
+static char *levelstr(int level, char *buf, size_t len)
+{
+	if (level == 255)
+		return "-";
+	if (level == 0)
+		return "S";
+
+	snprintf(buf, len, "%d", level);
+	return buf;
+}
+
+static void trace_print(struct trace_rec *rec, char atoms[][TRACE_NAMELEN])
+{
+	char *name = atoms[rec->atom], a[4], b[4];
+
+	printf("%6" PRIu64 ".%06" PRIu64 " ", rec->time / 1000000000, rec->time % 1000000000 / 1000);
+
+	switch (rec->event) {
+	case TRACE_SVC_STATE:
+		printf("svc    %-20s job %-3d pid %-6d %s -> %s\n", name, rec->job, rec->pid,
+		       svcstr(rec->from), svcstr(rec->to));
+		break;
+
+	case TRACE_SVC_EXIT:
+		printf("exit   %-20s job %-3d pid %-6d ", name, rec->job, rec->pid);
+		if (WIFSIGNALED(rec->arg))
+			printf("signal %d%s\n", WTERMSIG(rec->arg), sig2str(WTERMSIG(rec->arg)));
+		else
+			printf("status %d%s\n", WEXITSTATUS(rec->arg), code2str(WEXITSTATUS(rec->arg)));
+		break;
+
+	case TRACE_COND:
+		printf("cond   %-20s %s -> %s\n", name, condstr(rec->from), condstr(rec->to));
+		break;
+
+	case TRACE_SM_STATE:
+		printf("sm     %s -> %s\n", smstr(rec->from), smstr(rec->to));
+		break;
+
+	case TRACE_RUNLEVEL:
+		printf("level  %s -> %s\n", levelstr(rec->from, a, sizeof(a)),
+		       levelstr(rec->to, b, sizeof(b)));
+		break;
+
+	default:
+		printf("event  %d\n", rec->event);
+		break;
+	}
+}
+
+static int trace(int follow)
+{
+	struct init_request rq = {
+		.magic    = INIT_MAGIC,
+		.cmd      = INIT_CMD_TRACE,
+		.runlevel = follow,
+	};
+	static char atoms[TRACE_ATOMS][TRACE_NAMELEN];
+	char buf[INIT_LOG_CHUNK];
+	uint32_t seq = 0;
+	int first = 1;
+	ssize_t len;
+	int sd;
+
+	sd = client_connect();
+	if (write(sd, &rq, sizeof(rq)) != sizeof(rq) ||
+	    read(sd, &rq, sizeof(rq)) != sizeof(rq) ||
+	    rq.cmd != INIT_CMD_ACK) {
+		client_disconnect();
+		errx(1, "Failed reading trace from Finit");
+	}
+
+	strlcpy(atoms[0], "?", sizeof(atoms[0]));
+	while ((len = read(sd, buf, sizeof(buf))) >= (ssize_t)sizeof(struct trace_msg)) {
+		struct trace_msg *msg = (struct trace_msg *)buf;
+		struct trace_atom *atom = (struct trace_atom *)(msg + 1);
+		struct trace_rec *rec = (struct trace_rec *)(msg + 1);
+
+		for (size_t i = 0; i < msg->num; i++) {
+			if (msg->type == TRACE_MSG_ATOM) {
+				if (sizeof(*msg) + (i + 1) * sizeof(*atom) > (size_t)len)
+					break;
+				if (atom[i].id < TRACE_ATOMS)
+					strlcpy(atoms[atom[i].id], atom[i].name, sizeof(atoms[0]));
+				continue;
+			}
+
+			if (sizeof(*msg) + (i + 1) * sizeof(*rec) > (size_t)len)
+				break;
+			if (rec[i].atom >= TRACE_ATOMS)
+				rec[i].atom = 0;
+
+			if (!first && rec[i].seq != seq)
+				printf("-- %" PRIu32 " records lost --\n", rec[i].seq - seq);
+			seq   = rec[i].seq + 1;
+			first = 0;
+
+			trace_print(&rec[i], atoms);
+		}
+		fflush(stdout);
+	}
+	client_disconnect();
+
+	return 0;
+}
+
+static int do_trace_dump(char *arg)
+{
+	return trace(ifollow);
+}
+
+static int do_trace_follow(char *arg)
+{
+	return trace(1);
 }
 
 static int do_runlevel(char *arg)
@@ -190,12 +1105,13 @@ static int do_runlevel(char *arg)
 	return client_send(&rq, sizeof(rq));
 }
 
-static int do_svc(int cmd, char *arg)
+static int do_svc_rl(int cmd, int runlevel, char *arg)
 {
 	struct init_request rq = {
-		.magic = INIT_MAGIC,
-		.cmd   = cmd,
-		.data  = "",
+		.magic    = INIT_MAGIC,
+		.cmd      = cmd,
+		.runlevel = runlevel,
+		.data     = "",
 	};
 
 	if (arg)
@@ -204,12 +1120,17 @@ static int do_svc(int cmd, char *arg)
 	return client_send(&rq, sizeof(rq));
 }
 
+static int do_svc(int cmd, char *arg)
+{
+	return do_svc_rl(cmd, 0, arg);
+}
+
 /*
  * This is a wrapper for do_svc() that adds a simple sanity check of
  * the service(s) provided as argument.  If a service does not exist
  * we make sure to return an error code.
  */
-static int do_startstop(int cmd, char *arg)
+static int do_startstop_rl(int cmd, int runlevel, char *arg)
 {
 	struct init_request rq = {
 		.magic = INIT_MAGIC,
@@ -232,7 +1153,12 @@ static int do_startstop(int cmd, char *arg)
 		return 1;
 	}
 
-	return do_svc(cmd, arg);
+	return do_svc_rl(cmd, runlevel, arg);
+}
+
+static int do_startstop(int cmd, char *arg)
+{
+	return do_startstop_rl(cmd, 0, arg);
 }
 
 static int do_start  (char *arg) { return do_startstop(INIT_CMD_START_SVC,   arg); }
@@ -246,12 +1172,61 @@ static int do_reload (char *arg)
 	return do_startstop(INIT_CMD_RELOAD_SVC, arg);
 }
 
+/*
+ * Without argument the keepalive is for the service we run as, or are
+ * a child of, i.e., for use in scripts and services with watchdog:SEC
+ */
+static int do_keepalive(char *arg)
+{
+	if (do_svc(INIT_CMD_SVC_KEEPALIVE, arg)) {
+		if (arg && arg[0])
+			warnx("no such service, or %s has no watchdog.", arg);
+		else
+			warnx("not a service, or service has no watchdog.");
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Hand over descriptor FD, e.g. inherited from a service script, to the
+ * fd store of the service we run as, or are a child of.  The service
+ * gets it back after any listen: sockets the next time it starts.
+ */
+static int do_fdstore(char *arg)
+{
+	struct init_request rq = {
+		.magic = INIT_MAGIC,
+		.cmd   = INIT_CMD_FDSTORE,
+	};
+	const char *errstr;
+	int fd;
+
+	if (!arg || !arg[0])
+		errx(1, "missing descriptor to store");
+
+	fd = strtonum(arg, 0, INT_MAX, &errstr);
+	if (errstr)
+		errx(1, "invalid descriptor %s", arg);
+	if (fcntl(fd, F_GETFD) == -1)
+		err(1, "cannot store descriptor %d", fd);
+
+	if (client_send_fds(&rq, sizeof(rq), &fd, 1)) {
+		warnx("not a service, or fd store of service is full.");
+		return 1;
+	}
+
+	return 0;
+}
+
 static int do_restart(char *arg)
 {
 	size_t retries = 3;
 	svc_t *svc;
 
-	if (do_startstop(INIT_CMD_STOP_SVC, arg))
+	/* runlevel:1, stopped for restart, socket activated keep sockets */
+	if (do_startstop_rl(INIT_CMD_STOP_SVC, 1, arg))
 		return 1;
 
 	while (retries-- > 0 && (svc = client_svc_find(arg))) {
@@ -614,6 +1589,34 @@ static char *svc_environ(svc_t *svc, char *buf, size_t len)
 	return buf;
 }
 
+static char *svc_sockets(svc_t *svc, char *buf, size_t len)
+{
+	int i;
+
+	buf[0] = 0;
+	for (i = 0; i < MAX_NUM_SOCKS && svc->sock[i].spec[0]; i++) {
+		if (i)
+			strlcat(buf, " ", len);
+		strlcat(buf, svc->sock[i].spec, len);
+	}
+
+	return buf;
+}
+
+static char *svc_health(svc_t *svc, char *buf, size_t len)
+{
+	struct svc_health *h = &svc->health;
+
+	if (h->failed)
+		snprintf(buf, len, "%s, failed", h->spec);
+	else if (h->failures)
+		snprintf(buf, len, "%s, failing %d/%d", h->spec, h->failures, h->retries);
+	else
+		snprintf(buf, len, "%s, every %d sec", h->spec, h->interval / 1000);
+
+	return buf;
+}
+
 static char *exit_status(int status, char *buf, size_t len)
 {
 	int rc, sig;
@@ -621,7 +1624,9 @@ static char *exit_status(int status, char *buf, size_t len)
 	rc = WEXITSTATUS(status);
 	sig = WTERMSIG(status);
 
-	if (WIFEXITED(status))
+	if (status == SVC_STATUS_UNKNOWN)
+		snprintf(buf, len, " (code=unknown)");
+	else if (WIFEXITED(status))
 		snprintf(buf, len, " (code=exited, status=%d%s)", rc, code2str(rc));
 	else if (WIFSIGNALED(status))
 		snprintf(buf, len, " (code=signal, status=%d%s)", sig, sig2str(sig));
@@ -730,6 +1735,10 @@ static int show_status(char *arg)
 		printf("Condition(s): %s\n", svc_cond(svc, buf, sizeof(buf)));
 		printf("    Command : %s\n", svc_command(svc, buf, sizeof(buf)));
 		printf("   PID file : %s\n", svc->pidfile);
+		if (svc_has_sockets(svc))
+			printf("    Sockets : %s\n", svc_sockets(svc, buf, sizeof(buf)));
+		if (svc->health.spec[0])
+			printf("     Health : %s\n", svc_health(svc, buf, sizeof(buf)));
 		printf("        PID : %d\n", svc->pid);
 		printf("       User : %s\n", svc->username);
 		printf("      Group : %s\n", svc->group);
@@ -744,7 +1753,7 @@ static int show_status(char *arg)
 		}
 		printf("\n");
 
-		return do_log(svc->cmd);
+		return do_log(ident);
 	}
 
 	col_widths();
@@ -827,11 +1836,15 @@ static int usage(int rc)
 		"Options:\n"
 		"  -b, --batch               Batch mode, no screen size probing\n"
 		"  -c, --create              Create missing paths (and files) as needed\n"
+		"  -F, --follow              Keep showing new lines in the 'log' command\n"
 		"  -f, --force               Ignore missing files and arguments, never prompt\n"
+		"  -n, --lines NUM           Number of lines in 'log' command, 0: all, default 10\n"
 		"  -1, --once                Only one lap in commands like 'top'\n"
 		"  -p, --plain               Use plain table headings, no ctrl chars\n"
 		"  -q, --quiet               Silent, only return status of command\n"
+		"  -S, --since TIME          Show 'log' from store, since TIME, e.g. -1h or 10:30\n"
 		"  -t, --no-heading          Skip table headings\n"
+		"  -U, --until TIME          Show 'log' from store, until TIME\n"
 		"  -v, --verbose             Verbose output\n"
 		"  -h, --help                This help text\n"
 		"\n"
@@ -875,11 +1888,19 @@ static int usage(int rc)
 		"  cond     status           Show condition status, default cond command\n"
 		"  cond     dump             Dump all conditions and their status\n"
 		"\n"
-		"  log      [NAME]           Show ten last Finit, or NAME, messages from syslog\n"
+		"  log      [NAME[:ID]]      Show recent Finit, or service, log messages\n"
+		"  logstat                   Show log counters of services, noisiest first\n"
+		"  trace    [dump | follow]  Show trace of service, condition, and runlevel changes\n"
+		"  latency                   Show time PID 1 spent in callbacks, hooks, and commands\n"
+		"  analyze  [blame]          Show boot time, services and boot steps slowest first\n"
+		"  analyze  critical [NAME]  Show chain of conditions NAME, or last service, waited for\n"
+		"  analyze  json             Export boot timeline in Chrome trace-event format\n"
 		"  start    <NAME>[:ID]      Start service by name, with optional ID\n"
 		"  stop     <NAME>[:ID]      Stop/Pause a running service by name\n"
 		"  reload   <NAME>[:ID]      Reload service by name (SIGHUP or restart)\n"
 		"  restart  <NAME>[:ID]      Restart (stop/start) service by name\n"
+		"  keepalive [NAME[:ID]]     Send watchdog keepalive for self, or NAME\n"
+		"  fdstore  <FD>             Hand over descriptor to fd store of self\n"
 		"  status   <NAME>[:ID]      Show service status, by name\n"
 		"  status                    Show status of services, default command\n"
 		"\n"
@@ -954,8 +1975,12 @@ int main(int argc, char *argv[])
 		{ "batch",      0, NULL, 'b' },
 		{ "create",     0, NULL, 'c' },
 		{ "debug",      0, NULL, 'd' },
+		{ "follow",     0, NULL, 'F' },
 		{ "force",      0, NULL, 'f' },
 		{ "help",       0, NULL, 'h' },
+		{ "lines",      1, NULL, 'n' },
+		{ "since",      1, NULL, 'S' },
+		{ "until",      1, NULL, 'U' },
 		{ "once",       0, NULL, '1' },
 		{ "plain",      0, NULL, 'p' },
 		{ "quiet",      0, NULL, 'q' },
@@ -971,6 +1996,17 @@ int main(int argc, char *argv[])
 		{ "clear",    NULL, do_cond_clr  },
 		{ NULL, NULL, NULL }
 	};
+	struct cmd trace[] = {
+		{ "dump",     NULL, do_trace_dump   }, /* default cmd */
+		{ "follow",   NULL, do_trace_follow },
+		{ NULL, NULL, NULL }
+	};
+	struct cmd analyze[] = {
+		{ "blame",    NULL, do_analyze_blame    }, /* default cmd */
+		{ "critical", NULL, do_analyze_critical },
+		{ "json",     NULL, do_analyze_json     },
+		{ NULL, NULL, NULL }
+	};
 	struct cmd command[] = {
 		{ "status",   NULL, show_status  }, /* default cmd */
 
@@ -993,9 +2029,15 @@ int main(int argc, char *argv[])
 		{ "cond",     cond, NULL         },
 
 		{ "log",      NULL, do_log       },
+		{ "logstat",  NULL, do_logstat   },
+		{ "trace",    trace, NULL        },
+		{ "latency",  NULL, do_latency   },
+		{ "analyze",  analyze, NULL      },
 		{ "start",    NULL, do_start     },
 		{ "stop",     NULL, do_stop      },
 		{ "restart",  NULL, do_restart   },
+		{ "keepalive", NULL, do_keepalive },
+		{ "fdstore",  NULL, do_fdstore   },
 
 		{ "cgroup",   NULL, show_cgroup  },
 		{ "ps",       NULL, show_cgps    },
@@ -1011,11 +2053,12 @@ int main(int argc, char *argv[])
 		{ NULL, NULL, NULL }
 	};
 	int interactive = 1, c;
+	const char *errstr;
 
 	if (transform(progname(argv[0])))
 		return reboot_main(argc, argv);
 
-	while ((c = getopt_long(argc, argv, "1bcdfh?pqtv", long_options, NULL)) != EOF) {
+	while ((c = getopt_long(argc, argv, "1bcdFfh?n:pqS:tU:v", long_options, NULL)) != EOF) {
 		switch(c) {
 		case '1':
 			ionce = 1;
@@ -1033,6 +2076,10 @@ int main(int argc, char *argv[])
 			debug = 1;
 			break;
 
+		case 'F':
+			ifollow = 1;
+			break;
+
 		case 'f':
 			iforce = 1;
 			break;
@@ -1041,6 +2088,12 @@ int main(int argc, char *argv[])
 		case '?':
 			return usage(0);
 
+		case 'n':
+			ilines = strtonum(optarg, 0, INT_MAX, &errstr);
+			if (errstr)
+				errx(1, "Invalid number of lines: %s", optarg);
+			break;
+
 		case 'p':
 			plain = 1;
 			break;
@@ -1049,10 +2102,18 @@ int main(int argc, char *argv[])
 			quiet = 1;
 			break;
 
+		case 'S':
+			isince = optarg;
+			break;
+
 		case 't':
 			heading = 0;
 			break;
 
+		case 'U':
+			iuntil = optarg;
+			break;
+
 		case 'v':
 			verbose = 1;
 			break;
@@ -0,0 +1,174 @@
+/* Event loop latency, time spent in callbacks, hooks, and run()
+ *
+ * Copyright (c) 2021  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "finit.h"
+#include "helpers.h"
+#include "latency.h"
+#include "log.h"
+#include "private.h"
+#include "timeline.h"
+#include "util.h"
+
+int latency_warn = LATENCY_WARN;
+
+static TAILQ_HEAD(, latency) list = TAILQ_HEAD_INITIALIZER(list);
+static LIST_HEAD(, latency) named[LATENCY_HASH];
+static size_t num;
+
+static uint32_t name_hash(const char *name)
+{
+	return strhash(name) & (LATENCY_HASH - 1);
+}
+
+/**
+ * latency_get - Find, or create, counters by name
+ * @fmt: printf(3) style name, e.g. of plugin hook or command
+ *
+ * For counters not known at build time, e.g., those of plugin hooks,
+ * libuEv callbacks use a static &struct latency instead.  Counters are
+ * never freed, so callers on a hot path can look them up once and keep
+ * the pointer.
+ *
+ * Returns:
+ * Counters, or %NULL if out of memory.
+ */
+struct latency *latency_get(const char *fmt, ...)
+{
+	char name[LATENCY_NAMELEN];
+	struct latency *lat;
+	uint32_t h;
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(name, sizeof(name), fmt, ap);
+	va_end(ap);
+
+	h = name_hash(name);
+	LIST_FOREACH(lat, &named[h], by_name) {
+		if (!strcmp(lat->stat.name, name))
+			return lat;
+	}
+
+	lat = calloc(1, sizeof(*lat));
+	if (!lat)
+		return NULL;
+
+	strlcpy(lat->stat.name, name, sizeof(lat->stat.name));
+	TAILQ_INSERT_TAIL(&list, lat, link);
+	LIST_INSERT_HEAD(&named[h], lat, by_name);
+	lat->listed = 1;
+	lat->named  = 1;
+	num++;
+
+	return lat;
+}
+
+void latency_start(struct timespec *start)
+{
+	clock_gettime(CLOCK_MONOTONIC, start);
+}
+
+/**
+ * latency_stop - Update counters with time since latency_start()
+ * @lat:   Counters, may be %NULL
+ * @start: Time from latency_start()
+ *
+ * Anything that kept PID 1 busy for longer than @latency_warn msec is
+ * logged, since no other event, e.g., from initctl, is handled then.
+ */
+void latency_stop(struct latency *lat, struct timespec *start)
+{
+	struct latency_stat *st;
+	struct timespec now;
+	uint64_t usec;
+	int n;
+
+	if (!lat)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	usec = (uint64_t)(now.tv_sec - start->tv_sec) * 1000000 +
+		(now.tv_nsec - start->tv_nsec) / 1000;
+
+	if (!lat->listed) {
+		TAILQ_INSERT_TAIL(&list, lat, link);
+		lat->listed = 1;
+		num++;
+	}
+
+	st = &lat->stat;
+	st->count++;
+	st->total += usec;
+	if (usec > st->max)
+		st->max = usec > UINT32_MAX ? UINT32_MAX : usec;
+
+	n = usec ? 64 - __builtin_clzll(usec) : 0;
+	if (n >= LATENCY_BUCKETS)
+		n = LATENCY_BUCKETS - 1;
+	st->hist[n]++;
+
+	/* hooks and commands are boot milestones, callbacks only if slow */
+	if (lat->named || usec >= TIMELINE_MIN)
+		timeline_span(st->name, start);
+
+	if (latency_warn && usec >= (uint64_t)latency_warn * 1000)
+		logit(LOG_WARNING, "%s blocked PID 1 for %" PRIu64 ".%03" PRIu64 " sec",
+		      st->name, usec / 1000000, usec / 1000 % 1000);
+}
+
+/**
+ * latency_stats - Send latency counters to an initctl client
+ * @sd: Client socket, closed when done
+ */
+void latency_stats(int sd)
+{
+	struct latency_stat *buf;
+	struct latency *lat;
+	size_t len = 0;
+
+	buf = calloc(num ? num : 1, sizeof(*buf));
+	if (!buf) {
+		close(sd);
+		return;
+	}
+
+	TAILQ_FOREACH(lat, &list, link)
+		buf[len++] = lat->stat;
+
+	api_reply(sd, buf, len, sizeof(*buf));
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
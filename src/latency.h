@@ -0,0 +1,68 @@
+/* Event loop latency, time spent in callbacks, hooks, and run()
+ *
+ * Copyright (c) 2021  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef FINIT_LATENCY_H_
+#define FINIT_LATENCY_H_
+
+#include <stdint.h>
+#include <time.h>
+#include <lite/queue.h>
+#include <uev/uev.h>
+
+#define LATENCY_NAMELEN  48
+#define LATENCY_BUCKETS  28	/* Bucket N: less than 2^N usec */
+#define LATENCY_WARN     500	/* msec, default threshold for warning */
+#define LATENCY_HASH     64	/* power of two, buckets for latency_get() */
+
+/* Counters for one callback, sent as-is to initctl latency */
+struct latency_stat {
+	char     name[LATENCY_NAMELEN];
+	uint64_t count;
+	uint64_t total;		/* usec */
+	uint32_t max;		/* usec */
+	uint32_t hist[LATENCY_BUCKETS];
+};
+
+struct latency {
+	TAILQ_ENTRY(latency) link;
+	LIST_ENTRY(latency)  by_name;	/* only from latency_get() */
+	int      listed;
+	int      named;		/* from latency_get(), always on timeline */
+	struct latency_stat stat;
+};
+
+extern int latency_warn;
+
+struct latency *latency_get (const char *fmt, ...);
+void latency_start(struct timespec *start);
+void latency_stop (struct latency *lat, struct timespec *start);
+void latency_stats(int sd);
+
+#endif /* FINIT_LATENCY_H_ */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
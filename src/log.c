@@ -22,8 +22,17 @@
  */
 
 #include "config.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <paths.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <lite/lite.h>
 
 #include "finit.h"
@@ -33,6 +42,18 @@
 
 static int up       = 0;
 static int loglevel = LOG_INFO;
+static int kfd      = -1;	/* /dev/kmsg, until syslogd is up */
+
+/*
+ * Messages logged before syslogd is up, replayed to syslog with their
+ * original time stamp when it comes up.  The oldest are overwritten.
+ */
+static struct early {
+	int    prio;
+	time_t time;
+	char   msg[LOG_EARLY_LEN];
+} early[LOG_EARLY_NUM];
+static unsigned early_head, early_num, early_lost;
 
 void log_init(int dbg)
 {
@@ -55,6 +76,51 @@ void log_exit(void)
 	enable_progress(1);
 }
 
+/* Send with original time stamp, syslog() would use the current time */
+static void early_replay(void)
+{
+	struct sockaddr_un sun = { .sun_family = AF_UNIX };
+	int sd;
+
+	if (!early_num)
+		return;
+
+	strlcpy(sun.sun_path, _PATH_LOG, sizeof(sun.sun_path));
+	sd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (sd != -1 && connect(sd, (struct sockaddr *)&sun, sizeof(sun))) {
+		close(sd);
+		sd = -1;
+	}
+
+	if (early_lost)
+		syslog(LOG_WARNING, "Lost %u early boot log messages, replaying %u.",
+		       early_lost, early_num);
+
+	for (unsigned i = 0; i < early_num; i++) {
+		struct early *e = &early[(early_head + i) % LOG_EARLY_NUM];
+		char hdr[64], ts[20];
+		struct iovec iov[2] = {
+			{ hdr, 0 },
+			{ e->msg, strlen(e->msg) },
+		};
+
+		if (sd == -1) {
+			syslog(e->prio, "%s", e->msg);
+			continue;
+		}
+
+		strftime(ts, sizeof(ts), "%b %e %H:%M:%S", localtime(&e->time));
+		iov[0].iov_len = snprintf(hdr, sizeof(hdr), "<%d>%s finit[1]: ",
+					  ((e->prio & LOG_FACMASK) ? 0 : LOG_DAEMON) | e->prio, ts);
+		if (writev(sd, iov, NELEMS(iov)) == -1)
+			syslog(e->prio, "%s", e->msg);
+	}
+
+	if (sd != -1)
+		close(sd);
+	early_head = early_num = early_lost = 0;
+}
+
 static void log_open(void)
 {
 	int opts = LOG_PID;
@@ -66,9 +132,26 @@ static void log_open(void)
 	openlog("finit", opts, LOG_DAEMON);
 	setlogmask(LOG_UPTO(loglevel));
 
+	if (!up && fexist(_PATH_LOG))
+		early_replay();
+	log_close();
+
 	up = 1;
 }
 
+/**
+ * log_close - Close /dev/kmsg, reopened on demand
+ *
+ * For when all descriptors are closed, at shutdown, so logit() does not
+ * write to whatever file reuses the descriptor.
+ */
+void log_close(void)
+{
+	if (kfd != -1)
+		close(kfd);
+	kfd = -1;
+}
+
 /* Toggle debug mode */
 void log_debug(void)
 {
@@ -87,16 +170,19 @@ void log_debug(void)
 
 /*
  * Log to /dev/kmsg until syslogd has started, then openlog()
- * and continue logging as a regular daemon.
+ * and continue logging as a regular daemon.  Messages logged
+ * until then are kept in memory and replayed to syslog.
  */
 void logit(int prio, const char *fmt, ...)
 {
-	FILE *fp;
+	struct early *e;
+	struct iovec iov[3];
+	char hdr[32];
 	va_list ap;
 
 	va_start(ap, fmt);
 
-	if (up || fexist("/dev/log")) {
+	if (up || fexist(_PATH_LOG)) {
 		if (!up)
 			log_open();
 
@@ -107,21 +193,36 @@ void logit(int prio, const char *fmt, ...)
 	if (LOG_PRI(prio) > loglevel)
 		goto done;
 
-	fp = fopen("/dev/kmsg", "w");
-	if (!fp) {
-		vfprintf(stderr, fmt, ap);
+	if (early_num == LOG_EARLY_NUM) {
+		early_head = (early_head + 1) % LOG_EARLY_NUM;
+		early_num--;
+		early_lost++;
+	}
+	e = &early[(early_head + early_num++) % LOG_EARLY_NUM];
+	e->prio = prio;
+	e->time = time(NULL);
+	vsnprintf(e->msg, sizeof(e->msg), fmt, ap);
+	chomp(e->msg);
+
+	if (kfd == -1)
+		kfd = open("/dev/kmsg", O_WRONLY | O_CLOEXEC | O_NOCTTY);
+	if (kfd == -1) {
+		fprintf(stderr, "%s\n", e->msg);
 		goto done;
 	}
 
-	fprintf(fp, "<%d>finit[1]:", LOG_DAEMON | prio);
-	vfprintf(fp, fmt, ap);
-	fclose(fp);
+	/* one write() per message, that is one record in the kernel log */
+	iov[0].iov_base = hdr;
+	iov[0].iov_len  = snprintf(hdr, sizeof(hdr), "<%d>finit[1]:", LOG_DAEMON | prio);
+	iov[1].iov_base = e->msg;
+	iov[1].iov_len  = strlen(e->msg);
+	iov[2].iov_base = "\n";
+	iov[2].iov_len  = 1;
+	if (writev(kfd, iov, NELEMS(iov)) == -1)
+		fprintf(stderr, "%s\n", e->msg);
 
-	if (debug) {
-		va_end(ap);
-		va_start(ap, fmt);
-		vfprintf(stderr, fmt, ap);
-	}
+	if (debug)
+		fprintf(stderr, "%s\n", e->msg);
 
 done:
 	va_end(ap);
@@ -26,6 +26,9 @@
 
 #include <syslog.h>
 
+#define LOG_EARLY_NUM 64	/* Messages kept until syslogd is up */
+#define LOG_EARLY_LEN 256
+
 /* Local facility, unused in GNU but available in FreeBSD or sysklogd >= 2.0 */
 #ifndef LOG_CONSOLE
 #define LOG_CONSOLE  (14<<3)
@@ -47,6 +50,7 @@
 
 void    log_init        (int dbg);
 void    log_exit        (void);
+void    log_close       (void);
 
 void    log_debug       (void);
 
@@ -22,65 +22,217 @@
 
 #include <config.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #define SYSLOG_NAMES
 #include <syslog.h>
 #include <unistd.h>
+#include <time.h>
 #include <sys/stat.h>
 #include <lite/lite.h>
 
+#define LOGIT_BUF_MAX   65536		/* Max bytes buffered before write() */
+#define LOGIT_BUF       4096		/* Default flush threshold */
+#define LOGIT_INTERVAL  1000		/* Default flush interval, msec */
+
 static const char version_info[] = PACKAGE_NAME " v" PACKAGE_VERSION;
 extern int logrotate(char *file, int num, off_t sz);
+extern int logrotate_codec(char *name, int lvl);
+
+
+/* Buffered log file, size tracked in memory instead of fstat() per line */
+struct flog {
+	char   *file;
+	int     fd;
+	int     num;		/* rotated files to keep */
+	off_t   sz;		/* rotate when bigger */
+	off_t   size;		/* incl. buffered */
+	size_t  threshold;	/* flush when this many bytes are buffered */
+	int     sync;		/* fsync() after each flush */
+	long long since;	/* msec, when the oldest buffered byte was added */
+	size_t  len;
+	char    buf[LOGIT_BUF_MAX];
+};
+
+static volatile sig_atomic_t done;
+
+static void sigcb(int signo)
+{
+	(void)signo;
+	done = 1;
+}
 
+static long long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-static int checksz(FILE *fp, off_t sz)
+static int fopenlog(struct flog *f)
 {
 	struct stat st;
 
-	if (sz <= 0)
-		return 0;
-
-	if (!fstat(fileno(fp), &st) && st.st_size > sz) {
-		fclose(fp);
+	f->fd = open(f->file, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+	if (f->fd == -1) {
+		syslog(LOG_ERR | LOG_PERROR, "Failed opening %s: %s", f->file, strerror(errno));
 		return 1;
 	}
 
+	f->size = 0;
+	if (!fstat(f->fd, &st))
+		f->size = st.st_size;
+
 	return 0;
 }
 
-static int flogit(char *logfile, int num, off_t sz, char *buf, size_t len)
+static int fflushlog(struct flog *f)
 {
-	FILE *fp;
+	char *ptr = f->buf;
+	ssize_t rc;
+
+	while (f->len > 0) {
+		rc = write(f->fd, ptr, f->len);
+		if (rc == -1) {
+			if (errno == EINTR)
+				continue;
+			syslog(LOG_ERR | LOG_PERROR, "Failed writing %s: %s", f->file, strerror(errno));
+			f->len = 0;
+			return 1;
+		}
+		ptr    += rc;
+		f->len -= rc;
+	}
+
+	if (f->sync)
+		fsync(f->fd);
+
+	return 0;
+}
 
-reopen:
-	fp = fopen(logfile, "a");
-	if (!fp) {
-		syslog(LOG_ERR | LOG_PERROR, "Failed opening %s: %s", logfile, strerror(errno));
+/*
+ * Append one line to the buffer, it is written when the threshold is
+ * reached, or at the flush interval.  Rotation happens at the same line
+ * as unbuffered, the in-memory size includes buffered lines.
+ */
+static int fputlog(struct flog *f, const char *line, size_t len)
+{
+	if (f->len + len > sizeof(f->buf) && fflushlog(f))
 		return 1;
+	if (!f->len)
+		f->since = now_ms();
+
+	if (len > sizeof(f->buf)) {
+		memcpy(f->buf, line, sizeof(f->buf));
+		f->len = sizeof(f->buf);
+		f->size += f->len;
+		return fputlog(f, &line[f->len], len - f->len);
+	}
+
+	memcpy(&f->buf[f->len], line, len);
+	f->len  += len;
+	f->size += len;
+
+	if (f->sz > 0 && f->size > f->sz) {
+		if (fflushlog(f))
+			return 1;
+		close(f->fd);
+		logrotate(f->file, f->num, f->sz);
+
+		return fopenlog(f);
 	}
 
+	if (f->len >= f->threshold)
+		return fflushlog(f);
+
+	return 0;
+}
+
+static int flogit(struct flog *f, int interval, char *buf, size_t len)
+{
+	size_t pos = 0;
+	int rc;
+
+	if (fopenlog(f))
+		return 1;
+
 	if (buf[0]) {
-		fprintf(fp, "%s\n", buf);
-		fsync(fileno(fp));
-		if (checksz(fp, sz))
-			return logrotate(logfile, num, sz);
-	} else {
-		while ((fgets(buf, len, stdin))) {
-			fputs(buf, fp);
-			fsync(fileno(fp));
-
-			if (checksz(fp, sz)) {
-				logrotate(logfile, num, sz);
-				buf[0] = 0;
-				goto reopen;
+		strlcat(buf, "\n", len);
+		rc = fputlog(f, buf, strlen(buf));
+		rc |= fflushlog(f);
+		close(f->fd);
+
+		return rc;
+	}
+
+	signal(SIGTERM, sigcb);
+	signal(SIGINT, sigcb);
+	signal(SIGHUP, sigcb);
+
+	while (!done) {
+		struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+		ssize_t num;
+		size_t i, start = 0;
+		int tmo = -1;
+
+		/* the interval runs from the first buffered byte, not the last read */
+		if (f->len) {
+			tmo = f->since + interval - now_ms();
+			if (tmo <= 0) {
+				fflushlog(f);
+				continue;
 			}
 		}
+
+		rc = poll(&pfd, 1, tmo);
+		if (rc == -1 && errno == EINTR)
+			continue;
+		if (rc == 0) {
+			fflushlog(f);
+			continue;
+		}
+
+		num = read(STDIN_FILENO, &buf[pos], len - pos);
+		if (num == -1 && errno == EINTR)
+			continue;
+		if (num <= 0)
+			break;
+		pos += num;
+
+		/* complete lines, or all of buf if the line is too long */
+		for (i = 0; i < pos; i++) {
+			if (buf[i] != '\n')
+				continue;
+
+			if (fputlog(f, &buf[start], i + 1 - start))
+				goto fail;
+			start = i + 1;
+		}
+		if (start == 0 && pos == len) {
+			if (fputlog(f, buf, pos))
+				goto fail;
+			start = pos;
+		}
+
+		pos -= start;
+		memmove(buf, &buf[start], pos);
 	}
 
-	return fclose(fp);
+	/* partial last line */
+	if (pos > 0)
+		fputlog(f, buf, pos);
+fail:
+	rc = fflushlog(f);
+	close(f->fd);
+
+	return rc;
 }
 
 static int logit(int level, char *buf, size_t len)
@@ -147,6 +299,10 @@ static int usage(int code)
 		"  -f FILE  File to write log messages to, instead of syslog\n"
 		"  -n SIZE  Number of bytes before rotating, default: 200 kB\n"
 		"  -r NUM   Number of rotated files to keep, default: 5\n"
+		"  -b SIZE  Buffer up to SIZE bytes before writing to FILE, default: 4 kB\n"
+		"  -i MSEC  Max time lines are buffered before writing, default: 1000\n"
+		"  -S       Sync (fsync) FILE after each write, default: off\n"
+		"  -z CODEC Compress rotated files, gzip[:LEVEL] or none, default: gzip:6\n"
 		"  -v       Show program version\n"
 		"\n"
 		"This version of logit is distributed as part of Finit.\n"
@@ -157,16 +313,24 @@ static int usage(int code)
 
 int main(int argc, char *argv[])
 {
-	int c, rc, num = 5;
+	int c, rc, num = 5, interval = LOGIT_INTERVAL;
+	static struct flog f = { .threshold = LOGIT_BUF };
 	int facility = LOG_USER;
 	int level = LOG_INFO;
 	int log_opts = LOG_NOWAIT;
 	off_t size = 200 * 1024;
-	char *ident = NULL, *logfile = NULL;
+	char *ident = NULL, *logfile = NULL, *ptr;
 	char buf[512] = "";
 
-	while ((c = getopt(argc, argv, "f:hn:p:r:st:v")) != EOF) {
+	while ((c = getopt(argc, argv, "b:f:hi:n:p:r:sSt:vz:")) != EOF) {
 		switch (c) {
+		case 'b':
+			c = atoi(optarg);
+			if (c < 1)
+				c = 1;
+			f.threshold = c > LOGIT_BUF_MAX ? LOGIT_BUF_MAX : (size_t)c;
+			break;
+
 		case 'f':
 			logfile = optarg;
 			break;
@@ -174,6 +338,12 @@ int main(int argc, char *argv[])
 		case 'h':
 			return usage(0);
 
+		case 'i':
+			interval = atoi(optarg);
+			if (interval < 0)
+				interval = 0;
+			break;
+
 		case 'n':
 			size = atoi(optarg);
 			break;
@@ -191,6 +361,10 @@ int main(int argc, char *argv[])
 			log_opts |= LOG_PERROR;
 			break;
 
+		case 'S':
+			f.sync = 1;
+			break;
+
 		case 't':
 			ident = optarg;
 			break;
@@ -199,6 +373,16 @@ int main(int argc, char *argv[])
 			fprintf(stderr, "%s\n", version_info);
 			return 0;
 
+		case 'z':
+			ptr = strchr(optarg, ':');
+			if (ptr)
+				*ptr++ = 0;
+			if (logrotate_codec(optarg, ptr ? atoi(ptr) : 0)) {
+				fprintf(stderr, "Unsupported compression %s\n", optarg);
+				return usage(1);
+			}
+			break;
+
 		default:
 			return usage(1);
 		}
@@ -221,8 +405,12 @@ int main(int argc, char *argv[])
 
 	openlog(ident, log_opts, facility);
 
-	if (logfile)
-		rc = flogit(logfile, num, size, buf, sizeof(buf));
+	if (logfile) {
+		f.file = logfile;
+		f.num  = num;
+		f.sz   = size;
+		rc = flogit(&f, interval, buf, sizeof(buf));
+	}
 	else
 		rc = logit(level, buf, sizeof(buf));
 
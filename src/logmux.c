@@ -0,0 +1,1071 @@
+/* Log multiplexer, collects stdout/stderr of services for syslog or file
+ *
+ * Copyright (c) 2021  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#define SYSLOG_NAMES
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <lite/lite.h>
+#include <lite/queue.h>
+#include <uev/uev.h>
+
+#include "finit.h"
+#include "conf.h"
+#include "helpers.h"
+#include "latency.h"
+#include "log.h"
+#include "logmux.h"
+#include "logstore.h"
+#include "private.h"
+#include "util.h"
+
+extern int logrotate(char *file, int num, off_t sz);
+
+/* Buckets in the ident index of rings, power of two */
+#define LOGMUX_HASH 256
+
+/* log:/path/to/file, shared by all sources writing to it */
+struct logfile {
+	TAILQ_ENTRY(logfile) link;
+	char   *path;
+	int     fd;
+	off_t   size;		/* tracked, not fstat()'ed per write */
+	int     refs;
+
+	size_t  len;		/* lines batched in buf */
+	char    buf[LOGMUX_FILE_BUF];
+};
+
+/*
+ * Log rate limit, token buckets in thousandths of a line and byte.
+ * Shared by all processes of a service.  With block the buckets may
+ * go into debt, reading is then paused until they have recovered.
+ */
+struct lograte {
+	unsigned rate;		/* lines/s, 0: unlimited */
+	unsigned bytes;		/* bytes/s, 0: unlimited */
+	unsigned burst;		/* sec */
+	int      block;		/* backpressure, or drop */
+
+	int64_t  ltok;
+	int64_t  btok;
+	struct timespec last;
+};
+
+/* initctl log -F, client following a ring */
+struct logtail {
+	TAILQ_ENTRY(logtail) link;
+	int     sd;
+	uev_t   watcher;
+	struct logring *ring;
+};
+
+/*
+ * Recent output of a service, for initctl log.  Kept until the service
+ * is unregistered, and the last source writing to it is gone, so the
+ * output of a crashed service is still there after it has exited.
+ */
+struct logring {
+	TAILQ_ENTRY(logring) link;
+	LIST_ENTRY(logring)  by_ident;
+	char    ident[MAX_IDENT_LEN];
+	int     svc;		/* service still registered */
+	int     refs;		/* sources writing to it */
+	TAILQ_HEAD(, logtail) tails;
+
+	struct lograte     lim;
+	struct logmux_stat stat;
+	unsigned suppressed;	/* since last notice */
+
+	size_t  head;		/* oldest line */
+	size_t  len;
+	size_t  fresh;		/* not yet sent to tails */
+	char    buf[LOGMUX_RING_SIZE];
+};
+
+/* Read end of the stdout/stderr pipe of one started process */
+struct logsrc {
+	TAILQ_ENTRY(logsrc) link;
+	int     fd;
+	int     wfd;		/* write end, until handed to the child */
+	pid_t   pid;
+	uev_t   watcher;
+	uev_t   resume;		/* rate limit with block */
+
+	int     prio;		/* facility | level, for syslog */
+	char    ident[32];
+	struct logfile *file;	/* or syslog */
+	struct logring *ring;
+
+	size_t  len;		/* partial line in buf */
+	char    buf[LOGMUX_LINE_MAX];
+};
+
+static TAILQ_HEAD(, logsrc)  sources = TAILQ_HEAD_INITIALIZER(sources);
+static TAILQ_HEAD(, logfile) files   = TAILQ_HEAD_INITIALIZER(files);
+static TAILQ_HEAD(, logring) rings   = TAILQ_HEAD_INITIALIZER(rings);
+static LIST_HEAD(, logring)  ring_by_ident[LOGMUX_HASH];
+static size_t                num_rings;
+
+/* Batch of syslog messages, sent with a single sendmmsg() */
+static struct mmsghdr msgs[LOGMUX_BATCH];
+static struct iovec   iovs[LOGMUX_BATCH];
+static char           lines[LOGMUX_BATCH][LOGMUX_LINE_MAX + 64];
+static int            hdrs[LOGMUX_BATCH];	/* length of <PRI> */
+static int            num;
+
+static int sd = -1;		/* /dev/log */
+static int stream;		/* SOCK_STREAM, messages are NUL terminated */
+static int dropped;
+
+static int parse_prio(char *arg)
+{
+	int facility = LOG_USER, level = LOG_INFO;
+	char *prio = strdupa(arg);
+	char *ptr;
+
+	ptr = strchr(prio, '.');
+	if (ptr) {
+		*ptr++ = 0;
+
+		for (int i = 0; facilitynames[i].c_name; i++) {
+			if (!strcmp(facilitynames[i].c_name, prio)) {
+				facility = facilitynames[i].c_val;
+				break;
+			}
+		}
+
+		prio = ptr;
+	}
+
+	for (int i = 0; prioritynames[i].c_name; i++) {
+		if (!strcmp(prioritynames[i].c_name, prio)) {
+			level = prioritynames[i].c_val;
+			break;
+		}
+	}
+
+	return facility | level;
+}
+
+static int syslog_open(void)
+{
+	struct sockaddr_un sun = { .sun_family = AF_UNIX };
+	int types[] = { SOCK_DGRAM, SOCK_STREAM };
+
+	if (sd != -1)
+		return 0;
+
+	strlcpy(sun.sun_path, _PATH_LOG, sizeof(sun.sun_path));
+	for (size_t i = 0; i < NELEMS(types); i++) {
+		sd = socket(AF_UNIX, types[i] | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+		if (sd == -1)
+			return -1;
+
+		if (!connect(sd, (struct sockaddr *)&sun, sizeof(sun))) {
+			stream = types[i] == SOCK_STREAM;
+			return 0;
+		}
+
+		close(sd);
+		sd = -1;
+		if (errno != EPROTOTYPE)
+			break;
+	}
+
+	return -1;
+}
+
+static void syslog_close(void)
+{
+	if (sd != -1)
+		close(sd);
+	sd = -1;
+}
+
+/*
+ * Until syslogd is up, the messages go to the kernel ring buffer,
+ * without the timestamp, the kernel has its own.
+ */
+static void kmsg_send(void)
+{
+	int fd;
+
+	fd = open("/dev/kmsg", O_WRONLY | O_CLOEXEC | O_NONBLOCK);
+	if (fd == -1)
+		return;
+
+	for (int i = 0; i < num; i++) {
+		char *msg = lines[i] + hdrs[i] + LOGMUX_TS_LEN;
+		struct iovec iov[2] = {
+			{ lines[i], hdrs[i] },
+			{ msg, strlen(msg) },
+		};
+
+		if (writev(fd, iov, NELEMS(iov)) == -1)
+			break;
+	}
+	close(fd);
+}
+
+static void syslog_flush(void)
+{
+	int rc, retry = 1;
+
+	if (!num)
+		return;
+again:
+	if (syslog_open()) {
+		kmsg_send();
+		goto done;
+	}
+
+	rc = sendmmsg(sd, msgs, num, MSG_NOSIGNAL);
+	if (rc == -1) {
+		/* syslogd restarted, reconnect once */
+		if (retry-- && (errno == ECONNREFUSED || errno == ENOTCONN || errno == EPIPE)) {
+			syslog_close();
+			goto again;
+		}
+		rc = 0;
+	}
+
+	/* Never block PID 1 on a slow syslogd */
+	if (rc < num)
+		dropped += num - rc;
+	else if (dropped) {
+		logit(LOG_WARNING, "Log multiplexer dropped %d lines, syslogd too slow.", dropped);
+		dropped = 0;
+	}
+done:
+	num = 0;
+}
+
+/*
+ * RFC3164 time stamp of all lines, reformatted only when the second
+ * changes.  The time zone is read once, localtime_r() does not.
+ */
+static const char *stamp(void)
+{
+	static char ts[LOGMUX_TS_LEN + 1];
+	static time_t last = -1;
+	time_t now;
+	struct tm tm;
+
+	if (last == -1)
+		tzset();
+
+	now = time(NULL);
+	if (now != last) {
+		strftime(ts, sizeof(ts), "%b %e %H:%M:%S ", localtime_r(&now, &tm));
+		last = now;
+	}
+
+	return ts;
+}
+
+static void syslog_line(struct logsrc *src, char *line, size_t len)
+{
+	const char *ts;
+	int n;
+
+	if (num == LOGMUX_BATCH)
+		syslog_flush();
+
+	ts = stamp();
+
+	/* RFC3164, with a NUL terminator for syslogd on stream sockets */
+	hdrs[num] = snprintf(lines[num], sizeof(lines[num]), "<%d>", src->prio);
+	n = snprintf(lines[num] + hdrs[num], sizeof(lines[num]) - hdrs[num], "%s%s: %.*s",
+		     ts, src->ident, (int)len, line) + hdrs[num];
+	if (n >= (int)sizeof(lines[num]))
+		n = sizeof(lines[num]) - 1;
+
+	iovs[num].iov_base = lines[num];
+	iovs[num].iov_len  = n + stream;
+	msgs[num].msg_hdr  = (struct msghdr) { .msg_iov = &iovs[num], .msg_iovlen = 1 };
+	num++;
+}
+
+static int file_open(struct logfile *f)
+{
+	struct stat st;
+
+	f->fd = open(f->path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC | O_NOCTTY, 0644);
+	if (f->fd == -1) {
+		logit(LOG_ERR, "Failed opening %s: %s", f->path, strerror(errno));
+		return -1;
+	}
+
+	if (!fstat(f->fd, &st))
+		f->size = st.st_size;
+	else
+		f->size = 0;
+
+	return 0;
+}
+
+static struct logfile *file_get(char *path)
+{
+	struct logfile *f;
+
+	TAILQ_FOREACH(f, &files, link) {
+		if (!strcmp(f->path, path)) {
+			f->refs++;
+			return f;
+		}
+	}
+
+	f = calloc(1, sizeof(*f));
+	if (!f || !(f->path = strdup(path))) {
+		free(f);
+		return NULL;
+	}
+	f->fd   = -1;
+	f->refs = 1;
+	TAILQ_INSERT_TAIL(&files, f, link);
+
+	return f;
+}
+
+static void file_put(struct logfile *f)
+{
+	if (!f || --f->refs > 0)
+		return;
+
+	TAILQ_REMOVE(&files, f, link);
+	if (f->fd != -1)
+		close(f->fd);
+	free(f->path);
+	free(f);
+}
+
+/* Write all lines batched for @f in one go, rotate if too big */
+static void file_flush(struct logfile *f)
+{
+	char *buf = f->buf;
+	ssize_t rc;
+
+	if (!f->len)
+		return;
+
+	if (f->fd == -1 && file_open(f)) {
+		f->len = 0;
+		return;
+	}
+
+	while (f->len > 0) {
+		rc = write(f->fd, buf, f->len);
+		if (rc == -1) {
+			if (errno == EINTR)
+				continue;
+			logit(LOG_ERR, "Failed writing to %s: %s", f->path, strerror(errno));
+			break;
+		}
+		buf     += rc;
+		f->len  -= rc;
+		f->size += rc;
+	}
+	f->len = 0;
+
+	if (logfile_size_max > 0 && f->size > logfile_size_max) {
+		close(f->fd);
+		f->fd = -1;
+		logrotate(f->path, logfile_count_max, logfile_size_max);
+	}
+}
+
+static void file_line(struct logfile *f, char *line, size_t len)
+{
+	if (f->len + len + 1 > sizeof(f->buf))
+		file_flush(f);
+
+	memcpy(&f->buf[f->len], line, len);
+	f->len += len;
+	f->buf[f->len++] = '\n';
+}
+
+/* Bucket of @ident in ring_by_ident[] */
+static unsigned int ring_hash(const char *ident)
+{
+	return strhash(ident) & (LOGMUX_HASH - 1);
+}
+
+static struct logring *ring_find(char *ident)
+{
+	struct logring *r;
+
+	LIST_FOREACH(r, &ring_by_ident[ring_hash(ident)], by_ident) {
+		if (!strcmp(r->ident, ident))
+			return r;
+	}
+
+	return NULL;
+}
+
+static struct logring *ring_get(svc_t *svc)
+{
+	char ident[MAX_IDENT_LEN];
+	struct logring *r;
+
+	svc_ident(svc, ident, sizeof(ident));
+	r = ring_find(ident);
+	if (!r) {
+		r = calloc(1, sizeof(*r));
+		if (!r)
+			return NULL;
+
+		strlcpy(r->ident, ident, sizeof(r->ident));
+		strlcpy(r->stat.ident, ident, sizeof(r->stat.ident));
+		TAILQ_INIT(&r->tails);
+		TAILQ_INSERT_TAIL(&rings, r, link);
+		LIST_INSERT_HEAD(&ring_by_ident[ring_hash(ident)], r, by_ident);
+		num_rings++;
+	}
+	r->svc = 1;
+	r->refs++;
+
+	/* new settings apply from next start, buckets start full */
+	r->lim.rate  = svc->log.rate;
+	r->lim.bytes = svc->log.bytes;
+	r->lim.burst = svc->log.burst ?: LOGMUX_BURST;
+	r->lim.block = svc->log.block;
+
+	return r;
+}
+
+static void tail_free(struct logtail *t)
+{
+	uev_io_stop(&t->watcher);
+	TAILQ_REMOVE(&t->ring->tails, t, link);
+	close(t->sd);
+	free(t);
+}
+
+static void ring_free(struct logring *r)
+{
+	while (!TAILQ_EMPTY(&r->tails))
+		tail_free(TAILQ_FIRST(&r->tails));
+
+	TAILQ_REMOVE(&rings, r, link);
+	LIST_REMOVE(r, by_ident);
+	num_rings--;
+	free(r);
+}
+
+static void ring_put(struct logring *r)
+{
+	if (!r || --r->refs > 0 || r->svc)
+		return;
+
+	ring_free(r);
+}
+
+static char ring_at(struct logring *r, size_t off)
+{
+	return r->buf[(r->head + off) % sizeof(r->buf)];
+}
+
+static void ring_read(struct logring *r, size_t off, char *buf, size_t len)
+{
+	size_t pos = (r->head + off) % sizeof(r->buf);
+	size_t n = MIN(len, sizeof(r->buf) - pos);
+
+	memcpy(buf, &r->buf[pos], n);
+	memcpy(buf + n, r->buf, len - n);
+}
+
+static void ring_write(struct logring *r, const char *buf, size_t len)
+{
+	size_t pos = (r->head + r->len) % sizeof(r->buf);
+	size_t n = MIN(len, sizeof(r->buf) - pos);
+
+	memcpy(&r->buf[pos], buf, n);
+	memcpy(r->buf, buf + n, len - n);
+	r->len   += len;
+	r->fresh += len;
+}
+
+/* Append a line, dropping the oldest ones to make room */
+static void ring_line(struct logring *r, char *line, size_t len)
+{
+	size_t need = LOGMUX_TS_LEN + len + 1;
+
+	while (r->len > 0 && r->len + need > sizeof(r->buf)) {
+		char c;
+
+		do {
+			c = ring_at(r, 0);
+			r->head = (r->head + 1) % sizeof(r->buf);
+			r->len--;
+		} while (r->len > 0 && c != '\n');
+	}
+	if (r->fresh > r->len)
+		r->fresh = r->len;
+
+	ring_write(r, stamp(), LOGMUX_TS_LEN);
+	ring_write(r, line, len);
+	ring_write(r, "\n", 1);
+}
+
+/* Send whole lines, at most INIT_LOG_CHUNK per message, never block */
+static int ring_send(int sd, struct logring *r, size_t off, size_t len)
+{
+	char buf[INIT_LOG_CHUNK];
+
+	while (len > 0) {
+		size_t n = MIN(len, sizeof(buf));
+
+		ring_read(r, off, buf, n);
+		if (n < len) {
+			char *nl = memrchr(buf, '\n', n);
+
+			if (nl)
+				n = nl - buf + 1;
+		}
+
+		if (send(sd, buf, n, MSG_DONTWAIT | MSG_NOSIGNAL) != (ssize_t)n)
+			return -1;
+
+		off += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/* Forward lines added since last flush to any initctl log -F clients */
+static void ring_flush(struct logring *r)
+{
+	struct logtail *t, *tmp;
+
+	if (!r || !r->fresh)
+		return;
+
+	/* drop slow readers rather than block PID 1 */
+	TAILQ_FOREACH_SAFE(t, &r->tails, link, tmp) {
+		if (ring_send(t->sd, r, r->len - r->fresh, r->fresh))
+			tail_free(t);
+	}
+	r->fresh = 0;
+}
+
+static void rate_refill(struct lograte *lim)
+{
+	struct timespec now;
+	int64_t ms;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+	ms = (int64_t)(now.tv_sec - lim->last.tv_sec) * 1000 +
+		(now.tv_nsec - lim->last.tv_nsec) / 1000000;
+	if (ms <= 0)
+		return;
+	lim->last = now;
+
+	lim->ltok = MIN(lim->ltok + ms * lim->rate,  (int64_t)lim->rate  * lim->burst * 1000);
+	lim->btok = MIN(lim->btok + ms * lim->bytes, (int64_t)lim->bytes * lim->burst * 1000);
+}
+
+/* Returns non-zero if the line may pass, with block it always does */
+static int rate_take(struct lograte *lim, size_t len)
+{
+	if (!lim->rate && !lim->bytes)
+		return 1;
+
+	rate_refill(lim);
+	if (!lim->block) {
+		if (lim->rate && lim->ltok < 1000)
+			return 0;
+		if (lim->bytes && lim->btok < (int64_t)len * 1000)
+			return 0;
+	}
+
+	if (lim->rate)
+		lim->ltok -= 1000;
+	if (lim->bytes)
+		lim->btok -= (int64_t)len * 1000;
+
+	return 1;
+}
+
+/* With block, msec until buckets are out of debt, otherwise zero */
+static int rate_wait(struct lograte *lim)
+{
+	int64_t ms = 0;
+
+	if (!lim->block || (!lim->rate && !lim->bytes))
+		return 0;
+
+	rate_refill(lim);
+	if (lim->rate && lim->ltok < 1000)
+		ms = (1000 - lim->ltok) / lim->rate + 1;
+	if (lim->bytes && lim->btok < 0)
+		ms = MAX(ms, -lim->btok / lim->bytes + 1);
+
+	return ms;
+}
+
+static void src_emit(struct logsrc *src, char *line, size_t len)
+{
+	if (src->ring) {
+		ring_line(src->ring, line, len);
+		logstore_append(src->ring->ident, src->prio, line, len);
+	}
+
+	if (src->file)
+		file_line(src->file, line, len);
+	else
+		syslog_line(src, line, len);
+}
+
+/* Lines dropped by the rate limit are reported with the next line */
+static void src_suppressed(struct logsrc *src)
+{
+	struct logring *r = src->ring;
+	char msg[64];
+	int len;
+
+	if (!r || !r->suppressed)
+		return;
+
+	len = snprintf(msg, sizeof(msg), "%u messages suppressed by log rate limit", r->suppressed);
+	r->suppressed = 0;
+	src_emit(src, msg, len);
+}
+
+static void src_line(struct logsrc *src, char *line, size_t len)
+{
+	struct logring *r = src->ring;
+
+	/* strip any trailing CR */
+	while (len > 0 && line[len - 1] == '\r')
+		len--;
+
+	if (r) {
+		if (!rate_take(&r->lim, len)) {
+			r->stat.suppressed++;
+			r->suppressed++;
+			return;
+		}
+
+		src_suppressed(src);
+		r->stat.lines++;
+		r->stat.bytes += len;
+	}
+
+	src_emit(src, line, len);
+}
+
+static void src_flush(struct logsrc *src)
+{
+	ring_flush(src->ring);
+	logstore_flush();
+
+	if (src->file)
+		file_flush(src->file);
+	else
+		syslog_flush();
+}
+
+/* Returns 1 on EOF, or error, when the source is done */
+static int src_read(struct logsrc *src)
+{
+	ssize_t len;
+	char *line;
+	size_t pos;
+
+	len = read(src->fd, &src->buf[src->len], sizeof(src->buf) - src->len - 1);
+	if (len == -1 && (errno == EAGAIN || errno == EINTR))
+		return 0;
+	if (len <= 0) {
+		if (src->len)
+			src_line(src, src->buf, src->len);
+		src->len = 0;
+		src_suppressed(src);
+		src_flush(src);
+		return 1;
+	}
+	src->len += len;
+
+	line = src->buf;
+	for (pos = 0; pos < src->len; pos++) {
+		if (src->buf[pos] != '\n')
+			continue;
+
+		src_line(src, line, &src->buf[pos] - line);
+		line = &src->buf[pos + 1];
+	}
+
+	/* keep partial line, unless buffer is full */
+	src->len -= line - src->buf;
+	if (src->len == sizeof(src->buf) - 1) {
+		src_line(src, line, src->len);
+		src->len = 0;
+	} else if (src->len)
+		memmove(src->buf, line, src->len);
+
+	src_flush(src);
+
+	return 0;
+}
+
+static void src_free(struct logsrc *src)
+{
+	uev_timer_stop(&src->resume);
+	uev_io_stop(&src->watcher);
+	TAILQ_REMOVE(&sources, src, link);
+	if (src->wfd != -1)
+		close(src->wfd);
+	close(src->fd);
+	file_put(src->file);
+	ring_put(src->ring);
+	free(src);
+}
+
+static void resume_cb(uev_t *w, void *arg, int events)
+{
+	static struct latency lat = { .stat.name = "resume_cb" };
+	struct logsrc *src = (struct logsrc *)arg;
+	struct timespec start;
+
+	latency_start(&start);
+	uev_io_start(&src->watcher);
+
+	latency_stop(&lat, &start);
+}
+
+static void src_cb(uev_t *w, void *arg, int events)
+{
+	static struct latency lat = { .stat.name = "src_cb" };
+	struct logsrc *src = (struct logsrc *)arg;
+	struct timespec start;
+
+	latency_start(&start);
+	if (UEV_ERROR == events) {
+		src_free(src);
+		goto done;
+	}
+
+	if (src_read(src)) {
+		src_free(src);
+		goto done;
+	}
+
+	/* backpressure, the service blocks when the pipe is full */
+	if (src->ring) {
+		int ms = rate_wait(&src->ring->lim);
+
+		if (ms > 0) {
+			src->ring->stat.throttled += ms;
+			uev_io_stop(&src->watcher);
+			uev_timer_init(ctx, &src->resume, resume_cb, src, ms, 0);
+		}
+	}
+done:
+	latency_stop(&lat, &start);
+}
+
+/**
+ * logmux_open - Set up collection of stdout/stderr of a service
+ * @svc: Service to be started, with log enabled
+ *
+ * Creates a pipe, the read end is watched by the event loop, lines are
+ * forwarded to syslog using the log:prio and log:tag of @svc, or written
+ * to its log:/path/to/file.  The source lives until the last process
+ * holding the write end has exited.
+ *
+ * Returns:
+ * Write end of the pipe, for the child's stdout/stderr, or -1 on error.
+ * The caller must call logmux_close() after fork().
+ */
+int logmux_open(svc_t *svc)
+{
+	struct logsrc *src;
+	int fd[2];
+
+	src = calloc(1, sizeof(*src));
+	if (!src)
+		return -1;
+
+	if (pipe2(fd, O_CLOEXEC)) {
+		free(src);
+		return -1;
+	}
+	fcntl(fd[0], F_SETFL, fcntl(fd[0], F_GETFL) | O_NONBLOCK);
+
+	src->fd  = fd[0];
+	src->wfd = fd[1];
+	src->ring = ring_get(svc);
+	src->prio = parse_prio(svc->log.prio[0] ? svc->log.prio : "daemon.info");
+
+	if (svc->log.file[0] == '/') {
+		src->file = file_get(svc->log.file);
+		if (!src->file)
+			goto fail;
+	} else {
+		char *tag = basename(svc->cmd);
+
+		if (svc->log.ident[0])
+			tag = svc->log.ident;
+		strlcpy(src->ident, tag, sizeof(src->ident));
+	}
+
+	if (uev_io_init(ctx, &src->watcher, src_cb, src, src->fd, UEV_READ))
+		goto fail;
+	TAILQ_INSERT_TAIL(&sources, src, link);
+
+	return src->wfd;
+fail:
+	file_put(src->file);
+	ring_put(src->ring);
+	close(fd[0]);
+	close(fd[1]);
+	free(src);
+
+	return -1;
+}
+
+/**
+ * logmux_close - Close the write end of the pipe in Finit after fork()
+ * @fd:  Write end, from logmux_open()
+ * @pid: Process writing to the pipe, or -1 if fork() failed
+ */
+void logmux_close(int fd, pid_t pid)
+{
+	struct logsrc *src;
+
+	if (fd == -1)
+		return;
+
+	TAILQ_FOREACH(src, &sources, link) {
+		if (src->wfd != fd)
+			continue;
+
+		close(src->wfd);
+		src->wfd = -1;
+		src->pid = pid;
+		return;
+	}
+}
+
+/**
+ * logmux_complete - Wait for a process, collecting its output meanwhile
+ * @cmd: Command, for error messages
+ * @pid: Process to wait for
+ *
+ * Like complete(), but for run/task commands with log enabled, they
+ * would otherwise block on a full pipe.  Output from any background
+ * processes holding the pipe after @pid has exited is collected by the
+ * event loop, as usual.
+ *
+ * Returns:
+ * Exit status from waitpid(), or -1 on error.
+ */
+int logmux_complete(char *cmd, pid_t pid)
+{
+	struct logsrc *src;
+	int status;
+
+	TAILQ_FOREACH(src, &sources, link) {
+		if (src->pid == pid)
+			break;
+	}
+	if (!src)
+		return complete(cmd, pid);
+
+	while (1) {
+		struct pollfd pfd = { .fd = src->fd, .events = POLLIN };
+		pid_t rc;
+
+		rc = waitpid(pid, &status, WNOHANG);
+		if (rc == pid)
+			break;
+		if (rc == -1) {
+			_pe("Failed waiting for %s", cmd);
+			return -1;
+		}
+
+		if (poll(&pfd, 1, 100) > 0 && src_read(src)) {
+			src_free(src);
+			return complete(cmd, pid);
+		}
+	}
+
+	/* drain what is buffered, the rest is read by the event loop */
+	while (1) {
+		struct pollfd pfd = { .fd = src->fd, .events = POLLIN };
+
+		if (poll(&pfd, 1, 0) <= 0)
+			break;
+
+		if (src_read(src)) {
+			src_free(src);
+			break;
+		}
+	}
+
+	return status;
+}
+
+/**
+ * logmux_has_ring - Check if there is any recent output from a service
+ * @svc: Service to check
+ *
+ * Returns:
+ * %TRUE(1) if @svc has been started with log enabled, otherwise %FALSE(0).
+ */
+int logmux_has_ring(svc_t *svc)
+{
+	return ring_find(svc_ident(svc, NULL, 0)) != NULL;
+}
+
+static void tail_cb(uev_t *w, void *arg, int events)
+{
+	static struct latency lat = { .stat.name = "tail_cb" };
+	struct logtail *t = (struct logtail *)arg;
+	char buf[16];
+	struct timespec start;
+
+	latency_start(&start);
+
+	/* client has nothing to say, this is EOF or an error */
+	if (UEV_ERROR != events && read(w->fd, buf, sizeof(buf)) == -1 && errno == EAGAIN)
+		goto done;
+
+	tail_free(t);
+done:
+	latency_stop(&lat, &start);
+}
+
+/**
+ * logmux_tail - Send recent output of a service to an initctl client
+ * @sd:     Client socket, closed when done
+ * @svc:    Service, see logmux_has_ring()
+ * @lines:  Number of lines, or zero for all in the ring
+ * @follow: Keep @sd and send new lines as they arrive
+ *
+ * The lines are sent as messages of at most %INIT_LOG_CHUNK bytes.  A
+ * following client that does not keep up with the output is dropped.
+ */
+void logmux_tail(int sd, svc_t *svc, int lines, int follow)
+{
+	struct logring *r;
+	struct logtail *t;
+	size_t off;
+
+	r = ring_find(svc_ident(svc, NULL, 0));
+	if (!r)
+		goto done;
+
+	if (lines <= 0)
+		lines = INT_MAX;
+
+	off = r->len;
+	while (off > 0 && lines-- > 0) {
+		off--;
+		while (off > 0 && ring_at(r, off - 1) != '\n')
+			off--;
+	}
+
+	if (ring_send(sd, r, off, r->len - off) || !follow)
+		goto done;
+
+	t = calloc(1, sizeof(*t));
+	if (!t)
+		goto done;
+
+	fcntl(sd, F_SETFL, fcntl(sd, F_GETFL) | O_NONBLOCK);
+	t->sd   = sd;
+	t->ring = r;
+	if (uev_io_init(ctx, &t->watcher, tail_cb, t, sd, UEV_READ)) {
+		free(t);
+		goto done;
+	}
+	TAILQ_INSERT_TAIL(&r->tails, t, link);
+
+	return;
+done:
+	close(sd);
+}
+
+/**
+ * logmux_stats - Send log counters of all services to an initctl client
+ * @sd: Client socket, closed when done
+ */
+void logmux_stats(int sd)
+{
+	struct logmux_stat *buf;
+	struct logring *r;
+	size_t num = 0;
+
+	buf = calloc(num_rings ? num_rings : 1, sizeof(*buf));
+	if (!buf) {
+		close(sd);
+		return;
+	}
+
+	TAILQ_FOREACH(r, &rings, link)
+		buf[num++] = r->stat;
+
+	api_reply(sd, buf, num, sizeof(*buf));
+}
+
+/**
+ * logmux_forget - Drop recent output of a service being unregistered
+ * @svc: Service
+ *
+ * The ring is freed when the last process writing to it has exited.
+ */
+void logmux_forget(svc_t *svc)
+{
+	struct logring *r;
+
+	r = ring_find(svc_ident(svc, NULL, 0));
+	if (!r)
+		return;
+
+	r->svc = 0;
+	if (!r->refs)
+		ring_free(r);
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
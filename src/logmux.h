@@ -0,0 +1,62 @@
+/* Log multiplexer, collects stdout/stderr of services for syslog or file
+ *
+ * Copyright (c) 2021  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef FINIT_LOGMUX_H_
+#define FINIT_LOGMUX_H_
+
+#include <stdint.h>
+#include "svc.h"
+
+#define LOGMUX_LINE_MAX   1024		/* Longer lines are split */
+#define LOGMUX_BATCH      32		/* Max syslog messages per sendmmsg() */
+#define LOGMUX_FILE_BUF   8192		/* Max bytes per write() to log:/file */
+#define LOGMUX_TS_LEN     16		/* "Mmm dd hh:mm:ss " */
+#define LOGMUX_RING_SIZE  8192		/* Recent output kept per service */
+#define LOGMUX_BURST      2		/* sec, default log rate limit burst */
+
+/* Reply to INIT_CMD_LOG_STATS, as many per message as fit INIT_LOG_CHUNK */
+struct logmux_stat {
+	char     ident[MAX_IDENT_LEN];
+	uint64_t lines;			/* forwarded */
+	uint64_t bytes;
+	uint64_t suppressed;		/* dropped by rate limit */
+	uint64_t throttled;		/* msec not read, rate limit with block */
+};
+
+int  logmux_open    (svc_t *svc);
+void logmux_close   (int fd, pid_t pid);
+int  logmux_complete(char *cmd, pid_t pid);
+
+int  logmux_has_ring(svc_t *svc);
+void logmux_tail    (int sd, svc_t *svc, int lines, int follow);
+void logmux_forget  (svc_t *svc);
+void logmux_stats   (int sd);
+
+#endif /* FINIT_LOGMUX_H_ */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
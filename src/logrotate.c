@@ -20,12 +20,35 @@
  * THE SOFTWARE.
  */
 
+
+#include "config.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
 #include <lite/lite.h>
 #include <stdio.h>
+#include <string.h>
 #include <syslog.h>
+#include <time.h>
+#include <sys/file.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <unistd.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+/* Rotated, but not yet aged, file.0.NSEC, picked up in order */
+#define PENDING "%s.0.%019llu"
+
+#ifdef HAVE_ZLIB
+static char *codec = "gzip";
+#else
+static char *codec = "none";
+#endif
+static int   level = 6;
 
 static int recreate(char *path, mode_t mode, uid_t uid, gid_t gid)
 {
@@ -37,65 +60,234 @@ static int recreate(char *path, mode_t mode, uid_t uid, gid_t gid)
 	return 0;
 }
 
+/*
+ * Compress @src to @src.gz, in-process with zlib, via a temporary file
+ * so a partial .gz is never seen.  @src is removed on success.
+ */
+static int zip(char *src)
+{
+#ifdef HAVE_ZLIB
+	size_t len = strlen(src) + 8;
+	char dst[len], tmp[len], mode[4];
+	char buf[16384];
+	struct stat st;
+	int fd, out;
+	ssize_t num;
+	gzFile gz;
+
+	if (!strcmp(codec, "none"))
+		return 1;
+
+	fd = open(src, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return 1;
+
+	snprintf(dst, len, "%s.gz", src);
+	snprintf(tmp, len, "%s.gz~", src);
+	snprintf(mode, sizeof(mode), "wb%d", level);
+
+	out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (out == -1)
+		goto fail;
+	if (!fstat(fd, &st) && (fchown(out, st.st_uid, st.st_gid) || fchmod(out, st.st_mode & 07777)))
+		syslog(LOG_WARNING, "Failed setting owner and mode of %s: %s", tmp, strerror(errno));
+
+	gz = gzdopen(out, mode);
+	if (!gz) {
+		close(out);
+		goto fail;
+	}
+
+	while ((num = read(fd, buf, sizeof(buf))) > 0) {
+		if (gzwrite(gz, buf, num) != num) {
+			gzclose(gz);
+			goto fail;
+		}
+	}
+	if (gzclose(gz) != Z_OK || num == -1)
+		goto fail;
+	close(fd);
+
+	if (rename(tmp, dst))
+		goto fail;
+
+	return remove(src);
+fail:
+	syslog(LOG_ERR, "Failed compressing %s: %s", src, strerror(errno));
+	(void)remove(tmp);
+	close(fd);
+#else
+	(void)src;
+#endif
+	return 1;
+}
+
+/* Oldest pending rotated file of @file, or NULL */
+static char *pending(char *file, char *buf, size_t len)
+{
+	char *dir, *base, *fn;
+	struct dirent *d;
+	size_t blen;
+	DIR *dp;
+
+	fn   = strdupa(file);
+	dir  = dirname(fn);
+	fn   = strdupa(file);
+	base = basename(fn);
+	blen = strlen(base);
+
+	dp = opendir(dir);
+	if (!dp)
+		return NULL;
+
+	buf[0] = 0;
+	while ((d = readdir(dp))) {
+		if (strncmp(d->d_name, base, blen) || strncmp(&d->d_name[blen], ".0.", 3))
+			continue;
+		if (strlen(d->d_name) != blen + 3 + 19)
+			continue;
+
+		if (!buf[0] || strcmp(d->d_name, strrchr(buf, '/') + 1) < 0)
+			snprintf(buf, len, "%s/%s", dir, d->d_name);
+	}
+	closedir(dp);
+
+	return buf[0] ? buf : NULL;
+}
+
+/*
+ * Age the rotated files of @file, at most @num are kept, and by default
+ * .2 and older are compressed.  Pending files, moved out of the way by
+ * logrotate(), are handled oldest first.  Serialized on the directory,
+ * in case a new rotation starts before compression of the last is done.
+ */
+static void age(char *file, int num)
+{
+	size_t len = strlen(file) + 32;
+	char ofile[len], nfile[len], pfile[len];
+	char *dir, *fn;
+	int cnt, dfd;
+
+	fn  = strdupa(file);
+	dir = dirname(fn);
+	dfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dfd != -1 && flock(dfd, LOCK_EX))
+		syslog(LOG_WARNING, "Failed locking %s for logrotate: %s", dir, strerror(errno));
+
+	while (pending(file, pfile, len)) {
+		/* First age zipped log files */
+		for (cnt = num; cnt > 2; cnt--) {
+			snprintf(ofile, len, "%s.%d.gz", file, cnt - 1);
+			snprintf(nfile, len, "%s.%d.gz", file, cnt);
+
+			/* May fail because ofile doesn't exist yet, ignore. */
+			if (rename(ofile, nfile) && errno != ENOENT)
+				syslog(LOG_ERR, "Failed logrotate %s: %s",
+				       ofile, strerror(errno));
+		}
+
+		for (cnt = num; cnt > 1; cnt--) {
+			snprintf(ofile, len, "%s.%d", file, cnt - 1);
+			snprintf(nfile, len, "%s.%d", file, cnt);
+
+			/* May fail because ofile doesn't exist yet, ignore. */
+			if (rename(ofile, nfile) && errno != ENOENT)
+				syslog(LOG_ERR, "Failed logrotate %s: %s",
+				       ofile, strerror(errno));
+		}
+
+		snprintf(nfile, len, "%s.1", file);
+		if (rename(pfile, nfile)) {
+			syslog(LOG_ERR, "Failed logrotate %s: %s", pfile, strerror(errno));
+			(void)remove(pfile);
+		}
+
+		snprintf(nfile, len, "%s.2", file);
+		if (num > 2 && fexist(nfile))
+			zip(nfile);
+	}
+
+	if (dfd != -1)
+		close(dfd);
+}
+
+/**
+ * logrotate_codec - Set compression of rotated log files
+ * @name: One of "gzip", or "none"
+ * @lvl:  Compression level, 1-9, or 0 for default
+ *
+ * Returns:
+ * POSIX OK(0), or -1 if @name is not supported.
+ */
+int logrotate_codec(char *name, int lvl)
+{
+	if (!strcmp(name, "none"))
+		codec = "none";
+#ifdef HAVE_ZLIB
+	else if (!strcmp(name, "gzip"))
+		codec = "gzip";
+#endif
+	else
+		return -1;
+
+	if (lvl < 0 || lvl > 9)
+		return -1;
+	level = lvl ? lvl : 6;
+
+	return 0;
+}
+
 /*
  * This function triggers a log rotates of @file when size >= @sz bytes
  * At most @num old versions are kept and by default it starts gzipping
- * .2 and older log files.  If gzip is not available in $PATH then @num
- * files are kept uncompressed.
+ * .2 and older log files, in-process with zlib.
+ *
+ * Only moving @file out of the way and recreating it is done by the
+ * caller, so writing can continue right away.  Aging and compression
+ * of the old files is done in the background, by a detached process.
  */
 int logrotate(char *file, int num, off_t sz)
 {
-	int cnt;
+	struct timespec now;
 	struct stat st;
+	pid_t pid;
 
 	if (stat(file, &st))
 		return 1;
 
-	if (sz > 0 && S_ISREG(st.st_mode) && st.st_size > sz) {
-		if (num > 0) {
-			size_t len = strlen(file) + 10 + 1;
-			char   ofile[len];
-			char   nfile[len];
-
-			/* First age zipped log files */
-			for (cnt = num; cnt > 2; cnt--) {
-				snprintf(ofile, len, "%s.%d.gz", file, cnt - 1);
-				snprintf(nfile, len, "%s.%d.gz", file, cnt);
-
-				/* May fail because ofile doesn't exist yet, ignore. */
-				if (rename(ofile, nfile) && errno != ENOENT)
-					syslog(LOG_ERR, "Failed logrotate %s: %s",
-					       ofile, strerror(errno));
-			}
+	if (sz <= 0 || !S_ISREG(st.st_mode) || st.st_size <= sz)
+		return 0;
 
-			for (cnt = num; cnt > 0; cnt--) {
-				snprintf(ofile, len, "%s.%d", file, cnt - 1);
-				snprintf(nfile, len, "%s.%d", file, cnt);
+	if (num > 0) {
+		size_t len = strlen(file) + 32;
+		char   pfile[len];
 
-				/* May fail because ofile doesn't exist yet, ignore. */
-				if (rename(ofile, nfile) && errno != ENOENT) {
-					syslog(LOG_ERR, "Failed logrotate %s: %s",
-					       ofile, strerror(errno));
-					continue;
-				}
+		clock_gettime(CLOCK_REALTIME, &now);
+		snprintf(pfile, len, PENDING, file,
+			 (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec);
+		if (rename(file, pfile))
+			goto fallback;
+		recreate(file, st.st_mode, st.st_uid, st.st_gid);
 
-				if (cnt == 2 && fexist(nfile)) {
-					if (systemf("gzip %s 2>/dev/null", nfile))
-						continue; /* no gzip, probably */
-
-					(void)remove(nfile);
-				}
+		/* Double fork, the worker is reparented and reaped by init */
+		pid = fork();
+		if (pid == 0) {
+			if (fork() == 0) {
+				age(file, num);
+				_exit(0);
 			}
-
-			if (rename(file, nfile))
-				goto fallback;
-			recreate(file, st.st_mode, st.st_uid, st.st_gid);
-		} else {
-		fallback:
-			if (truncate(file, 0))
-				syslog(LOG_ERR, "Failed truncating %s during logrotate: %s",
-				       file, strerror(errno));
+			_exit(0);
 		}
+
+		if (pid > 0)
+			waitpid(pid, NULL, 0);
+		else
+			age(file, num);
+	} else {
+	fallback:
+		if (truncate(file, 0))
+			syslog(LOG_ERR, "Failed truncating %s during logrotate: %s",
+			       file, strerror(errno));
 	}
 
 	return 0;
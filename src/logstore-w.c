@@ -0,0 +1,495 @@
+/* Indexed binary store of service output, writer side
+ *
+ * Copyright (c) 2021  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <lite/lite.h>
+
+#include "finit.h"
+#include "helpers.h"
+#include "log.h"
+#include "logstore.h"
+#include "util.h"
+
+#define LOGSTORE_RETRY 5	/* sec, before retrying a failed segment open */
+#define LOGSTORE_HASH  64	/* power of two, buckets in ident index */
+
+static char    *store;		/* NULL: disabled */
+static int      seg_size  = LOGSTORE_SIZE;
+static int      seg_count = LOGSTORE_COUNT;
+
+/* From .conf files, applied by logstore_config() */
+static char    *conf_store;
+static int      conf_size  = LOGSTORE_SIZE;
+static int      conf_count = LOGSTORE_COUNT;
+
+static int      fd = -1;
+static uint32_t seq;		/* current segment */
+static off_t    off;		/* end of segment, incl. buffered */
+static off_t    mark_at;	/* next time mark */
+static time_t   retry;
+static int      failed;		/* error logged */
+
+static size_t   len;
+static char     buf[LOGSTORE_BUF];
+
+static struct logstore_idx   idx;
+static struct logstore_ent  *ents;
+static struct logstore_mark *marks;
+static size_t   ents_max, marks_max;
+static uint32_t bucket[LOGSTORE_HASH];	/* 1 + first ent, 0: empty */
+static uint32_t *chain;			/* 1 + next ent in same bucket */
+static size_t   chain_max;
+static int      noidx;		/* out of memory, reader scans segment */
+
+static int seg_seq(char *name, uint32_t *n)
+{
+	char ext[4];
+
+	return sscanf(name, "%8x.%3s", n, ext) == 2 &&
+		(!strcmp(ext, "seg") || !strcmp(ext, "idx"));
+}
+
+/* Highest sequence number in store, zero if empty */
+static uint32_t seg_last(void)
+{
+	struct dirent *d;
+	uint32_t n, max = 0;
+	DIR *dp;
+
+	dp = opendir(store);
+	if (!dp)
+		return 0;
+
+	while ((d = readdir(dp))) {
+		if (seg_seq(d->d_name, &n) && n > max)
+			max = n;
+	}
+	closedir(dp);
+
+	return max;
+}
+
+/* Remove segments, and their index, older than the last count */
+static void seg_prune(void)
+{
+	struct dirent *d;
+	uint32_t n;
+	DIR *dp;
+
+	dp = opendir(store);
+	if (!dp)
+		return;
+
+	while ((d = readdir(dp))) {
+		if (!seg_seq(d->d_name, &n) || n > seq)
+			continue;
+		if (seq - n < (uint32_t)seg_count)
+			continue;
+
+		if (unlinkat(dirfd(dp), d->d_name, 0))
+			_pe("Failed removing %s/%s", store, d->d_name);
+	}
+	closedir(dp);
+}
+
+static void seg_error(const char *what)
+{
+	if (failed)
+		return;
+
+	logit(LOG_ERR, "Failed %s log store %s: %s", what, store, strerror(errno));
+	failed = 1;
+}
+
+static int seg_open(void)
+{
+	struct logstore_seg hdr = {
+		.version = LOGSTORE_VERSION,
+	};
+	char path[256];
+
+	if (time(NULL) < retry)
+		return -1;
+
+	if (mkpath(store, 0755))
+		goto fail;
+
+	if (!seq)
+		seq = seg_last();
+	hdr.seq = ++seq;
+	memcpy(hdr.magic, LOGSTORE_MAGIC, sizeof(hdr.magic));
+
+	snprintf(path, sizeof(path), "%s/" LOGSTORE_SEG, store, seq);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0640);
+	if (fd == -1)
+		goto fail;
+
+	if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+		close(fd);
+		fd = -1;
+		goto fail;
+	}
+
+	off     = sizeof(hdr);
+	mark_at = off;
+	len     = 0;
+	noidx   = 0;
+	failed  = 0;
+	memset(&idx, 0, sizeof(idx));
+	memset(bucket, 0, sizeof(bucket));
+
+	seg_prune();
+
+	/* let initctl find us */
+	erase(LOGSTORE_LINK);
+	if (symlink(store, LOGSTORE_LINK))
+		_pe("Failed creating %s", LOGSTORE_LINK);
+
+	return 0;
+fail:
+	seg_error("opening");
+	retry = time(NULL) + LOGSTORE_RETRY;
+
+	return -1;
+}
+
+static void *grow(void *arr, size_t *max, size_t num, size_t sz)
+{
+	void *ptr;
+
+	if (num < *max)
+		return arr;
+
+	ptr = realloc(arr, (*max + 16) * sz);
+	if (!ptr)
+		return NULL;
+	*max += 16;
+
+	return ptr;
+}
+
+/* Bucket of the part of @ident that fits in the index entry */
+static uint32_t ident_hash(const char *ident)
+{
+	char name[sizeof(ents->ident)];
+
+	strlcpy(name, ident, sizeof(name));
+
+	return strhash(name) & (LOGSTORE_HASH - 1);
+}
+
+static void index_add(char *ident, int64_t time, off_t at)
+{
+	struct logstore_ent *e = NULL;
+	uint32_t h, i;
+	void *ptr;
+
+	if (noidx)
+		return;
+
+	h = ident_hash(ident);
+	for (i = bucket[h]; i; i = chain[i - 1]) {
+		if (!strncmp(ents[i - 1].ident, ident, sizeof(ents->ident) - 1)) {
+			e = &ents[i - 1];
+			break;
+		}
+	}
+
+	if (!e) {
+		ptr = grow(ents, &ents_max, idx.num, sizeof(*ents));
+		if (!ptr)
+			goto fail;
+		ents = ptr;
+
+		ptr = grow(chain, &chain_max, idx.num, sizeof(*chain));
+		if (!ptr)
+			goto fail;
+		chain = ptr;
+
+		chain[idx.num] = bucket[h];
+		bucket[h] = idx.num + 1;
+
+		e = &ents[idx.num++];
+		memset(e, 0, sizeof(*e));
+		strlcpy(e->ident, ident, sizeof(e->ident));
+		e->first     = time;
+		e->first_off = at;
+	}
+
+	e->count++;
+	e->last_off = at;
+	if (time < e->first)
+		e->first = time;
+	if (time > e->last)
+		e->last = time;
+
+	if (!idx.first || time < idx.first)
+		idx.first = time;
+	if (time > idx.last)
+		idx.last = time;
+
+	if (at >= mark_at) {
+		ptr = grow(marks, &marks_max, idx.marks, sizeof(*marks));
+		if (!ptr)
+			goto fail;
+		marks = ptr;
+
+		marks[idx.marks++] = (struct logstore_mark){ .time = time, .off = at };
+		mark_at = at + LOGSTORE_MARK;
+	}
+
+	return;
+fail:
+	_e("Out of memory, log store segment %08x will not be indexed", seq);
+	noidx = 1;
+}
+
+/* Written last, a segment with an index is complete */
+static void index_write(void)
+{
+	struct iovec iov[] = {
+		{ &idx,  sizeof(idx) },
+		{ ents,  idx.num   * sizeof(*ents)  },
+		{ marks, idx.marks * sizeof(*marks) },
+	};
+	char path[256], tmp[260];
+	int ifd;
+
+	if (noidx)
+		return;
+
+	memcpy(idx.magic, LOGSTORE_IDXMAGIC, sizeof(idx.magic));
+	idx.version = LOGSTORE_VERSION;
+
+	snprintf(path, sizeof(path), "%s/" LOGSTORE_IDX, store, seq);
+	snprintf(tmp, sizeof(tmp), "%s~", path);
+	ifd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+	if (ifd == -1)
+		goto fail;
+
+	if (writev(ifd, iov, NELEMS(iov)) == -1) {
+		close(ifd);
+		goto fail;
+	}
+	close(ifd);
+
+	if (!rename(tmp, path))
+		return;
+fail:
+	_pe("Failed writing log store index %s", path);
+	erase(tmp);
+}
+
+static void buf_write(void)
+{
+	char *ptr = buf;
+	ssize_t rc;
+
+	while (len > 0) {
+		rc = write(fd, ptr, len);
+		if (rc == -1) {
+			if (errno == EINTR)
+				continue;
+			seg_error("writing to");
+			break;
+		}
+		ptr += rc;
+		len -= rc;
+	}
+	len = 0;
+}
+
+static void seg_close(void)
+{
+	buf_write();
+	index_write();
+	close(fd);
+	fd = -1;
+}
+
+/**
+ * logstore_append - Add a line of output from a service to the store
+ * @ident: Service identity, NAME[:ID]
+ * @prio:  Facility and level, as for syslog
+ * @msg:   Line of output, not NUL terminated
+ * @msglen: Length of @msg
+ *
+ * The record is buffered until logstore_flush(), or the buffer is full.
+ */
+void logstore_append(char *ident, int prio, char *msg, size_t msglen)
+{
+	struct logstore_rec rec = { 0 };
+	struct timespec ts;
+	size_t idlen, size;
+
+	if (!store)
+		return;
+	if (fd == -1 && seg_open())
+		return;
+
+	idlen = strlen(ident);
+	size  = LOGSTORE_ALIGN(sizeof(rec) + idlen + msglen);
+	if (size > sizeof(buf))
+		return;
+	if (len + size > sizeof(buf))
+		buf_write();
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	rec.time  = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	rec.size  = size;
+	rec.len   = msglen;
+	rec.idlen = idlen;
+	rec.prio  = prio;
+
+	memcpy(&buf[len], &rec, sizeof(rec));
+	memcpy(&buf[len + sizeof(rec)], ident, idlen);
+	memcpy(&buf[len + sizeof(rec) + idlen], msg, msglen);
+	memset(&buf[len + sizeof(rec) + idlen + msglen], 0, size - sizeof(rec) - idlen - msglen);
+
+	index_add(ident, rec.time, off);
+	len += size;
+	off += size;
+}
+
+/**
+ * logstore_flush - Write buffered records, start new segment if full
+ */
+void logstore_flush(void)
+{
+	if (fd == -1)
+		return;
+
+	buf_write();
+	if (off >= seg_size)
+		seg_close();
+}
+
+/**
+ * logstore_exit - Close the active segment and write its index
+ */
+void logstore_exit(void)
+{
+	if (fd == -1)
+		return;
+
+	seg_close();
+}
+
+/**
+ * logstore_reset - Reset settings to defaults, before .conf reload
+ *
+ * The store is disabled by default, a logstore line in any .conf file
+ * enables it again.  Nothing changes until logstore_config().
+ */
+void logstore_reset(void)
+{
+	free(conf_store);
+	conf_store = NULL;
+	conf_size  = LOGSTORE_SIZE;
+	conf_count = LOGSTORE_COUNT;
+}
+
+/**
+ * logstore_parse - Parse logstore /path [size:BYTES] [count:NUM]
+ * @arg: Arguments from finit.conf
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero on error.
+ */
+int logstore_parse(char *arg)
+{
+	int size = LOGSTORE_SIZE, count = LOGSTORE_COUNT;
+	char *tok, *path = NULL, *s;
+
+	s = strdupa(arg);
+
+	for (tok = strtok(s, " \t"); tok; tok = strtok(NULL, " \t")) {
+		if (!strncmp(tok, "size:", 5))
+			size = strtobytes(tok + 5);
+		else if (!strncmp(tok, "count:", 6))
+			count = atoi(tok + 6);
+		else if (tok[0] == '/')
+			path = tok;
+		else
+			_e("Unknown logstore option %s", tok);
+	}
+
+	if (!path) {
+		_e("logstore requires an absolute path");
+		return 1;
+	}
+	if (size < LOGSTORE_BUF || count < 2) {
+		_e("Invalid logstore size:%d count:%d", size, count);
+		return 1;
+	}
+
+	free(conf_store);
+	conf_store = strdup(path);
+	if (!conf_store)
+		return 1;
+
+	conf_size  = size;
+	conf_count = count;
+
+	return 0;
+}
+
+/**
+ * logstore_config - Apply settings from .conf files, after reload
+ *
+ * Changing the directory, or removing the logstore line, closes the
+ * active segment.  The next line of output starts a new one.
+ */
+void logstore_config(void)
+{
+	if (store && (!conf_store || strcmp(store, conf_store))) {
+		logstore_exit();
+		free(store);
+		store = NULL;
+		seq = 0;
+	}
+	if (!store && conf_store) {
+		store = strdup(conf_store);
+		if (!store)
+			_pe("Failed enabling logstore %s", conf_store);
+	}
+
+	seg_size  = conf_size;
+	seg_count = conf_count;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,268 @@
+/* Indexed binary store of service output, reader side
+ *
+ * Copyright (c) 2021  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "logstore.h"
+
+struct map {
+	char   *ptr;
+	size_t  len;
+};
+
+static int map(char *dir, const char *fmt, uint32_t seq, struct map *m)
+{
+	char path[256], name[16];
+	struct stat st;
+	int fd;
+
+	snprintf(name, sizeof(name), fmt, seq);
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+
+	if (fstat(fd, &st) || st.st_size == 0) {
+		close(fd);
+		return -1;
+	}
+
+	m->len = st.st_size;
+	m->ptr = mmap(NULL, m->len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (m->ptr == MAP_FAILED)
+		return -1;
+
+	return 0;
+}
+
+static void unmap(struct map *m)
+{
+	if (m->ptr)
+		munmap(m->ptr, m->len);
+	m->ptr = NULL;
+}
+
+static int seq_cmp(const void *a, const void *b)
+{
+	uint32_t x = *(uint32_t *)a, y = *(uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Sorted list of segments in the store, caller frees */
+static uint32_t *segments(char *dir, size_t *num)
+{
+	uint32_t *list = NULL, *ptr, n;
+	size_t max = 0;
+	struct dirent *d;
+	char ext[4];
+	DIR *dp;
+
+	*num = 0;
+	dp = opendir(dir);
+	if (!dp)
+		return NULL;
+
+	while ((d = readdir(dp))) {
+		if (sscanf(d->d_name, "%8x.%3s", &n, ext) != 2 || strcmp(ext, "seg"))
+			continue;
+
+		if (*num == max) {
+			ptr = realloc(list, (max + 64) * sizeof(*list));
+			if (!ptr)
+				break;
+			list = ptr;
+			max += 64;
+		}
+		list[(*num)++] = n;
+	}
+	closedir(dp);
+
+	qsort(list, *num, sizeof(*list), seq_cmp);
+
+	return list;
+}
+
+/* NAME matches all instances, NAME:ID only that one */
+static int ident_match(char *ident, char *name, size_t len)
+{
+	size_t n;
+
+	if (!ident)
+		return 1;
+
+	n = strlen(ident);
+	if (len < n || memcmp(name, ident, n))
+		return 0;
+
+	return len == n || (name[n] == ':' && !strchr(ident, ':'));
+}
+
+/*
+ * Narrow down the part of the segment to scan using its index, if it
+ * has one.  Returns non-zero if nothing in the segment can match.
+ */
+static int seg_range(struct map *idx, char *ident, int64_t since, int64_t until,
+		     size_t *from, size_t *to)
+{
+	struct logstore_idx *hdr = (struct logstore_idx *)idx->ptr;
+	struct logstore_ent *ents;
+	struct logstore_mark *marks;
+	size_t first = SIZE_MAX, last = 0;
+
+	if (idx->len < sizeof(*hdr) || memcmp(hdr->magic, LOGSTORE_IDXMAGIC, sizeof(hdr->magic)) ||
+	    hdr->version != LOGSTORE_VERSION ||
+	    idx->len < sizeof(*hdr) + hdr->num * sizeof(*ents) + hdr->marks * sizeof(*marks))
+		return 0;	/* unusable index, scan it all */
+
+	if (hdr->last < since || (until && hdr->first > until))
+		return 1;
+
+	ents  = (struct logstore_ent *)(hdr + 1);
+	marks = (struct logstore_mark *)(ents + hdr->num);
+
+	for (uint32_t i = 0; i < hdr->num; i++) {
+		struct logstore_ent *e = &ents[i];
+
+		if (!ident_match(ident, e->ident, strnlen(e->ident, sizeof(e->ident))))
+			continue;
+		if (e->last < since || (until && e->first > until))
+			continue;
+
+		if (e->first_off < first)
+			first = e->first_off;
+		if (e->last_off > last)
+			last = e->last_off;
+	}
+	if (first == SIZE_MAX)
+		return 1;
+
+	/* skip ahead to the last time mark before @since */
+	for (uint32_t i = 0; i < hdr->marks && marks[i].time < since; i++) {
+		if (marks[i].off > first)
+			first = marks[i].off;
+	}
+
+	*from = first;
+	*to   = last;
+
+	return 0;
+}
+
+static void seg_scan(struct map *seg, size_t from, size_t to, char *ident,
+		     int64_t since, int64_t until, logstore_cb cb)
+{
+	char name[MAX_IDENT_LEN], msg[UINT16_MAX + 1];
+
+	while (from <= to && from + sizeof(struct logstore_rec) <= seg->len) {
+		struct logstore_rec *rec = (struct logstore_rec *)(seg->ptr + from);
+		char *ptr = (char *)(rec + 1);
+
+		/* end of active segment, or torn write */
+		if (rec->size < sizeof(*rec) || rec->size > seg->len - from ||
+		    sizeof(*rec) + rec->idlen + rec->len > rec->size)
+			break;
+		from += rec->size;
+
+		if (rec->time < since || (until && rec->time > until))
+			continue;
+		if (!ident_match(ident, ptr, rec->idlen))
+			continue;
+
+		snprintf(name, sizeof(name), "%.*s", rec->idlen, ptr);
+		memcpy(msg, ptr + rec->idlen, rec->len);
+		msg[rec->len] = 0;
+
+		cb(rec, name, msg);
+	}
+}
+
+/**
+ * logstore_query - Find output of a service in a time range
+ * @dir:   Log store directory
+ * @ident: Service, NAME for all instances or NAME:ID, or %NULL for all
+ * @since: Start of range, usec since the epoch
+ * @until: End of range, or zero for no limit
+ * @cb:    Called for each matching record, in order
+ *
+ * Segments are mapped, not read, and their index used to skip those,
+ * or the parts of them, with nothing of interest.
+ *
+ * Returns:
+ * POSIX OK(0) on success, or non-zero if the store cannot be read.
+ */
+int logstore_query(char *dir, char *ident, int64_t since, int64_t until, logstore_cb cb)
+{
+	uint32_t *list;
+	size_t num;
+
+	list = segments(dir, &num);
+	if (!list)
+		return -1;
+
+	for (size_t i = 0; i < num; i++) {
+		struct map seg = { 0 }, idx = { 0 };
+		struct logstore_seg *hdr;
+		size_t from, to;
+		int skip = 0;
+
+		if (map(dir, LOGSTORE_SEG, list[i], &seg))
+			continue;
+
+		hdr  = (struct logstore_seg *)seg.ptr;
+		from = sizeof(*hdr);
+		to   = seg.len;
+		if (seg.len < sizeof(*hdr) || memcmp(hdr->magic, LOGSTORE_MAGIC, sizeof(hdr->magic)) ||
+		    hdr->version != LOGSTORE_VERSION)
+			skip = 1;
+		else if (!map(dir, LOGSTORE_IDX, list[i], &idx))
+			skip = seg_range(&idx, ident, since, until, &from, &to);
+
+		if (!skip)
+			seg_scan(&seg, from, to, ident, since, until, cb);
+
+		unmap(&idx);
+		unmap(&seg);
+	}
+	free(list);
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
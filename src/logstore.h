@@ -0,0 +1,114 @@
+/* Indexed binary store of service output, for initctl log --since/--until
+ *
+ * Copyright (c) 2021  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef FINIT_LOGSTORE_H_
+#define FINIT_LOGSTORE_H_
+
+#include <paths.h>
+#include <stdint.h>
+#include "svc.h"
+
+/*
+ * The store is a directory of segments, NNNNNNNN.seg, each an append
+ * only sequence of records.  When a segment is full it is closed, its
+ * index written to NNNNNNNN.idx, and a new one is started.  The oldest
+ * segments are removed when there are more than count.  A segment
+ * without index, the active one or after a crash, is scanned instead.
+ */
+#define LOGSTORE_LINK     _PATH_VARRUN "finit/logstore"	/* -> store dir */
+#define LOGSTORE_SEG      "%08x.seg"
+#define LOGSTORE_IDX      "%08x.idx"
+#define LOGSTORE_MAGIC    "FINITLOG"
+#define LOGSTORE_IDXMAGIC "FINITIDX"
+#define LOGSTORE_VERSION  1
+#define LOGSTORE_SIZE     1048576	/* Default segment size */
+#define LOGSTORE_COUNT    8		/* Default number of segments */
+#define LOGSTORE_MARK     65536		/* Time mark every N bytes in index */
+#define LOGSTORE_BUF      16384		/* Max bytes per write() */
+
+#define LOGSTORE_ALIGN(x) (((x) + 7) & ~7)
+
+/* Segment header */
+struct logstore_seg {
+	char     magic[8];
+	uint32_t version;
+	uint32_t seq;
+};
+
+/* Record, followed by ident and message, padded to 8 bytes */
+struct logstore_rec {
+	int64_t  time;		/* usec since the epoch */
+	uint32_t size;		/* of record, incl. header and padding */
+	uint16_t len;		/* message */
+	uint8_t  idlen;		/* ident, NAME[:ID] */
+	uint8_t  prio;		/* facility | level */
+};
+
+/* Index header, followed by num entries and marks */
+struct logstore_idx {
+	char     magic[8];
+	uint32_t version;
+	uint32_t num;
+	uint32_t marks;
+	uint32_t pad;
+	int64_t  first;		/* time range of segment */
+	int64_t  last;
+};
+
+/* Index entry, one per service in the segment */
+struct logstore_ent {
+	char     ident[MAX_IDENT_LEN];
+	uint32_t count;
+	uint32_t first_off;	/* first and last record */
+	uint32_t last_off;
+	int64_t  first;		/* time range */
+	int64_t  last;
+};
+
+/* Time of first record at or after every LOGSTORE_MARK bytes */
+struct logstore_mark {
+	int64_t  time;
+	uint32_t off;
+	uint32_t pad;
+};
+
+/* Writer, in Finit */
+void logstore_reset (void);
+int  logstore_parse (char *arg);
+void logstore_config(void);
+void logstore_append(char *ident, int prio, char *msg, size_t len);
+void logstore_flush (void);
+void logstore_exit  (void);
+
+/* Reader, in initctl */
+typedef void (*logstore_cb)(struct logstore_rec *rec, char *ident, char *msg);
+int  logstore_query (char *dir, char *ident, int64_t since, int64_t until, logstore_cb cb);
+
+#endif /* FINIT_LOGSTORE_H_ */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -21,9 +21,25 @@
  * THE SOFTWARE.
  */
 
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <mntent.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include <sys/mount.h>
+#include <sys/wait.h>
+#include <lite/lite.h>
+
+#include "finit.h"
+#include "helpers.h"
+#include "log.h"
+#include "pid.h"
 
 /*
  * SysV init on Debian/Ubuntu skips these protected mount points
@@ -59,53 +75,370 @@ static int is_protected(char *dir)
 	return 0;
 }
 
-static void iterator_end(FILE **fp)
+/* Max number of concurrent umount workers */
+#define UMOUNT_WORKERS 32
+
+/* Bounded wait, in msec, for a busy mount and for a hung umount worker */
+#define UMOUNT_BUSY    1000
+#define UMOUNT_TIMEOUT 5000
+
+struct mnt {
+	int   id;
+	int   parent;
+	char *dir;
+	char *fsname;		/* mount source, e.g. /dev/sda1 or tmpfs */
+
+	int   children;		/* Child mounts not yet unmounted */
+	pid_t worker;		/* Pending umount worker, or 0 */
+	long  started;		/* When worker was started, msec */
+	int   done;
+};
+
+/* Result from worker, in shared memory */
+struct res {
+	int   err;		/* errno from umount2(), or 0 */
+	int   lazy;		/* Busy, detached with MNT_DETACH */
+};
+
+static long now_ms(void)
 {
-	endmntent(*fp);
-	*fp = NULL;
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
-static struct mntent *iterator(char *fstab, FILE **fp)
+/* Mount points in mountinfo have space, tab, newline and \ octal escaped */
+static char *unescape(char *str)
 {
-	static struct mntent *mnt;
+	char *src, *dst;
 
-	if (!*fp && fstab) {
-		*fp = setmntent(fstab, "r");
-		if (!*fp)
-			return NULL;
+	for (src = dst = str; *src; src++, dst++) {
+		if (src[0] == '\\' && isdigit(src[1]) && isdigit(src[2]) && isdigit(src[3])) {
+			*dst = (src[1] - '0') * 64 + (src[2] - '0') * 8 + (src[3] - '0');
+			src += 3;
+		} else
+			*dst = *src;
 	}
+	*dst = 0;
+
+	return str;
+}
 
-	while ((mnt = getmntent(*fp))) {
-		if (is_protected(mnt->mnt_dir))
+/*
+ * Read the mount tree from /proc/self/mountinfo, once.  Each line has
+ * the mount ID, the parent mount ID, and after the optional fields and
+ * the '-' separator, the file system type and the mount source:
+ *
+ *   36 35 98:0 /mnt1 /mnt2 rw,noatime master:1 - ext3 /dev/root rw
+ */
+static struct mnt *mount_tree(int *num)
+{
+	struct mnt *tree = NULL, *m;
+	char line[LINE_SIZE];
+	int i, j, max = 0;
+	FILE *fp;
+
+	*num = 0;
+	fp = fopen("/proc/self/mountinfo", "r");
+	if (!fp)
+		return NULL;
+
+	while (fgets(line, sizeof(line), fp)) {
+		char dir[LINE_SIZE], fsname[LINE_SIZE];
+		int id, parent;
+		char *ptr;
+
+		if (sscanf(line, "%d %d %*s %*s %s", &id, &parent, dir) != 3)
+			continue;
+		ptr = strstr(line, " - ");
+		if (!ptr || sscanf(ptr, " - %*s %s", fsname) != 1)
 			continue;
 
-		return mnt;
+		if (*num == max) {
+			max = max ? max * 2 : 64;
+			m = realloc(tree, max * sizeof(*m));
+			if (!m)
+				break;
+			tree = m;
+		}
+
+		m = &tree[(*num)++];
+		memset(m, 0, sizeof(*m));
+		m->id     = id;
+		m->parent = parent;
+		m->dir    = strdup(unescape(dir));
+		m->fsname = strdup(unescape(fsname));
+		if (!m->dir || !m->fsname) {
+			free(m->dir);
+			free(m->fsname);
+			(*num)--;
+		}
+	}
+	fclose(fp);
+
+	for (i = 0; i < *num; i++) {
+		for (j = 0; j < *num; j++) {
+			if (i != j && tree[j].parent == tree[i].id)
+				tree[i].children++;
+		}
 	}
 
-	iterator_end(fp);
-	return NULL;
+	return tree;
 }
 
-void unmount_tmpfs(void)
+static void mount_tree_free(struct mnt *tree, int num)
 {
-	struct mntent *mnt;
-	FILE *fp = NULL;
+	for (int i = 0; i < num; i++) {
+		free(tree[i].dir);
+		free(tree[i].fsname);
+	}
+	free(tree);
+}
+
+/*
+ * Worker process, a busy mount may be released by processes that are
+ * about to exit, so we retry for a while before detaching it lazily.
+ */
+static void worker(struct mnt *m, struct res *r)
+{
+	long end = now_ms() + UMOUNT_BUSY;
+	struct timespec ts = { 0, 50000000 };
+
+	while (umount2(m->dir, 0)) {
+		r->err = errno;
+		if (errno != EBUSY)
+			_exit(1);
 
-	while ((mnt = iterator("/proc/mounts", &fp))) {
-		if (!strcmp("tmpfs", mnt->mnt_fsname) && !umount(mnt->mnt_dir))
-			iterator_end(&fp);  /* Restart iteration */
+		if (now_ms() >= end) {
+			if (!umount2(m->dir, MNT_DETACH)) {
+				r->lazy = 1;
+				_exit(0);
+			}
+			_exit(1);
+		}
+		nanosleep(&ts, NULL);
 	}
+
+	r->err = 0;
+	_exit(0);
 }
 
-void unmount_regular(void)
+/*
+ * Find processes keeping @dir busy, i.e., with their cwd, root, or an
+ * open file below it.  Used to report why an unmount failed.
+ */
+static char *busy_procs(const char *dir, char *buf, size_t len)
+{
+	size_t dlen = strlen(dir);
+	struct dirent *d;
+	DIR *proc;
+
+	buf[0] = 0;
+	proc = opendir("/proc");
+	if (!proc)
+		return buf;
+
+	while ((d = readdir(proc))) {
+		char path[64], link[PATH_MAX], *files[] = { "cwd", "root", "exe" };
+		int pid, busy = 0;
+		struct dirent *f;
+		DIR *fds;
+		ssize_t n;
+
+		pid = atoi(d->d_name);
+		if (pid <= 1)
+			continue;
+
+		for (size_t i = 0; !busy && i < NELEMS(files); i++) {
+			snprintf(path, sizeof(path), "/proc/%d/%s", pid, files[i]);
+			n = readlink(path, link, sizeof(link) - 1);
+			if (n <= 0)
+				continue;
+			link[n] = 0;
+			if (!strncmp(link, dir, dlen) && (link[dlen] == '/' || !link[dlen]))
+				busy = 1;
+		}
+
+		snprintf(path, sizeof(path), "/proc/%d/fd", pid);
+		fds = opendir(path);
+		while (fds && !busy && (f = readdir(fds))) {
+			char fd[sizeof(path) + 16];
+
+			if (f->d_name[0] == '.')
+				continue;
+
+			snprintf(fd, sizeof(fd), "%s/%s", path, f->d_name);
+			n = readlink(fd, link, sizeof(link) - 1);
+			if (n <= 0)
+				continue;
+			link[n] = 0;
+			if (!strncmp(link, dir, dlen) && (link[dlen] == '/' || !link[dlen]))
+				busy = 1;
+		}
+		if (fds)
+			closedir(fds);
+
+		if (busy) {
+			char name[32];
+			size_t pos = strlen(buf);
+
+			snprintf(&buf[pos], len - pos, "%s%s[%d]", pos ? ", " : "",
+				 pid_get_name(pid, name, sizeof(name)) ?: "?", pid);
+		}
+	}
+	closedir(proc);
+
+	return buf;
+}
+
+static void report(struct mnt *m, struct res *r)
 {
-	struct mntent *mnt;
-	FILE *fp = NULL;
+	char procs[128];
 
-	while ((mnt = iterator("/proc/mounts", &fp))) {
-		if (!umount(mnt->mnt_dir))
-			iterator_end(&fp);  /* Restart iteration */
+	if (m->worker) {
+		logit(LOG_WARNING, "Timed out unmounting %s, abandoning it.", m->dir);
+		return;
 	}
+
+	if (!r->err)
+		return;
+
+	if (r->err == EBUSY)
+		busy_procs(m->dir, procs, sizeof(procs));
+	else
+		procs[0] = 0;
+
+	if (r->lazy)
+		logit(LOG_WARNING, "%s busy%s%s, detached lazily.", m->dir,
+		      procs[0] ? ", used by " : "", procs);
+	else
+		logit(LOG_WARNING, "Failed unmounting %s: %s%s%s", m->dir, strerror(r->err),
+		      procs[0] ? ", used by " : "", procs);
+}
+
+/*
+ * Unmount all non-protected mounts, optionally only from @fsname, in
+ * dependency order.  The mount tree is read once, a mount is unmounted
+ * as soon as all its children have been unmounted, and all such leaves
+ * are unmounted concurrently, each in a worker process of its own.  A
+ * worker that hangs, e.g. on an unreachable NFS server, is abandoned
+ * after a bounded wait, leaving its parent mounted.
+ */
+static void unmount_all(const char *fsname)
+{
+	int i, num, running = 0;
+	struct mnt *tree;
+	struct res *res;
+
+	tree = mount_tree(&num);
+	if (!tree)
+		return;
+
+	res = mmap(NULL, num * sizeof(*res), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (res == MAP_FAILED) {
+		mount_tree_free(tree, num);
+		return;
+	}
+	memset(res, 0, num * sizeof(*res));
+
+	while (1) {
+		int status;
+		pid_t pid;
+
+		for (i = 0; i < num && running < UMOUNT_WORKERS; i++) {
+			struct mnt *m = &tree[i];
+
+			if (m->done || m->worker || m->children)
+				continue;
+			if (is_protected(m->dir) || (fsname && strcmp(m->fsname, fsname)))
+				continue;
+
+			pid = fork();
+			if (pid == -1)
+				break;
+			if (!pid)
+				worker(m, &res[i]);
+
+			m->worker  = pid;
+			m->started = now_ms();
+			running++;
+		}
+
+		if (!running)
+			break;
+
+		pid = waitpid(-1, &status, WNOHANG);
+		if (pid <= 0) {
+			struct timespec ts = { 0, 10000000 };
+			long now = now_ms();
+
+			/* Abandon hung workers, the mount stays */
+			for (i = 0; i < num; i++) {
+				struct mnt *m = &tree[i];
+
+				if (!m->worker || now - m->started < UMOUNT_TIMEOUT)
+					continue;
+
+				kill(m->worker, SIGKILL);
+				report(m, &res[i]);
+				m->worker = 0;
+				m->done = -1;
+				running--;
+			}
+
+			nanosleep(&ts, NULL);
+			continue;
+		}
+
+		for (i = 0; i < num; i++) {
+			struct mnt *m = &tree[i];
+
+			if (m->worker != pid)
+				continue;
+
+			m->worker = 0;
+			running--;
+			report(m, &res[i]);
+			if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+				m->done = -1;
+				break;
+			}
+
+			/* Unmounted, or detached, parent may now be a leaf */
+			m->done = 1;
+			for (int j = 0; j < num; j++) {
+				if (tree[j].id == m->parent && tree[j].children > 0)
+					tree[j].children--;
+			}
+			break;
+		}
+	}
+
+	/* Mounts left because of a failed, or hung, unmount below them */
+	for (i = 0; !fsname && i < num; i++) {
+		struct mnt *m = &tree[i];
+
+		if (m->done || !m->children || is_protected(m->dir))
+			continue;
+
+		logit(LOG_WARNING, "%s left mounted, %d submount(s) remain.", m->dir, m->children);
+	}
+
+	munmap(res, num * sizeof(*res));
+	mount_tree_free(tree, num);
+}
+
+/* Mounts with source "tmpfs", named ones, e.g. "shm", are left for later */
+void unmount_tmpfs(void)
+{
+	unmount_all("tmpfs");
+}
+
+void unmount_regular(void)
+{
+	unmount_all(NULL);
 }
 
 /**
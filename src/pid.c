@@ -23,16 +23,30 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <paths.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
 #include <lite/lite.h>
 
 #include "pid.h"
 #include "svc.h"
 #include "helpers.h"
 
+/* Older C libraries, the syscall numbers are the same on all arches */
+#ifndef __NR_pidfd_send_signal
+#define __NR_pidfd_send_signal 424
+#endif
+#ifndef __NR_pidfd_open
+#define __NR_pidfd_open        434
+#endif
+
+/* P_PIDFD is only in the idtype_t enum of newer C libraries */
+static const idtype_t p_pidfd = 3;
+
 
 /**
  * pid_alive - Check if a given process ID is running
@@ -51,6 +65,90 @@ int pid_alive(pid_t pid)
 }
 
 
+/**
+ * pid_open - Open a pidfd for a process
+ * @pid: Process ID to open
+ *
+ * The pidfd refers to the process, not the PID, so it can be used to
+ * signal the process without the risk of hitting a recycled PID.  It is
+ * readable, for poll(), when the process has terminated.
+ *
+ * Returns:
+ * A close-on-exec pidfd, or -1 on error, e.g., %ENOSYS on kernels older
+ * than Linux 5.3, or %ESRCH if the process has already terminated.
+ */
+int pid_open(pid_t pid)
+{
+	int fd;
+
+	fd = syscall(__NR_pidfd_open, pid, 0);
+	if (fd == -1)
+		return -1;
+
+	/* pidfds are always close-on-exec, make sure */
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	return fd;
+}
+
+/**
+ * pid_signal - Send a signal to a process using its pidfd
+ * @pidfd: A pidfd from pid_open()
+ * @signo: Signal to send, zero to check if process is still alive
+ *
+ * Returns:
+ * POSIX OK(0) on success, otherwise -1 and errno set, %ESRCH if the
+ * process has terminated.
+ */
+int pid_signal(int pidfd, int signo)
+{
+	return syscall(__NR_pidfd_send_signal, pidfd, signo, NULL, 0);
+}
+
+/**
+ * pid_peek - Check for a terminated child process, without collecting it
+ * @pidfd:  A pidfd from pid_open(), or -1 for any child
+ * @status: Pointer to store waitpid() style exit status in
+ *
+ * The zombie is left for the caller to reap, e.g., with waitpid(), so
+ * its PID, and process group, cannot be recycled in the meantime.
+ *
+ * Returns:
+ * PID of the terminated process, zero if none, or -1 on error, e.g.,
+ * %ECHILD if it is not our child, with @status %SVC_STATUS_UNKNOWN.
+ */
+pid_t pid_peek(int pidfd, int *status)
+{
+	siginfo_t si = { 0 };
+	int rc;
+
+	if (pidfd < 0)
+		rc = waitid(P_ALL, 0, &si, WEXITED | WNOHANG | WNOWAIT);
+	else
+		rc = waitid(p_pidfd, pidfd, &si, WEXITED | WNOHANG | WNOWAIT);
+	if (rc) {
+		*status = SVC_STATUS_UNKNOWN;
+		return -1;
+	}
+	if (!si.si_pid)
+		return 0;
+
+	switch (si.si_code) {
+	case CLD_EXITED:
+		*status = (si.si_status & 0xff) << 8;
+		break;
+	case CLD_DUMPED:
+		*status = (si.si_status & 0x7f) | 0x80;
+		break;
+	default:
+		*status = si.si_status & 0x7f;
+		break;
+	}
+
+	return si.si_pid;
+}
+
+
 /**
  * pid_get_name - Find name of a process
  * @pid:  PID of process to find.
@@ -199,6 +297,13 @@ int pid_file_parse(svc_t *svc, char *arg)
 		char path[MAX_ARG_LEN];
 
 		arg += 4;
+
+		/* Forking, main PID and liveness tracked by cgroup */
+		if (!strcmp(arg, "!cgroup")) {
+			strlcpy(svc->pidfile, "!", sizeof(svc->pidfile));
+			return 0;
+		}
+
 		if ((arg[0] == '!' && arg[1] == '/') || arg[0] == '/')
 			return pid_file_set(svc, arg, 0);
 
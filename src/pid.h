@@ -29,6 +29,9 @@
 #include "util.h"
 
 int   pid_alive       (pid_t pid);
+int   pid_open        (pid_t pid);
+int   pid_signal      (int pidfd, int signo);
+pid_t pid_peek        (int pidfd, int *status);
 char *pid_get_name    (pid_t pid, char *name, size_t len);
 
 char *pid_file        (svc_t *svc);
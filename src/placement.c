@@ -0,0 +1,512 @@
+/* CPU affinity, NUMA placement and scheduling of services
+ *
+ * Copyright (c) 2021  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <lite/lite.h>
+
+#include "finit.h"
+#include "helpers.h"
+#include "log.h"
+#include "placement.h"
+#include "util.h"
+
+#ifndef MPOL_BIND
+#define MPOL_BIND         2
+#endif
+
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_SHIFT 13
+
+static const struct {
+	char *name;
+	int   policy;
+} policies[] = {
+	{ "other", SCHED_OTHER },
+	{ "fifo",  SCHED_FIFO  },
+	{ "rr",    SCHED_RR    },
+	{ "batch", SCHED_BATCH },
+	{ "idle",  SCHED_IDLE  },
+};
+
+static const char *ioclass[] = { "none", "rt", "be", "idle" };
+
+/*
+ * Parse a list of CPUs, or NUMA nodes, on the same format as the kernel
+ * uses in cpuset.cpus, e.g. 0-3,8,10-11.  Values must be below @max.
+ */
+static int parse_list(const char *list, int max, cpu_set_t *set)
+{
+	char *buf, *tok, *pos;
+
+	CPU_ZERO(set);
+	buf = strdupa(list);
+
+	for (tok = strtok_r(buf, ",", &pos); tok; tok = strtok_r(NULL, ",", &pos)) {
+		char *last = strchr(tok, '-');
+		const char *errstr;
+		long long lo, hi;
+
+		if (last)
+			*last++ = 0;
+
+		lo = strtonum(tok, 0, max - 1, &errstr);
+		if (errstr)
+			return -1;
+
+		hi = lo;
+		if (last) {
+			hi = strtonum(last, lo, max - 1, &errstr);
+			if (errstr)
+				return -1;
+		}
+
+		while (lo <= hi)
+			CPU_SET(lo++, set);
+	}
+
+	return CPU_COUNT(set) ? 0 : -1;
+}
+
+static int parse_num(svc_t *svc, char *key, char *val, int min, int max, int *num)
+{
+	const char *errstr;
+
+	*num = (int)strtonum(val, min, max, &errstr);
+	if (errstr) {
+		_e("%s: %s:%s is %s (%d-%d)", svc->cmd, key, val, errstr, min, max);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int parse_cpus(svc_t *svc, char *val)
+{
+	struct svc_sched *s = &svc->sched;
+
+	if (strlen(val) >= sizeof(svc->cgroup.cpus) || parse_list(val, CPU_SETSIZE, &s->cpus)) {
+		_e("%s: invalid cpus:%s", svc->cmd, val);
+		return 1;
+	}
+	strlcpy(svc->cgroup.cpus, val, sizeof(svc->cgroup.cpus));
+
+	return 0;
+}
+
+/*
+ * The CPUs of each node in @nodes are used for the affinity, unless
+ * an explicit cpus:LIST is given.
+ */
+static int parse_numa(svc_t *svc, char *val)
+{
+	struct svc_sched *s = &svc->sched;
+	int max = sizeof(s->mems) * 8;
+	cpu_set_t nodes;
+
+	if (strlen(val) >= sizeof(svc->cgroup.mems) || parse_list(val, max, &nodes)) {
+		_e("%s: invalid numa:%s (0-%d)", svc->cmd, val, max - 1);
+		return 1;
+	}
+
+	s->mems = 0;
+	for (int n = 0; n < max; n++) {
+		if (!CPU_ISSET(n, &nodes))
+			continue;
+
+		if (!fisdir(str("/sys/devices/system/node/node%d", n)))
+			logit(LOG_WARNING, "%s: numa node %d does not exist.", svc->cmd, n);
+		s->mems |= 1UL << n;
+	}
+	strlcpy(svc->cgroup.mems, val, sizeof(svc->cgroup.mems));
+
+	return 0;
+}
+
+/*
+ * CPUs of the NUMA nodes in @mems, also as a cpuset.cpus @list unless
+ * %NULL.  Returns the number of CPUs, or -1 if @list is too short.
+ */
+static int node_cpus(unsigned long mems, cpu_set_t *cpus, char *list, size_t len)
+{
+	int max = sizeof(mems) * 8;
+	int rc = 0;
+
+	CPU_ZERO(cpus);
+	if (list)
+		list[0] = 0;
+	for (int n = 0; n < max; n++) {
+		char buf[64];
+		cpu_set_t set;
+		FILE *fp;
+
+		if (!(mems & (1UL << n)))
+			continue;
+
+		fp = fopen(str("/sys/devices/system/node/node%d/cpulist", n), "r");
+		if (!fp)
+			continue;
+
+		if (fgets(buf, sizeof(buf), fp) && !parse_list(chomp(buf), CPU_SETSIZE, &set)) {
+			CPU_OR(cpus, cpus, &set);
+			if (list) {
+				if (list[0] && strlcat(list, ",", len) >= len)
+					rc = -1;
+				if (strlcat(list, buf, len) >= len)
+					rc = -1;
+			}
+		}
+		fclose(fp);
+	}
+
+	return rc ?: CPU_COUNT(cpus);
+}
+
+/* Bind to the CPUs of numa:NODES, rejected if cpuset.cpus cannot hold them */
+static void numa_cpus(svc_t *svc)
+{
+	struct svc_sched *s = &svc->sched;
+	int num;
+
+	num = node_cpus(s->mems, &s->cpus, svc->cgroup.cpus, sizeof(svc->cgroup.cpus));
+	if (num < 0) {
+		_e("%s: CPUs of numa:%s do not fit in cpuset.cpus, ignoring.", svc->cmd, svc->cgroup.mems);
+		s->flags &= ~PLACE_MEMS;
+		s->mems = 0;
+		CPU_ZERO(&s->cpus);
+		svc->cgroup.cpus[0] = 0;
+		svc->cgroup.mems[0] = 0;
+		return;
+	}
+
+	if (num)
+		s->flags |= PLACE_CPUS;
+}
+
+static int parse_sched(svc_t *svc, char *val)
+{
+	struct svc_sched *s = &svc->sched;
+	char *prio = strchr(val, ':');
+	size_t i;
+
+	if (prio)
+		*prio++ = 0;
+
+	for (i = 0; i < NELEMS(policies); i++) {
+		if (!strcmp(val, policies[i].name))
+			break;
+	}
+	if (i == NELEMS(policies)) {
+		_e("%s: invalid sched:%s, must be other, fifo, rr, batch, or idle", svc->cmd, val);
+		return 1;
+	}
+
+	s->policy = policies[i].policy;
+	s->prio   = 0;
+	if (s->policy == SCHED_FIFO || s->policy == SCHED_RR) {
+		s->prio = 1;
+		if (prio && parse_num(svc, "sched priority", prio, 1, 99, &s->prio))
+			return 1;
+	} else if (prio) {
+		_e("%s: sched:%s does not take a priority", svc->cmd, val);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int parse_ioprio(svc_t *svc, char *val)
+{
+	struct svc_sched *s = &svc->sched;
+	char *level = strchr(val, ':');
+	int class, num = 4;
+
+	if (level)
+		*level++ = 0;
+
+	for (class = 1; class < (int)NELEMS(ioclass); class++) {
+		if (!strcmp(val, ioclass[class]))
+			break;
+	}
+	if (class == (int)NELEMS(ioclass)) {
+		_e("%s: invalid ioprio:%s, must be rt, be, or idle", svc->cmd, val);
+		return 1;
+	}
+
+	if (level && parse_num(svc, "ioprio level", level, 0, 7, &num))
+		return 1;
+	if (!strcmp(val, "idle"))
+		num = 0;
+
+	s->ioprio = (class << IOPRIO_CLASS_SHIFT) | num;
+
+	return 0;
+}
+
+/**
+ * placement_option - Check if service option is a placement option
+ * @opt: Service option, e.g. cpus:0-3
+ *
+ * Returns:
+ * %TRUE(1) if @opt is handled by placement_parse(), otherwise %FALSE(0).
+ */
+int placement_option(char *opt)
+{
+	char *keys[] = { "cpus:", "numa:", "sched:", "nice:", "ioprio:", "oom:" };
+
+	for (size_t i = 0; i < NELEMS(keys); i++) {
+		if (!strncasecmp(opt, keys[i], strlen(keys[i])))
+			return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * placement_parse - Parse CPU, NUMA, and scheduling options of a service
+ * @svc:  Service to set up
+ * @opts: Options, cpus:LIST, numa:NODES, sched:POLICY[:PRIO], nice:NUM,
+ *        ioprio:CLASS[:LEVEL], and oom:ADJ
+ * @num:  Number of options in @opts
+ *
+ * All settings are reset before parsing, so options removed from the
+ * .conf file are dropped on reload.  Invalid options are logged and
+ * skipped.  The cpus:LIST and numa:NODES also set cpuset.cpus and
+ * cpuset.mems of the leaf cgroup of the service.
+ */
+void placement_parse(svc_t *svc, char *opts[], int num)
+{
+	struct svc_sched *s = &svc->sched;
+
+	memset(s, 0, sizeof(*s));
+	svc->cgroup.cpus[0] = 0;
+	svc->cgroup.mems[0] = 0;
+
+	for (int i = 0; i < num; i++) {
+		char *key = strdupa(opts[i]);
+		char *val;
+
+		val = strchr(key, ':');
+		if (!val)
+			continue;
+		*val++ = 0;
+
+		if (!strcasecmp(key, "cpus")) {
+			if (!parse_cpus(svc, val))
+				s->flags |= PLACE_CPUS;
+		} else if (!strcasecmp(key, "numa")) {
+			if (!parse_numa(svc, val))
+				s->flags |= PLACE_MEMS;
+		} else if (!strcasecmp(key, "sched")) {
+			if (!parse_sched(svc, val))
+				s->flags |= PLACE_SCHED;
+		} else if (!strcasecmp(key, "nice")) {
+			if (!parse_num(svc, key, val, -20, 19, &s->nice))
+				s->flags |= PLACE_NICE;
+		} else if (!strcasecmp(key, "ioprio")) {
+			if (!parse_ioprio(svc, val))
+				s->flags |= PLACE_IOPRIO;
+		} else if (!strcasecmp(key, "oom")) {
+			if (!parse_num(svc, key, val, -1000, 1000, &s->oom))
+				s->flags |= PLACE_OOM;
+		}
+	}
+
+	if ((s->flags & PLACE_MEMS) && !(s->flags & PLACE_CPUS))
+		numa_cpus(svc);
+}
+
+/**
+ * placement_pool - CPUs, or NUMA nodes, to spread service instances over
+ * @opts: Placement options of the instance template
+ * @num:  Number of options in @opts
+ * @numa: Spread over NUMA nodes instead of CPUs
+ * @pool: Set of CPUs, or NUMA nodes
+ *
+ * The CPUs are taken from cpus:LIST, or numa:NODES, of the template,
+ * falling back to the CPUs Finit may run on, which leaves out any
+ * isolcpus=.  NUMA nodes are all online nodes, or node 0 on systems
+ * without NUMA.
+ *
+ * Returns:
+ * Number of CPUs, or nodes, in @pool.
+ */
+int placement_pool(char *opts[], int num, int numa, cpu_set_t *pool)
+{
+	unsigned long mems = 0;
+	char list[64];
+	FILE *fp;
+
+	if (numa) {
+		CPU_ZERO(pool);
+		fp = fopen("/sys/devices/system/node/online", "r");
+		if (fp) {
+			if (!fgets(list, sizeof(list), fp) || parse_list(chomp(list), sizeof(mems) * 8, pool))
+				CPU_ZERO(pool);
+			fclose(fp);
+		}
+		if (!CPU_COUNT(pool))
+			CPU_SET(0, pool);
+
+		return CPU_COUNT(pool);
+	}
+
+	for (int i = 0; i < num; i++) {
+		cpu_set_t set;
+
+		if (!strncasecmp(opts[i], "cpus:", 5) && !parse_list(&opts[i][5], CPU_SETSIZE, pool))
+			return CPU_COUNT(pool);
+
+		if (!strncasecmp(opts[i], "numa:", 5) && !parse_list(&opts[i][5], sizeof(mems) * 8, &set)) {
+			for (int n = 0; n < (int)sizeof(mems) * 8; n++) {
+				if (CPU_ISSET(n, &set))
+					mems |= 1UL << n;
+			}
+		}
+	}
+
+	if (mems && node_cpus(mems, pool, NULL, 0) > 0)
+		return CPU_COUNT(pool);
+
+	if (sched_getaffinity(0, sizeof(*pool), pool)) {
+		CPU_ZERO(pool);
+		CPU_SET(0, pool);
+	}
+
+	return CPU_COUNT(pool);
+}
+
+/**
+ * placement_instance - Place a service instance on a CPU, or NUMA node
+ * @svc:  Service instance
+ * @pool: Set of CPUs, or NUMA nodes, from placement_pool()
+ * @nth:  Instance number, from zero, wraps around the size of @pool
+ * @numa: Place on NUMA node, binding memory and using the CPUs of it
+ *
+ * Overrides cpus:LIST, and for @numa also numa:NODES, of the template.
+ */
+void placement_instance(svc_t *svc, cpu_set_t *pool, int nth, int numa)
+{
+	struct svc_sched *s = &svc->sched;
+	int slot = 0, n;
+
+	n = nth % CPU_COUNT(pool);
+	for (int i = 0; i < CPU_SETSIZE; i++) {
+		if (CPU_ISSET(i, pool) && n-- == 0) {
+			slot = i;
+			break;
+		}
+	}
+
+	if (numa) {
+		s->mems   = 1UL << slot;
+		s->flags |= PLACE_MEMS;
+		snprintf(svc->cgroup.mems, sizeof(svc->cgroup.mems), "%d", slot);
+		s->flags &= ~PLACE_CPUS;
+		numa_cpus(svc);
+	} else {
+		CPU_ZERO(&s->cpus);
+		CPU_SET(slot, &s->cpus);
+		s->flags |= PLACE_CPUS;
+		snprintf(svc->cgroup.cpus, sizeof(svc->cgroup.cpus), "%d", slot);
+	}
+}
+
+/**
+ * placement_apply - Apply CPU, NUMA, and scheduling settings
+ * @svc: Service being started
+ *
+ * Called in the child, from service_fork(), before dropping privileges
+ * since raising priorities, and lowering the OOM score, requires root.
+ * Failures are logged, the service is started anyway.
+ */
+void placement_apply(svc_t *svc)
+{
+	struct svc_sched *s = &svc->sched;
+
+	if (s->flags & PLACE_MEMS) {
+#ifdef SYS_set_mempolicy
+		unsigned long mask = s->mems;
+
+		if (syscall(SYS_set_mempolicy, MPOL_BIND, &mask, sizeof(mask) * 8 + 1))
+#endif
+			logit(LOG_WARNING, "%s: failed setting numa:%s: %s", svc->cmd,
+			      svc->cgroup.mems, strerror(errno));
+	}
+
+	if (s->flags & PLACE_CPUS) {
+		if (sched_setaffinity(0, sizeof(s->cpus), &s->cpus))
+			logit(LOG_WARNING, "%s: failed setting cpus:%s: %s", svc->cmd,
+			      svc->cgroup.cpus, strerror(errno));
+	}
+
+	if (s->flags & PLACE_SCHED) {
+		struct sched_param param = { .sched_priority = s->prio };
+
+		if (sched_setscheduler(0, s->policy, &param))
+			logit(LOG_WARNING, "%s: failed setting scheduling policy %d, prio %d: %s",
+			      svc->cmd, s->policy, s->prio, strerror(errno));
+	}
+
+	if (s->flags & PLACE_NICE) {
+		if (setpriority(PRIO_PROCESS, 0, s->nice))
+			logit(LOG_WARNING, "%s: failed setting nice:%d: %s", svc->cmd,
+			      s->nice, strerror(errno));
+	}
+
+	if (s->flags & PLACE_IOPRIO) {
+#ifdef SYS_ioprio_set
+		if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, s->ioprio))
+#endif
+			logit(LOG_WARNING, "%s: failed setting ioprio: %s", svc->cmd,
+			      strerror(errno));
+	}
+
+	if (s->flags & PLACE_OOM) {
+		char buf[16];
+		int fd, len;
+
+		len = snprintf(buf, sizeof(buf), "%d", s->oom);
+		fd = open("/proc/self/oom_score_adj", O_WRONLY | O_CLOEXEC);
+		if (fd == -1 || write(fd, buf, len) != len)
+			logit(LOG_WARNING, "%s: failed setting oom:%d: %s", svc->cmd,
+			      s->oom, strerror(errno));
+		if (fd != -1)
+			close(fd);
+	}
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
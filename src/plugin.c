@@ -33,9 +33,11 @@
 #include "cond.h"
 #include "finit.h"
 #include "helpers.h"
+#include "latency.h"
 #include "plugin.h"
 #include "private.h"
 #include "service.h"
+#include "timeline.h"
 
 #define is_io_plugin(p) ((p)->io.cb && (p)->io.fd > 0)
 #define SEARCH_PLUGIN(str)						\
@@ -47,10 +49,51 @@
 static char *plugpath = NULL; /* Set by first load. */
 static TAILQ_HEAD(plugin_head, plugin) plugins  = TAILQ_HEAD_INITIALIZER(plugins);
 
+/* Latency counters of plugin hooks and I/O, looked up on first call */
+struct plugin_lat {
+	LIST_ENTRY(plugin_lat) link;
+
+	plugin_t       *plugin;
+	struct latency *hook[HOOK_MAX_NUM];
+	struct latency *io;
+};
+static LIST_HEAD(, plugin_lat) plugin_lats = LIST_HEAD_INITIALIZER(plugin_lats);
+
 #ifndef ENABLE_STATIC
 static void check_plugin_depends(plugin_t *plugin);
 #endif
 
+static struct plugin_lat *plugin_lat(plugin_t *plugin)
+{
+	struct plugin_lat *pl;
+
+	LIST_FOREACH(pl, &plugin_lats, link) {
+		if (pl->plugin == plugin)
+			return pl;
+	}
+
+	pl = calloc(1, sizeof(*pl));
+	if (!pl)
+		return NULL;
+
+	pl->plugin = plugin;
+	LIST_INSERT_HEAD(&plugin_lats, pl, link);
+
+	return pl;
+}
+
+static void plugin_lat_del(plugin_t *plugin)
+{
+	struct plugin_lat *pl;
+
+	LIST_FOREACH(pl, &plugin_lats, link) {
+		if (pl->plugin == plugin) {
+			LIST_REMOVE(pl, link);
+			free(pl);
+			return;
+		}
+	}
+}
 
 static char *trim_ext(char *name)
 {
@@ -110,6 +153,7 @@ int plugin_unregister(plugin_t *plugin)
 {
 	if (is_io_plugin(plugin))
 		uev_io_stop(&plugin->watcher);
+	plugin_lat_del(plugin);
 
 #ifndef ENABLE_STATIC
 	TAILQ_REMOVE(&plugins, plugin, link);
@@ -177,6 +221,19 @@ const char *plugin_hook_str(hook_point_t no)
 	return hook_cond[no];
 }
 
+/* Runtime hooks have no condition, only used for latency counters */
+static const char *hook_name(hook_point_t no)
+{
+	switch (no) {
+	case HOOK_SVC_RECONF:
+		return "hook/svc/reconf";
+	case HOOK_RUNLEVEL_CHANGE:
+		return "hook/runlevel/change";
+	default:
+		return hook_cond[no];
+	}
+}
+
 int plugin_exists(hook_point_t no)
 {
 	plugin_t *p, *tmp;
@@ -192,14 +249,26 @@ int plugin_exists(hook_point_t no)
 /* Some hooks are called with a fixed argument */
 void plugin_run_hook(hook_point_t no, void *arg)
 {
+	struct timespec begin;
 	plugin_t *p, *tmp;
 
+	clock_gettime(CLOCK_MONOTONIC, &begin);
 	PLUGIN_ITERATOR(p, tmp) {
 		if (p->hook[no].cb) {
+			struct plugin_lat *pl;
+			struct timespec start;
+
 			_d("Calling %s hook n:o %d (arg: %p) ...", basename(p->name), no, arg ?: "NIL");
+			latency_start(&start);
 			p->hook[no].cb(arg ? arg : p->hook[no].arg);
+
+			pl = plugin_lat(p);
+			if (pl && !pl->hook[no])
+				pl->hook[no] = latency_get("%s:%s", basename(p->name), hook_name(no));
+			latency_stop(pl ? pl->hook[no] : NULL, &start);
 		}
 	}
+	timeline_span(hook_name(no), &begin);
 
 	/* Conditions are stored in /run, so don't try to signal
 	 * conditions for any hooks before filesystems have been
@@ -224,14 +293,22 @@ void plugin_run_hooks(hook_point_t no)
 static void generic_io_cb(uev_t *w, void *arg, int events)
 {
 	plugin_t *p = (plugin_t *)arg;
+	struct plugin_lat *pl;
+	struct timespec start;
 
 	if (is_io_plugin(p) && p->io.fd == w->fd) {
 		/* Stop watcher, callback may close descriptor on us ... */
 		uev_io_stop(w);
 
 		_d("Calling I/O %s from runloop...", basename(p->name));
+		latency_start(&start);
 		p->io.cb(p->io.arg, w->fd, events);
 
+		pl = plugin_lat(p);
+		if (pl && !pl->io)
+			pl->io = latency_get("%s:io", basename(p->name));
+		latency_stop(pl ? pl->io : NULL, &start);
+
 		/* Update fd, may be changed by plugin callback, e.g., if FIFO */
 		uev_io_set(w, p->io.fd, p->io.flags);
 	}
@@ -0,0 +1,336 @@
+/* Pressure stall information (PSI) based admission control of services
+ *
+ * Copyright (c) 2021  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <lite/lite.h>
+#include <uev/uev.h>
+
+#include "finit.h"
+#include "cond.h"
+#include "helpers.h"
+#include "latency.h"
+#include "log.h"
+#include "pressure.h"
+#include "service.h"
+
+struct psi {
+	char  *name;		/* memory, io, cpu */
+	int    threshold;	/* percent of window stalled, 0: disabled */
+	int    conf;		/* threshold from .conf, see pressure_config() */
+	int    fd;		/* trigger, /proc/pressure/NAME */
+	int    high;		/* above threshold, starts deferred */
+	uev_t  watcher;
+};
+
+static struct psi psi[] = {
+	{ "memory", 0, 0, -1, 0, { 0 } },
+	{ "io",     0, 0, -1, 0, { 0 } },
+	{ "cpu",    0, 0, -1, 0, { 0 } },
+};
+
+static uev_t relief;		/* periodic check for relief while high */
+static int   deferred;		/* any service starts deferred */
+
+static char *psi_cond(struct psi *p, char *buf, size_t len)
+{
+	snprintf(buf, len, "sys/pressure/%s", p->name);
+	return buf;
+}
+
+/*
+ * Read the 10 sec average, in percent, of time some tasks have been
+ * stalled.  The trigger descriptor can be read like the file itself:
+ *
+ *   some avg10=1.23 avg60=0.80 avg300=0.20 total=123456
+ */
+static int psi_avg10(struct psi *p)
+{
+	char buf[256], *ptr;
+	ssize_t len;
+
+	len = pread(p->fd, buf, sizeof(buf) - 1, 0);
+	if (len <= 0)
+		return 0;
+	buf[len] = 0;
+
+	ptr = strstr(buf, "some avg10=");
+	if (!ptr)
+		return 0;
+
+	return atoi(&ptr[11]);
+}
+
+static void relief_cb(uev_t *w, void *arg, int events)
+{
+	static struct latency lat = { .stat.name = "relief_cb" };
+	char cond[MAX_COND_LEN];
+	size_t i;
+	int high = 0;
+	struct timespec start;
+
+	latency_start(&start);
+	for (i = 0; i < NELEMS(psi); i++) {
+		struct psi *p = &psi[i];
+
+		if (!p->high)
+			continue;
+
+		if (psi_avg10(p) >= p->threshold) {
+			high++;
+			continue;
+		}
+
+		logit(LOG_NOTICE, "%s pressure below %d%%, relieved.", p->name, p->threshold);
+		cond_clear(psi_cond(p, cond, sizeof(cond)));
+		p->high = 0;
+	}
+
+	if (high)
+		goto done;
+
+	uev_timer_stop(&relief);
+	if (deferred)
+		logit(LOG_NOTICE, "Resuming deferred service starts.");
+	deferred = 0;
+	service_step_all(SVC_TYPE_SERVICE);
+done:
+	latency_stop(&lat, &start);
+}
+
+static void psi_stop(struct psi *p)
+{
+	char cond[MAX_COND_LEN];
+
+	if (p->fd == -1)
+		return;
+
+	uev_io_stop(&p->watcher);
+	close(p->fd);
+	p->fd = -1;
+
+	if (p->high)
+		cond_clear(psi_cond(p, cond, sizeof(cond)));
+	p->high = 0;
+}
+
+/*
+ * The kernel signals POLLPRI when the stall time in the window exceeds
+ * the trigger threshold.  There is no event when pressure drops again,
+ * so we poll the averages until it has.
+ */
+static void trigger_cb(uev_t *w, void *arg, int events)
+{
+	static struct latency lat = { .stat.name = "trigger_cb" };
+	struct psi *p = arg;
+	char cond[MAX_COND_LEN];
+	struct timespec start;
+
+	latency_start(&start);
+	if (UEV_ERROR == events) {
+		_e("Error on %s pressure trigger, disabling.", p->name);
+		psi_stop(p);
+		p->threshold = 0;	/* re-armed on next .conf reload */
+		goto done;
+	}
+
+	if (p->high)
+		goto done;
+
+	logit(LOG_WARNING, "%s pressure above %d%%, deferring start of non-critical services.",
+	      p->name, p->threshold);
+	p->high = 1;
+	cond_set(psi_cond(p, cond, sizeof(cond)));
+
+	if (!uev_timer_active(&relief))
+		uev_timer_init(ctx, &relief, relief_cb, NULL, PRESSURE_RELIEF, PRESSURE_RELIEF);
+done:
+	latency_stop(&lat, &start);
+}
+
+static void psi_start(struct psi *p)
+{
+	char fn[64], trigger[64];
+	int len;
+
+	snprintf(fn, sizeof(fn), "/proc/pressure/%s", p->name);
+	p->fd = open(fn, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (p->fd == -1) {
+		logit(LOG_WARNING, "Cannot monitor %s pressure, %s: %s", p->name, fn, strerror(errno));
+		return;
+	}
+
+	/* stall time, some tasks, in usec per window */
+	len = snprintf(trigger, sizeof(trigger), "some %d %d",
+		       p->threshold * (PRESSURE_WINDOW / 100), PRESSURE_WINDOW);
+	if (write(p->fd, trigger, len + 1) < 0) {
+		logit(LOG_WARNING, "Failed setting %s pressure trigger '%s': %s", p->name,
+		      trigger, strerror(errno));
+		goto fail;
+	}
+
+	if (uev_io_init(ctx, &p->watcher, trigger_cb, p, p->fd, UEV_PRI)) {
+		_pe("Failed setting up %s pressure watcher", p->name);
+		goto fail;
+	}
+
+	return;
+fail:
+	close(p->fd);
+	p->fd = -1;
+}
+
+/**
+ * pressure_reset - Disable all thresholds, before .conf reload
+ *
+ * Nothing changes until pressure_config(), so unchanged thresholds are
+ * not re-armed.
+ */
+void pressure_reset(void)
+{
+	size_t i;
+
+	for (i = 0; i < NELEMS(psi); i++)
+		psi[i].conf = 0;
+}
+
+/**
+ * pressure_parse - Parse pressure RES:PCT[,RES:PCT] from finit.conf
+ * @arg: Thresholds
+ *
+ * The resource is one of memory, io, or cpu, and the threshold is the
+ * percent, 1-99, of a one second window where some tasks are stalled.
+ * Resources not mentioned keep the threshold from any previous line,
+ * i.e., all pressure lines are merged.
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero on error.
+ */
+int pressure_parse(char *arg)
+{
+	char *tok, *s;
+	size_t i;
+	int rc = 0;
+
+	s = strdupa(arg);
+
+	for (tok = strtok(s, ", \t"); tok; tok = strtok(NULL, ", \t")) {
+		const char *errstr;
+		char *val;
+		int pct;
+
+		val = strchr(tok, ':');
+		if (!val) {
+			_e("Invalid pressure %s, missing threshold", tok);
+			rc = 1;
+			continue;
+		}
+		*val++ = 0;
+
+		for (i = 0; i < NELEMS(psi); i++) {
+			if (!strcmp(tok, psi[i].name))
+				break;
+		}
+		if (i == NELEMS(psi)) {
+			_e("Unknown pressure resource %s", tok);
+			rc = 1;
+			continue;
+		}
+
+		pct = strtonum(val, 1, 99, &errstr);
+		if (errstr) {
+			_e("Invalid %s pressure threshold %s: %s", tok, val, errstr);
+			rc = 1;
+			continue;
+		}
+		psi[i].conf = pct;
+	}
+
+	return rc;
+}
+
+/**
+ * pressure_config - Apply thresholds from .conf files, after reload
+ *
+ * Only resources with changed thresholds are re-armed, those removed
+ * from all .conf files are disabled.
+ */
+void pressure_config(void)
+{
+	size_t i;
+
+	for (i = 0; i < NELEMS(psi); i++) {
+		struct psi *p = &psi[i];
+
+		if (p->threshold == p->conf)
+			continue;
+
+		psi_stop(p);
+		p->threshold = p->conf;
+		if (p->threshold)
+			psi_start(p);
+	}
+}
+
+/**
+ * pressure_defer - Should the start of a service be deferred?
+ * @svc: Service about to be started, or restarted
+ *
+ * Starts of non-critical services are deferred while any of the system
+ * pressure thresholds are exceeded, they are started when the pressure
+ * has dropped.  Never during bootstrap.
+ *
+ * Returns:
+ * %TRUE(1) if the start should be deferred, otherwise %FALSE(0).
+ */
+int pressure_defer(svc_t *svc)
+{
+	size_t i;
+
+	if (bootstrap || !svc_is_daemon(svc) || svc->critical)
+		return 0;
+
+	for (i = 0; i < NELEMS(psi); i++) {
+		if (!psi[i].high)
+			continue;
+
+		_d("%s: deferring start, %s pressure above %d%%", svc->cmd,
+		   psi[i].name, psi[i].threshold);
+		deferred = 1;
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -30,6 +30,7 @@
 
 int       api_init         (uev_ctx_t *ctx);
 int       api_exit         (void);
+void      api_reply        (int sd, void *buf, size_t num, size_t sz);
 
 void      service_monitor  (pid_t lost, int status);
 
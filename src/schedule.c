@@ -23,6 +23,7 @@
 
 #include "config.h"
 #include "finit.h"
+#include "latency.h"
 #include "schedule.h"
 
 #define SC_INIT 0x494E4954	/* "INIT", see ascii(7) */
@@ -30,16 +31,21 @@
 /*
  * libuEv callback wrapper
  */
-static void cb(uev_t *w, void *arg, int events)
+static void work_cb(uev_t *w, void *arg, int events)
 {
+	static struct latency lat = { .stat.name = "work_cb" };
 	struct wq *work = (struct wq *)arg;
+	struct timespec start;
 
+	latency_start(&start);
 	if (UEV_ERROR == events) {
 		uev_timer_start(w);
-		return;
+		goto done;
 	}
 
 	work->cb(work);
+done:
+	latency_stop(&lat, &start);
 }
 
 /*
@@ -55,7 +61,7 @@ int schedule_work(struct wq *work)
 	msec = work->delay;
 	if (work->init != SC_INIT) {
 		work->init = SC_INIT;
-		return uev_timer_init(ctx, &work->watcher, cb, work, msec, 0);
+		return uev_timer_init(ctx, &work->watcher, work_cb, work, msec, 0);
 	}
 
 	return uev_timer_set(&work->watcher, msec, 0);
@@ -27,7 +27,6 @@
 #include <ctype.h>		/* isblank() */
 #include <string.h>
 #include <sys/reboot.h>
-#include <sys/prctl.h>
 #include <sys/resource.h>
 #include <sys/wait.h>
 #include <net/if.h>
@@ -37,23 +36,41 @@
 #include "cgroup.h"
 #include "conf.h"
 #include "cond.h"
+#include "deadline.h"
 #include "finit.h"
+#include "health.h"
 #include "helpers.h"
+#include "latency.h"
+#include "logmux.h"
 #include "pid.h"
+#include "placement.h"
+#include "pressure.h"
 #include "private.h"
 #include "sig.h"
 #include "service.h"
 #include "sm.h"
+#include "sock.h"
+#include "timeline.h"
+#include "trace.h"
 #include "tty.h"
 #include "util.h"
 #include "utmp-api.h"
 #include "schedule.h"
 
+/* Instance being registered from an instances:K template */
+static struct {
+	int        num;		/* 1..K, 0: not expanding a template */
+	int        numa;	/* spread over NUMA nodes, not CPUs */
+	char       id[MAX_ID_LEN];
+	cpu_set_t *pool;
+} instance;
+
 static struct wq work = {
 	.cb = service_worker,
 };
 
 static void svc_set_state(svc_t *svc, svc_state_t new);
+static void service_collect(svc_t *svc, pid_t lost, int status, int zombie);
 
 /**
  * service_timeout_cb - libuev callback wrapper for service timeouts
@@ -65,11 +82,17 @@ static void svc_set_state(svc_t *svc, svc_state_t new);
  */
 static void service_timeout_cb(uev_t *w, void *arg, int events)
 {
+	static struct latency lat = { .stat.name = "service_timeout_cb" };
 	svc_t *svc = arg;
+	struct timespec start;
+
+	latency_start(&start);
 
 	/* Ignore any UEV_ERROR, we're a one-shot cb so just run it. */
 	if (svc->timer_cb)
 		svc->timer_cb(svc);
+
+	latency_stop(&lat, &start);
 }
 
 /**
@@ -115,6 +138,204 @@ static int service_timeout_cancel(svc_t *svc)
 	return err;
 }
 
+/*
+ * The pidfd of a supervised process is readable when it terminates.  It
+ * is collected here, the exit names the exact svc, the SIGCHLD handler
+ * leaves it to us, see sig_reap().  The zombie is reaped after it has
+ * been collected, so its process group can be killed safely.
+ */
+static void service_pidfd_cb(uev_t *w, void *arg, int events)
+{
+	static struct latency lat = { .stat.name = "service_pidfd_cb" };
+	svc_t *svc = arg;
+	int status = 0;
+	pid_t pid;
+	struct timespec start;
+
+	latency_start(&start);
+	if (svc->pidfd < 0 || svc->pidfd != w->fd)
+		goto done;
+
+	pid = pid_peek(svc->pidfd, &status);
+	if (!pid)
+		goto done;	/* Spurious */
+
+	if (pid == -1) {
+		/* Not our child, e.g., forking daemon when not PID 1 */
+		_d("%s[%d] terminated, unknown exit status.", svc_ident(svc, NULL, 0), svc->pid);
+		service_collect(svc, svc->pid, status, 0);
+		goto done;
+	}
+
+	service_collect(svc, pid, status, 1);
+	while (waitpid(pid, NULL, WNOHANG) == -1 && errno == EINTR)
+		;
+
+	/* Orphans that sig_reap() could not get to while we were a zombie */
+	sig_reap();
+done:
+	latency_stop(&lat, &start);
+}
+
+/**
+ * service_untrack - Stop supervising process of a service by pidfd
+ * @svc: Service to stop tracking
+ */
+void service_untrack(svc_t *svc)
+{
+	if (svc->pidfd < 0)
+		return;
+
+	uev_io_stop(&svc->pidfd_watcher);
+	close(svc->pidfd);
+	svc->pidfd = -1;
+}
+
+/**
+ * service_track - Supervise the process of a service by pidfd
+ * @svc: Service with a new svc->pid, e.g., from a PID file
+ *
+ * On kernels without pidfd support Finit falls back to the SIGCHLD
+ * handler and PID lookup, and plain kill() of svc->pid.
+ */
+void service_track(svc_t *svc)
+{
+	service_untrack(svc);
+	if (svc->pid <= 1)
+		return;
+
+	svc->pidfd = pid_open(svc->pid);
+	if (svc->pidfd < 0) {
+		if (errno != ENOSYS)
+			_pe("Failed opening pidfd for %s[%d]", svc_ident(svc, NULL, 0), svc->pid);
+		return;
+	}
+
+	if (uev_io_init(ctx, &svc->pidfd_watcher, service_pidfd_cb, svc, svc->pidfd, UEV_READ)) {
+		close(svc->pidfd);
+		svc->pidfd = -1;
+	}
+}
+
+/*
+ * Send @signo to the process of @svc, or its whole process group.  With
+ * a pidfd a terminated, but not yet collected, process is detected and
+ * no recycled PID, or process group, is ever signaled.
+ */
+static int service_signal(svc_t *svc, int signo, int group)
+{
+	if (svc->pidfd >= 0) {
+		if (!group)
+			return pid_signal(svc->pidfd, signo);
+
+		/* The group cannot be recycled while its leader is alive */
+		if (pid_signal(svc->pidfd, 0))
+			return -1;
+	}
+
+	return kill(group ? -svc->pid : svc->pid, signo);
+}
+
+/**
+ * service_kill_hung - Kill a hung, or otherwise unhealthy, service
+ * @svc: Service to kill, forcefully
+ *
+ * The collected PID is handled like any crash, with restart accounting
+ * in service_retry() and any oncrash:reboot action.
+ */
+void service_kill_hung(svc_t *svc)
+{
+	pid_t pid = svc->pid;
+
+	/* Forking services that are starting are otherwise not collected */
+	svc_started(svc);
+	service_signal(svc, SIGKILL, 1);
+	service_signal(svc, SIGKILL, 0);
+
+	/* Parent of a forking service already collected, no SIGCHLD coming */
+	if (!pid_alive(pid))
+		service_collect(svc, pid, SIGKILL, 0);
+}
+
+/*
+ * Called when a service with start-timeout:SEC has not yet created, or
+ * touched, its PID file by the deadline.
+ */
+static void service_start_timeout_cb(uev_t *w, void *arg, int events)
+{
+	static struct latency lat = { .stat.name = "service_start_timeout_cb" };
+	svc_t *svc = arg;
+	pid_t pid = svc->pid;
+	struct timespec start;
+
+	latency_start(&start);
+	if (svc->state != SVC_RUNNING_STATE || pid <= 1)
+		goto done;
+
+	if (!svc_is_starting(svc)) {
+		char *restart_cnt = (char *)&svc->restart_cnt;
+
+		/* Made it in time, any earlier restarts are forgiven */
+		*restart_cnt = 0;
+		goto done;
+	}
+
+	logit(LOG_CONSOLE | LOG_WARNING, "Service %s[%d] not ready after %d sec, killing it.",
+	      svc_ident(svc, NULL, 0), pid, svc->start_timeout / 1000);
+	service_kill_hung(svc);
+done:
+	latency_stop(&lat, &start);
+}
+
+/*
+ * Called when a service with watchdog:SEC has not sent a keepalive in
+ * time.  Handled the same way as a missed start-timeout, i.e., as a
+ * crash, so restart accounting and oncrash:reboot apply.
+ */
+static void service_watchdog_cb(void *arg)
+{
+	svc_t *svc = arg;
+	pid_t pid = svc->pid;
+
+	if (svc->state != SVC_RUNNING_STATE || pid <= 1)
+		return;
+
+	logit(LOG_CONSOLE | LOG_WARNING, "Service %s[%d] missed watchdog keepalive (%d sec), killing it.",
+	      svc_ident(svc, NULL, 0), pid, svc->watchdog / 1000);
+	service_kill_hung(svc);
+}
+
+/* (Re)start the watchdog deadline, one full period from now */
+static void service_watchdog_arm(svc_t *svc)
+{
+	if (!svc->watchdog)
+		return;
+
+	deadline_arm(&svc->watchdog_timer, svc->watchdog, service_watchdog_cb, svc);
+}
+
+/**
+ * service_keepalive - Restart the watchdog deadline of a service
+ * @svc: Service that checked in
+ *
+ * Called on every keepalive from, or on behalf of, a service that has
+ * watchdog:SEC set.  Keepalives from services that are not running, or
+ * that are stopped (SIGSTOP) waiting for their condition, are ignored.
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero if @svc has no watchdog.
+ */
+int service_keepalive(svc_t *svc)
+{
+	if (!svc || !svc->watchdog)
+		return 1;
+
+	if (svc->state == SVC_RUNNING_STATE && svc->pid > 1)
+		service_watchdog_arm(svc);
+
+	return 0;
+}
+
 /*
  * Redirect stdin to /dev/null => all reads by process = EOF
  * https://www.freedesktop.org/software/systemd/man/systemd.exec.html#Logging%20and%20Standard%20Input/Output
@@ -150,98 +371,35 @@ static int fredirect(const char *file)
 }
 
 /*
- * Fallback in case we don't even have logger on the system.
- * XXX: we should parse 'prio' here to get facility.level
+ * Redirect output to the log multiplexer in Finit, see logmux.c
  */
-static void fallback_logger(char *ident, char *prio)
+static int lredirect(int fd)
 {
-	int facility = LOG_DAEMON;
-	int level = LOG_NOTICE;
-	char buf[256];
+	if (fd == -1)
+		return -1;
 
-	prctl(PR_SET_NAME, "finitlog", 0, 0, 0);
-	openlog(ident, LOG_NOWAIT | LOG_PID, facility);
-	while ((fgets(buf, sizeof(buf), stdin)))
-		syslog(level, "%s", buf);
+	dup2(fd, STDOUT_FILENO);
+	dup2(fd, STDERR_FILENO);
 
-	closelog();
+	return close(fd);
 }
 
 /*
- * Redirect output to syslog using the command line logit tool
+ * Set up collection of the output from @svc, before fork(), if it is
+ * to be logged to syslog or file.
  */
-static int lredirect(svc_t *svc)
+static int service_logfd(svc_t *svc)
 {
-	pid_t pid;
-	int fd;
-
-	/*
-	 * Open PTY to connect to logger.  A pty isn't buffered
-	 * like a pipe, and it eats newlines so they aren't logged
-	 */
-	fd = posix_openpt(O_RDWR);
-	if (fd == -1) {
-		svc->log.enabled = 0;
+	if (svc_is_tty(svc) || !svc->log.enabled || svc->log.null || svc->log.console)
 		return -1;
-	}
-	if (grantpt(fd) == -1 || unlockpt(fd) == -1) {
-		close(fd);
-		svc->log.enabled = 0;
-		return -1;
-	}
-
-	pid = fork();
-	if (pid == 0) {
-		int fds;
-		char *tag  = basename(svc->cmd);
-		char *prio = "daemon.info";
-
-		sched_yield();
-
-		fds = open(ptsname(fd), O_RDONLY);
-		close(fd);
-		if (fds == -1)
-			_exit(0);
-		dup2(fds, STDIN_FILENO);
 
-		/* Reset signals */
-		sig_unblock();
-
-		if (!whichp(_PATH_LOGIT)) {
-			logit(LOG_INFO, _PATH_LOGIT " missing, using syslog for %s instead", svc->name);
-			fallback_logger(tag, prio);
-			_exit(0);
-		}
-
-		if (svc->log.file[0] == '/') {
-			char sz[20], num[3];
-
-			snprintf(sz, sizeof(sz), "%d", logfile_size_max);
-			snprintf(num, sizeof(num), "%d", logfile_count_max);
-
-			execlp(_PATH_LOGIT, "logit", "-f", svc->log.file, "-n", sz, "-r", num, NULL);
-			_exit(1);
-		}
-
-		if (svc->log.ident[0])
-			tag = svc->log.ident;
-		if (svc->log.prio[0])
-			prio = svc->log.prio;
-
-		execlp(_PATH_LOGIT, "logit", "-t", tag, "-p", prio, NULL);
-		_exit(1);
-	}
-
-	dup2(fd, STDOUT_FILENO);
-	dup2(fd, STDERR_FILENO);
-
-	return close(fd);
+	return logmux_open(svc);
 }
 
 /*
  * Handle redirection of process output, if enabled
  */
-static int redirect(svc_t *svc)
+static int redirect(svc_t *svc, int logfd)
 {
 	stdin_redirect();
 
@@ -251,7 +409,7 @@ static int redirect(svc_t *svc)
 		if (svc->log.console)
 			return fredirect(console());
 
-		return lredirect(svc);
+		return lredirect(logfd);
 	} else if (debug)
 		return fredirect(console());
 #ifdef REDIRECT_OUTPUT
@@ -353,7 +511,9 @@ static int is_norespawn(void)
 }
 
 /* used for process group name, derived from originating filename,
- * so to group multiple services, place them in the same .conf
+ * so to group multiple services, place them in the same .conf.  Each
+ * instance of an instances:K template gets a leaf of its own, NAME@ID,
+ * for its cpuset placement, pid:!cgroup, and cgroup.kill to work.
  */
 static char *group_name(svc_t *svc, char *buf, size_t len)
 {
@@ -373,10 +533,105 @@ static char *group_name(svc_t *svc, char *buf, size_t len)
 	if (ptr)
 		*ptr = 0;
 
+	if (svc->instance) {
+		strlcat(buf, "@", len);
+		strlcat(buf, svc->id, len);
+	}
+
 	return buf;
 }
 
-static pid_t service_fork(svc_t *svc)
+/*
+ * Claim the leaf cgroup of @svc, called when registering the service.
+ * A changed .conf file name means a new leaf, so release the old one.
+ */
+static void service_cgroup_claim(svc_t *svc)
+{
+	char grnam[sizeof(svc->cgroup.leaf)];
+
+	if (svc_is_tty(svc))
+		return;
+
+	group_name(svc, grnam, sizeof(grnam));
+	if (!strcmp(grnam, svc->cgroup.leaf))
+		return;
+
+	if (svc->cgroup.leaf[0])
+		cgroup_leaf_release(svc->cgroup.leaf, svc);
+	strlcpy(svc->cgroup.leaf, grnam, sizeof(svc->cgroup.leaf));
+	cgroup_leaf_claim(svc->cgroup.leaf, svc);
+}
+
+/*
+ * Path to the leaf cgroup of @svc, if it has one of its own.  All getty
+ * share one leaf, as do services declared in the same .conf file.
+ */
+static int service_cgroup_path(svc_t *svc, char *path, size_t len)
+{
+	if (svc_is_tty(svc) || !svc->cgroup.leaf[0] || cgroup_leaf_shared(svc->cgroup.leaf))
+		return 1;
+
+	return cgroup_leaf(svc->cgroup.leaf, &svc->cgroup, path, len);
+}
+
+/*
+ * Send @signo to all processes in the leaf cgroup of @svc, also those
+ * that have left the process group of the service, e.g., with setsid().
+ */
+static int service_cgroup_signal(svc_t *svc, int signo)
+{
+	char path[256];
+
+	if (svc->type != SVC_TYPE_SERVICE || service_cgroup_path(svc, path, sizeof(path)))
+		return 1;
+
+	return cgroup_signal(path, signo);
+}
+
+/* Any processes left in the leaf cgroup of @svc? */
+static int service_cgroup_busy(svc_t *svc)
+{
+	char path[256];
+
+	if (svc->type != SVC_TYPE_SERVICE || service_cgroup_path(svc, path, sizeof(path)))
+		return 0;
+
+	return cgroup_populated(path);
+}
+
+/*
+ * SIGKILL all processes in the leaf cgroup of @svc, also those that
+ * have left the process group of the service, e.g., with setsid().
+ */
+static int service_cgroup_kill(svc_t *svc)
+{
+	char path[256];
+
+	if (svc->type != SVC_TYPE_SERVICE || service_cgroup_path(svc, path, sizeof(path)))
+		return 1;
+
+	return cgroup_kill(path);
+}
+
+/*
+ * Check memory.events of the leaf cgroup of @svc for new OOM kills, the
+ * only way to tell them apart from other SIGKILLs.
+ */
+static void service_cgroup_oom(svc_t *svc)
+{
+	char path[256];
+	int num;
+
+	if (svc->type != SVC_TYPE_SERVICE || service_cgroup_path(svc, path, sizeof(path)))
+		return;
+
+	num = cgroup_oom_kills(path);
+	if (num > 0 && num != svc->oom_kills)
+		logit(LOG_WARNING, "%s[%d] killed by the OOM killer.", svc_ident(svc, NULL, 0), svc->pid);
+	svc->oom_kills = num;
+}
+
+pid_t service_fork(svc_t *svc, struct cgroup *cg)
 {
 	pid_t pid;
 
@@ -401,6 +656,13 @@ static pid_t service_fork(svc_t *svc)
 				      svc->cmd, rlim2str(i));
 		}
 
+		/* Enter cgroup first, moving into a cpuset resets CPU affinity */
+		if (cg && cgroup_enter(svc->cgroup.leaf, cg))
+			_pe("%s: failed entering cgroup %s", svc->cmd, svc->cgroup.leaf);
+
+		/* CPU affinity, NUMA, scheduling, needs root */
+		placement_apply(svc);
+
 		/* Set desired user+group */
 		if (gid >= 0) {
 			if (setgid(gid))
@@ -423,6 +685,14 @@ static pid_t service_fork(svc_t *svc)
 			}
 		}
 
+		/* Instance number and CPU(s) of instances:K services */
+		if (svc->instance) {
+			setenv("INSTANCE", str("%d", svc->instance), 1);
+			setenv("CPU", svc->cgroup.cpus, 1);
+			if (svc->cgroup.mems[0])
+				setenv("NUMA_NODE", svc->cgroup.mems, 1);
+		}
+
 		/* Source any environment from env:/path/to/file */
 		source_env(svc);
 	}
@@ -440,8 +710,9 @@ static pid_t service_fork(svc_t *svc)
 static int service_start(svc_t *svc)
 {
 	int result = 0, do_progress = 1;
+	struct cgroup cg, *leaf = NULL;
 	sigset_t nmask, omask;
-	char grnam[80];
+	int logfd = -1;
 	pid_t pid;
 	size_t i;
 
@@ -497,7 +768,21 @@ static int service_start(svc_t *svc)
 	sigaddset(&nmask, SIGCHLD);
 	sigprocmask(SIG_BLOCK, &nmask, &omask);
 
-	pid = service_fork(svc);
+	/* Set up the leaf cgroup, the child moves itself there */
+	if (!svc_is_tty(svc)) {
+		char path[256];
+
+		cg = svc->cgroup;
+		/* a shared leaf would override the cpus of the others */
+		service_cgroup_claim(svc);
+		if (service_cgroup_path(svc, path, sizeof(path)))
+			cg.cpus[0] = cg.mems[0] = 0;
+		if (!cgroup_service(svc->cgroup.leaf, 0, &cg))
+			leaf = &cg;
+	}
+
+	logfd = service_logfd(svc);
+	pid = service_fork(svc, leaf);
 	if (pid == 0) {
 		char *args[MAX_NUM_SVC_ARGS + 1];
 		int status;
@@ -580,7 +865,17 @@ static int service_start(svc_t *svc)
 			logit(LOG_ERR, "failed setsid(), pid %d: %s", pid, strerror(errno));
 
 		if (!svc_is_tty(svc))
-			redirect(svc);
+			redirect(svc, logfd);
+		if (svc_is_daemon(svc))
+			sock_pass(svc);
+		if (svc->watchdog) {
+			char buf[24];
+
+			snprintf(buf, sizeof(buf), "%lld", (long long)svc->watchdog * 1000);
+			setenv("WATCHDOG_USEC", buf, 1);
+			snprintf(buf, sizeof(buf), "%d", getpid());
+			setenv("WATCHDOG_PID", buf, 1);
+		}
 		sig_unblock();
 
 		if (svc_is_runtask(svc))
@@ -603,20 +898,28 @@ static int service_start(svc_t *svc)
 		}
 		_d("Starting %s %s", svc->cmd, buf);
 	}
+	logmux_close(logfd, pid);
 
 	if (svc_is_tty(svc))
 		cgroup_user("getty", pid);
-	else
-		cgroup_service(group_name(svc, grnam, sizeof(grnam)), pid, &svc->cgroup);
+
+	if (svc_is_cgtracked(svc)) {
+		char path[256];
+
+		if (service_cgroup_path(svc, path, sizeof(path)))
+			logit(LOG_WARNING, "%s: pid:!cgroup requires a cgroup of its own, not %s.",
+			      svc_ident(svc, NULL, 0), svc->cgroup.name);
+	}
 
 	logit(LOG_CONSOLE | LOG_NOTICE, "Starting %s[%d]", svc_ident(svc, NULL, 0), pid);
 
 	svc->pid = pid;
 	svc->start_time = jiffies();
+	timeline_mark(TIMELINE_SVC_FORK, svc_ident(svc, NULL, 0));
 
 	switch (svc->type) {
 	case SVC_TYPE_RUN:
-		svc->status = complete(svc->cmd, pid);
+		svc->status = logmux_complete(svc->cmd, pid);
 		if (WIFEXITED(svc->status) && !WEXITSTATUS(svc->status))
 			result = 0;
 		else
@@ -628,9 +931,16 @@ static int service_start(svc_t *svc)
 
 	case SVC_TYPE_SERVICE:
 		pid_file_create(svc);
+		if (svc->start_timeout)
+			uev_timer_init(ctx, &svc->start_timer, service_start_timeout_cb,
+				       svc, svc->start_timeout, 0);
+		service_track(svc);
+		service_watchdog_arm(svc);
+		health_start(svc);
 		break;
 
 	default:
+		service_track(svc);
 		break;
 	}
 
@@ -652,6 +962,15 @@ static void service_kill(svc_t *svc)
 	service_timeout_cancel(svc);
 
 	if (svc->pid <= 1) {
+		/* Main PID collected, but processes remain in its cgroup */
+		if (svc->state == SVC_STOPPING_STATE && service_cgroup_busy(svc)) {
+			logit(LOG_CONSOLE | LOG_NOTICE, "Stopping %s, killing remaining processes ...",
+			      svc_ident(svc, NULL, 0));
+			service_cgroup_kill(svc);
+			service_step(svc);
+			return;
+		}
+
 		/* Avoid killing ourselves or all processes ... */
 		_d("%s: Aborting SIGKILL, already terminated.", svc->cmd);
 		return;
@@ -663,7 +982,8 @@ static void service_kill(svc_t *svc)
 	if (runlevel != 1)
 		print_desc("Killing ", svc->desc);
 
-	kill(-svc->pid, SIGKILL);
+	if (service_cgroup_kill(svc))
+		service_signal(svc, SIGKILL, 1);
 
 	/* Let SIGKILLs stand out, show result as [WARN] */
 	if (runlevel != 1)
@@ -677,8 +997,11 @@ static void service_cleanup(svc_t *svc)
 {
 	char *fn;
 
-	/* PID collected, cancel any pending SIGKILL */
+	/* PID collected, cancel any pending SIGKILL and deadlines */
 	service_timeout_cancel(svc);
+	uev_timer_stop(&svc->start_timer);
+	deadline_stop(&svc->watchdog_timer);
+	health_stop(svc);
 
 	fn = pid_file(svc);
 	if (fn && remove(fn) && errno != ENOENT)
@@ -691,6 +1014,9 @@ static void service_cleanup(svc_t *svc)
 
 	svc->oldpid = svc->pid;
 	svc->start_time = svc->pid = 0;
+
+	/* Socket activated services wait for the next connection */
+	svc->activated = 0;
 }
 
 /**
@@ -712,6 +1038,8 @@ static int service_stop(svc_t *svc)
 		return 0;
 
 	service_timeout_cancel(svc);
+	deadline_stop(&svc->watchdog_timer);
+	health_stop(svc);
 
 	if (!svc_is_sysv(svc)) {
 		if (svc->pid <= 1)
@@ -742,32 +1070,39 @@ static int service_stop(svc_t *svc)
 
 	if (!svc_is_sysv(svc)) {
 		if (svc->pid > 1) {
-			/* Kill all children in the same proess group, e.g. logit */
-			rc = kill(-svc->pid, svc->sighalt);
+			/* Kill all children in the same process group */
+			rc = service_signal(svc, svc->sighalt, 1);
 			_d("kill(-%d, %d) => rc %d", svc->pid, svc->sighalt, rc);
 			/* PID lost or forking process never really started */
 			if (rc == -1 && ESRCH == errno)
 				service_cleanup(svc);
+
+			/* ... and those that have left it, cgroup.kill at killdelay */
+			service_cgroup_signal(svc, svc->sighalt);
 		} else
 				service_cleanup(svc);
 	} else {
 		char *args[] = { svc->cmd, "stop", NULL };
+		int logfd;
 		pid_t pid;
 
+		logfd = service_logfd(svc);
 		pid = fork();
 		switch (pid) {
 		case 0:
 			setsid();
-			redirect(svc);
+			redirect(svc, logfd);
 			exec_runtask(svc->cmd, args);
 			_exit(0);
 			break;
 		case -1:
 			_pe("Failed fork() to call sysv script '%s stop'", svc->cmd);
+			logmux_close(logfd, pid);
 			rc = 1;
 			break;
 		default:
-			rc = WEXITSTATUS(complete(svc->cmd, pid));
+			logmux_close(logfd, pid);
+			rc = WEXITSTATUS(logmux_complete(svc->cmd, pid));
 			break;
 		}
 	}
@@ -817,13 +1152,14 @@ static int service_restart(svc_t *svc)
 	_d("Sending SIGHUP to PID %d", svc->pid);
 	logit(LOG_CONSOLE | LOG_NOTICE, "Restarting %s[%d], sending SIGHUP ...",
 	      svc_ident(svc, NULL, 0), svc->pid);
-	rc = kill(svc->pid, SIGHUP);
+	rc = service_signal(svc, SIGHUP, 0);
 	if (rc == -1 && errno == ESRCH) {
 		/* nobody home, reset internal state machine */
 		lost = svc->pid;
 	} else {
 		/* Declare we're waiting for svc to re-assert/touch its pidfile */
-		svc_starting(svc);
+		if (!svc_is_cgtracked(svc))
+			svc_starting(svc);
 
 		/* Service does not maintain a PID file on its own */
 		if (svc_has_pidfile(svc)) {
@@ -836,7 +1172,7 @@ static int service_restart(svc_t *svc)
 		print_result(rc);
 
 	if (lost)
-		service_monitor(lost, 0);
+		service_collect(svc, lost, SVC_STATUS_UNKNOWN, 0);
 
 	return rc;
 }
@@ -873,12 +1209,38 @@ void service_runlevel(int newlevel)
 		networking(0);
 }
 
+/* Value of log rate:LINES and burst:SEC, zero (default) if invalid */
+static unsigned parse_log_num(svc_t *svc, char *opt, char *val, long long max)
+{
+	const char *errstr;
+	long long num;
+
+	if (!val) {
+		_e("%s: log %s is missing a value", svc->cmd, opt);
+		return 0;
+	}
+
+	num = strtonum(val, 1, max, &errstr);
+	if (errstr) {
+		_e("%s: log %s:%s is %s (1-%lld)", svc->cmd, opt, val, errstr, max);
+		return 0;
+	}
+
+	return (unsigned)num;
+}
+
 /*
  * log:/path/to/logfile,priority:facility.level,tag:ident
  */
 static void parse_log(svc_t *svc, char *arg)
 {
-	char *tok;
+	char *tok, *val;
+	int bytes;
+
+	svc->log.rate  = 0;
+	svc->log.bytes = 0;
+	svc->log.burst = 0;
+	svc->log.block = 0;
 
 	tok = strtok(arg, ":, ");
 	while (tok) {
@@ -894,6 +1256,23 @@ static void parse_log(svc_t *svc, char *arg)
 			strlcpy(svc->log.prio, strtok(NULL, ","), sizeof(svc->log.prio));
 		else if (!strcmp(tok, "tag") || !strcmp(tok, "identity") || !strcmp(tok, "ident"))
 			strlcpy(svc->log.ident, strtok(NULL, ","), sizeof(svc->log.ident));
+		else if (!strcmp(tok, "rate"))
+			svc->log.rate = parse_log_num(svc, tok, strtok(NULL, ","), 1000000);
+		else if (!strcmp(tok, "bytes")) {
+			val = strtok(NULL, ",");
+			bytes = strtobytes(val);
+			if (bytes <= 0) {
+				_e("%s: log bytes:%s is invalid", svc->cmd, val ?: "");
+				bytes = 0;
+			}
+			svc->log.bytes = bytes;
+		}
+		else if (!strcmp(tok, "burst"))
+			svc->log.burst = parse_log_num(svc, tok, strtok(NULL, ","), 3600);
+		else if (!strcmp(tok, "block"))
+			svc->log.block = 1;
+		else if (!strcmp(tok, "drop"))
+			svc->log.block = 0;
 
 		tok = strtok(NULL, ":=, ");
 	}
@@ -928,8 +1307,8 @@ static void parse_cgroup(svc_t *svc, char *cgroup)
 			return;
 	}
 
-	if (strlen(ptr) >= sizeof(svc->cgroup)) {
-		_e("%s: cgroup settings too long (>%d chars)", svc->cmd, sizeof(svc->cgroup));
+	if (strlen(ptr) >= sizeof(svc->cgroup.cfg)) {
+		_e("%s: cgroup settings too long (>%zu chars)", svc->cmd, sizeof(svc->cgroup.cfg) - 1);
 		return;
 	}
 
@@ -962,6 +1341,44 @@ static void parse_killdelay(svc_t *svc, char *delay)
 	svc->killdelay = (int)(sec * 1000);
 }
 
+static void parse_start_timeout(svc_t *svc, char *timeout)
+{
+	const char *errstr;
+	long long sec;
+
+	svc->start_timeout = 0;
+	if (!timeout)
+		return;
+
+	sec = strtonum(timeout, 1, 3600, &errstr);
+	if (errstr) {
+		_e("%s: start-timeout %s is %s (1-3600)", svc->cmd, timeout, errstr);
+		return;
+	}
+
+	/* convert to msec */
+	svc->start_timeout = (int)(sec * 1000);
+}
+
+static void parse_watchdog(svc_t *svc, char *timeout)
+{
+	const char *errstr;
+	long long sec;
+
+	svc->watchdog = 0;
+	if (!timeout)
+		return;
+
+	sec = strtonum(timeout, 1, 3600, &errstr);
+	if (errstr) {
+		_e("%s: watchdog %s is %s (1-3600)", svc->cmd, timeout, errstr);
+		return;
+	}
+
+	/* convert to msec */
+	svc->watchdog = (int)(sec * 1000);
+}
+
 static void parse_script(char *type, char *script, char *buf, size_t len)
 {
 	if (access(script, X_OK))
@@ -1070,6 +1487,63 @@ static void parse_cmdline_args(svc_t *svc, char *cmd)
 }
 
 
+/*
+ * Expand an instances:K[:numa] template to K services, :1 to :K, or with
+ * a template :ID, :ID.1 to :ID.K, each placed on a CPU, or NUMA node, of
+ * its own, round-robin.  K may be 'nproc', the number of CPUs, or nodes.
+ */
+static int service_instances(int type, char *cfg, struct rlimit rlimit[], char *file,
+			     char *cmd, char *arg, char *id, char *opts[], int num)
+{
+	char *buf = strdupa(arg);
+	const char *errstr;
+	cpu_set_t pool;
+	int count, k, rc = 0;
+	char *mode;
+
+	if (type != SVC_TYPE_SERVICE) {
+		_e("%s: instances: is only supported for services", cmd);
+		return errno = EINVAL;
+	}
+
+	memset(&instance, 0, sizeof(instance));
+	mode = strchr(buf, ':');
+	if (mode) {
+		*mode++ = 0;
+		if (strcmp(mode, "numa")) {
+			_e("%s: invalid instances:%s:%s, only numa is supported", cmd, buf, mode);
+			return errno = EINVAL;
+		}
+		instance.numa = 1;
+	}
+
+	count = placement_pool(opts, num, instance.numa, &pool);
+	if (!strcmp(buf, "nproc"))
+		k = count;
+	else {
+		k = (int)strtonum(buf, 1, MAX_NUM_INSTANCES, &errstr);
+		if (errstr) {
+			_e("%s: instances:%s is %s (1-%d, or nproc)", cmd, buf, errstr, MAX_NUM_INSTANCES);
+			return errno = EINVAL;
+		}
+	}
+
+	instance.pool = &pool;
+	for (int i = 1; i <= k; i++) {
+		instance.num = i;
+		if (id && id[0])
+			snprintf(instance.id, sizeof(instance.id), "%s.%d", id, i);
+		else
+			snprintf(instance.id, sizeof(instance.id), "%d", i);
+
+		if (service_register(type, cfg, rlimit, file))
+			rc = errno;
+	}
+	memset(&instance, 0, sizeof(instance));
+
+	return rc;
+}
+
 /**
  * service_register - Register service, task or run commands
  * @type:   %SVC_TYPE_SERVICE(0), %SVC_TYPE_TASK(1), %SVC_TYPE_RUN(2)
@@ -1129,14 +1603,19 @@ int service_register(int type, char *cfg, struct rlimit rlimit[], char *file)
 {
 	char *cmd, *desc, *runlevels = NULL, *cond = NULL;
 	char *username = NULL, *log = NULL, *pid = NULL;
-	char *name = NULL, *halt = NULL, *delay = NULL;
+	char *name = NULL, *halt = NULL, *delay = NULL, *start_tmo = NULL, *wdog = NULL;
+	char *health = NULL, *instances = NULL;
 	char *id = NULL, *env = NULL, *cgroup = NULL;
 	char *pre_script = NULL, *post_script = NULL;
+	char *sockets[MAX_NUM_SOCKS];
+	char *placement[MAX_NUM_PLACEMENT];
+	int num_listen = 0, num_placement = 0;
 	struct tty tty = { 0 };
 	char *dev = NULL;
 	int respawn = 0;
 	int levels = 0;
 	int manual = 0;
+	int critical = 0;
 	int restart_max = SVC_RESPAWN_MAX;
 	int restart_tmo = 0;
 	unsigned oncrash_action = SVC_ONCRASH_IGNORE;
@@ -1197,6 +1676,8 @@ int service_register(int type, char *cfg, struct rlimit rlimit[], char *file)
 			name = cmd;
 		else if (!strncasecmp(cmd, "manual:yes", 10))
 			manual = 1;
+		else if (!strncasecmp(cmd, "critical", 8))
+			critical = 1;
 		else if (!strncasecmp(cmd, "restart:", 8))
 			restart_max = atoi(&cmd[8]);
 		else if (!strncasecmp(cmd, "restarttmo:", 11))
@@ -1214,6 +1695,12 @@ int service_register(int type, char *cfg, struct rlimit rlimit[], char *file)
 			halt = &cmd[5];
 		else if (!strncasecmp(cmd, "kill:", 5))
 			delay = &cmd[5];
+		else if (!strncasecmp(cmd, "start-timeout:", 14))
+			start_tmo = &cmd[14];
+		else if (!strncasecmp(cmd, "watchdog:", 9))
+			wdog = &cmd[9];
+		else if (!strncasecmp(cmd, "health:", 7))
+			health = &cmd[7];
 		else if (!strncasecmp(cmd, "pre:", 4))
 			pre_script = &cmd[4];
 		else if (!strncasecmp(cmd, "post:", 5))
@@ -1224,6 +1711,17 @@ int service_register(int type, char *cfg, struct rlimit rlimit[], char *file)
 			cgroup = &cmd[7]; /* only settings */
 		else if (!strncasecmp(cmd, "cgroup.", 7))
 			cgroup = &cmd[6]; /* with group */
+		else if (!strncasecmp(cmd, "listen:", 7)) {
+			if (num_listen < MAX_NUM_SOCKS)
+				sockets[num_listen] = &cmd[7];
+			num_listen++;
+		}
+		else if (!strncasecmp(cmd, "instances:", 10))
+			instances = &cmd[10];
+		else if (placement_option(cmd)) {
+			if (num_placement < MAX_NUM_PLACEMENT)
+				placement[num_placement++] = cmd;
+		}
 		else
 			break;
 
@@ -1233,6 +1731,17 @@ int service_register(int type, char *cfg, struct rlimit rlimit[], char *file)
 			goto incomplete;
 	}
 
+	if (instances && num_listen) {
+		logit(LOG_ERR, "%s: listen: cannot be combined with instances:, "
+		      "all instances would bind the same address, skipping.", cmd);
+		return errno = EINVAL;
+	}
+	if (instances && !instance.num)
+		return service_instances(type, cfg, rlimit, file, cmd, instances,
+					 id, placement, num_placement);
+	if (instance.num)
+		id = instance.id;
+
 	levels = conf_parse_runlevels(runlevels);
 	if (runlevel > 0 && !ISOTHER(levels, 0)) {
 		_d("Skipping %s, bootstrap is completed.", cmd);
@@ -1374,6 +1883,9 @@ int service_register(int type, char *cfg, struct rlimit rlimit[], char *file)
 		parse_sighalt(svc, halt);
 	if (delay)
 		parse_killdelay(svc, delay);
+	parse_start_timeout(svc, start_tmo);
+	parse_watchdog(svc, wdog);
+	health_parse(svc, health);
 	if (pre_script)
 		parse_script("pre", pre_script, svc->pre_script, sizeof(svc->pre_script));
 	if (post_script)
@@ -1386,10 +1898,20 @@ int service_register(int type, char *cfg, struct rlimit rlimit[], char *file)
 		snprintf(svc->desc, sizeof(svc->desc), "Getty on %s", svc->dev);
 	if (env)
 		parse_env(svc, env);
+	if (svc_is_daemon(svc))
+		sock_parse(svc, sockets, num_listen);
+	else if (num_listen)
+		_e("%s: listen: is only supported for services", svc->cmd);
 	if (file)
 		strlcpy(svc->file, file, sizeof(svc->file));
 	if (respawn)
 		svc->respawn = 1;
+	svc->critical = critical;
+	placement_parse(svc, placement, num_placement);
+	if (instance.num)
+		placement_instance(svc, instance.pool, instance.num - 1, instance.numa);
+	svc->instance = instance.num;
+	service_cgroup_claim(svc);
 
 	/* Set configured limits */
 	memcpy(svc->rlimit, rlimit, sizeof(svc->rlimit));
@@ -1435,9 +1957,109 @@ void service_unregister(svc_t *svc)
 		return;
 
 	service_stop(svc);
+	uev_timer_stop(&svc->start_timer);
+	deadline_stop(&svc->watchdog_timer);
+	health_stop(svc);
+	service_untrack(svc);
+	sock_close(svc);
+	sock_store_clear(svc);
+	logmux_forget(svc);
 	svc_del(svc);
 }
 
+/*
+ * With pid:!cgroup the leaf cgroup of a forking service is the source
+ * of truth.  When the launcher, or the main PID, exits we look for a
+ * new main PID in the group, the service is alive as long as the group
+ * is populated.
+ *
+ * Returns:
+ * %TRUE(1) if a new main PID was found, otherwise %FALSE(0).
+ */
+static int service_cgroup_adopt(svc_t *svc, pid_t lost, int status)
+{
+	char path[256];
+	pid_t pid;
+
+	if (svc->state != SVC_RUNNING_STATE)
+		return 0;
+
+	/* Launcher failed, the service did not start */
+	if (svc_is_starting(svc) && (!WIFEXITED(status) || WEXITSTATUS(status)))
+		return 0;
+
+	if (service_cgroup_path(svc, path, sizeof(path)))
+		return 0;
+
+	pid = cgroup_main_pid(path);
+	if (pid <= 1 || pid == lost)
+		return 0;
+
+	_d("%s: main PID %d -> %d, from %s", svc_ident(svc, NULL, 0), lost, pid, path);
+	svc->pid = pid;
+	service_track(svc);
+
+	if (svc_is_starting(svc)) {
+		char cond[MAX_COND_LEN];
+
+		svc_started(svc);
+		cond_set(mkcond(svc, cond, sizeof(cond)));
+	}
+
+	return 1;
+}
+
+/**
+ * service_cgroup_empty - Called when a leaf cgroup is no longer populated
+ * @path: Path to the leaf cgroup
+ *
+ * A stopping service is done when the last process has left its cgroup.
+ * For services with pid:!cgroup, a main PID that is not our child, and
+ * that we have no pidfd for, is collected here.
+ */
+void service_cgroup_empty(const char *path)
+{
+	const char *name;
+	char leaf[256];
+	svc_t *svc;
+
+	name = strrchr(path, '/');
+	if (!name)
+		return;
+
+	svc = cgroup_leaf_owner(&name[1]);
+	if (!svc || !svc_is_daemon(svc))
+		return;
+	if (service_cgroup_path(svc, leaf, sizeof(leaf)) || strcmp(leaf, path))
+		return;
+
+	/* Stop completed, the last straggler has left the cgroup */
+	if (!svc->pid && svc->state == SVC_STOPPING_STATE) {
+		service_timeout_cancel(svc);
+		service_step(svc);
+		sm_step(&sm);
+		return;
+	}
+
+	if (!svc_is_cgtracked(svc) || svc->pid <= 1 || svc->pidfd >= 0)
+		return;
+
+	/* Zombie, SIGCHLD is on its way with the real exit status */
+	if (pid_alive(svc->pid))
+		return;
+
+	_d("%s: cgroup %s empty, collecting PID %d", svc_ident(svc, NULL, 0), path, svc->pid);
+	service_collect(svc, svc->pid, SVC_STATUS_UNKNOWN, 0);
+}
+
+/**
+ * service_monitor - Collect a terminated child process
+ * @lost:   PID of the terminated process, not yet reaped
+ * @status: Exit status, from waitid() with %WNOWAIT
+ *
+ * Called by sig_reap() for processes without a pidfd, which reaps the
+ * zombie afterwards.  This way its process group can still be killed.
+ */
 void service_monitor(pid_t lost, int status)
 {
 	svc_t *svc;
@@ -1447,17 +2069,34 @@ void service_monitor(pid_t lost, int status)
 
 	svc = svc_find_by_pid(lost);
 	if (!svc) {
+		if (health_collect(lost, status))
+			return;
 		_d("collected unknown PID %d", lost);
 		return;
 	}
 
+	service_collect(svc, lost, status, 1);
+}
+
+/*
+ * The process @lost of @svc has terminated, update books and step the
+ * state machine.  If @zombie, @lost is not yet reaped, so its process
+ * group cannot have been recycled and can be killed.  Otherwise, e.g.,
+ * not our child, the group is left to cgroup.kill of the leaf cgroup.
+ */
+static void service_collect(svc_t *svc, pid_t lost, int status, int zombie)
+{
+	trace_collect(svc, lost, status);
+	service_untrack(svc);
+
 	switch (svc->state) {
 	case SVC_CLEANUP_STATE:
 	case SVC_SETUP_STATE:
 		_d("collected script %s(%d), normal exit: %d, signaled: %d, exit code: %d",
 		   svc->state == SVC_CLEANUP_STATE ? svc->post_script : svc->pre_script,
 		   lost, WIFEXITED(status), WIFSIGNALED(status), WEXITSTATUS(status));
-		kill(-svc->pid, SIGKILL);
+		if (zombie)
+			kill(-lost, SIGKILL);
 		goto done;
 
 	default:
@@ -1467,12 +2106,24 @@ void service_monitor(pid_t lost, int status)
 		break;
 	}
 
+	/* pid:!cgroup, the service lives on as long as its cgroup does */
+	if (svc_is_cgtracked(svc) && service_cgroup_adopt(svc, lost, status))
+		return;
+
 	/* Forking sysv/services declare themselves with pid:!/path/to/pid.file  */
 	if (svc_is_starting(svc) && svc_is_forking(svc))
 		return;
 
-	/* Terminate any children in the same proess group, e.g. logit */
-	kill(-svc->pid, SIGKILL);
+	/* Killed by the kernel OOM killer? */
+	if (WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL)
+		service_cgroup_oom(svc);
+
+	/* Terminate any children in the same process group */
+	if (zombie)
+		kill(-lost, SIGKILL);
+
+	/* ... and any stragglers that have left it, e.g. with setsid() */
+	service_cgroup_kill(svc);
 
 	/* Try removing PID file (in case service does not clean up after itself) */
 	if (svc_is_daemon(svc) || svc_is_tty(svc)) {
@@ -1485,6 +2136,10 @@ void service_monitor(pid_t lost, int status)
 			svc->started = 0;
 	}
 
+	/* Stopped when the cgroup is empty, populated=0, or at killdelay */
+	if (svc->state == SVC_STOPPING_STATE && service_cgroup_busy(svc))
+		service_timeout_after(svc, svc->killdelay, service_kill);
+
 done:
 	/* No longer running, update books. */
 	svc->start_time = svc->pid = 0;
@@ -1535,12 +2190,12 @@ static void service_kill_script(svc_t *svc)
 	if (svc->pid <= 1)
 		return;
 
-	kill(-svc->pid, SIGKILL);
+	service_signal(svc, SIGKILL, 1);
 }
 
 static void service_pre_script(svc_t *svc)
 {
-	svc->pid = service_fork(svc);
+	svc->pid = service_fork(svc, NULL);
 	if (svc->pid < 0) {
 		_pe("Failed forking off %s pre-script %s", svc_ident(svc, NULL, 0), svc->pre_script);
 		return;
@@ -1559,13 +2214,15 @@ static void service_pre_script(svc_t *svc)
 		_exit(EX_OSERR);
 	}
 
+	service_track(svc);
+
 	/* Short hard-coded timeout to prevent locking up Finit */
 	service_timeout_after(svc, svc->killdelay, service_kill_script);
 }
 
 static void service_post_script(svc_t *svc)
 {
-	svc->pid = service_fork(svc);
+	svc->pid = service_fork(svc, NULL);
 	if (svc->pid < 0) {
 		_pe("Failed forking off %s post-script %s", svc_ident(svc, NULL, 0), svc->post_script);
 		return;
@@ -1600,6 +2257,8 @@ static void service_post_script(svc_t *svc)
 		_exit(EX_OSERR);
 	}
 
+	service_track(svc);
+
 	/* Short hard-coded timeout to prevent locking up Finit */
 	service_timeout_after(svc, svc->killdelay, service_kill_script);
 }
@@ -1619,6 +2278,10 @@ static void service_retry(svc_t *svc)
 
 	if (svc->state != SVC_HALTED_STATE ||
 	    svc->block != SVC_BLOCK_RESTARTING) {
+		/* Not yet ready, start-timeout: decides if it was a success */
+		if (svc->start_timeout && svc_is_starting(svc))
+			return;
+
 		*restart_cnt = 0;
 		return;
 	}
@@ -1652,10 +2315,25 @@ static void service_retry(svc_t *svc)
 	service_timeout_after(svc, timeout, service_retry);
 }
 
+/*
+ * Reverse dependency counts, see service_count_dependents().  Marked
+ * stale on every state change and at each service_step_all(), so the
+ * counts are recomputed at most once per step, not once per service.
+ */
+static int dependents_stale = 1;
+
 static void svc_set_state(svc_t *svc, svc_state_t new)
 {
 	svc_state_t *state = (svc_state_t *)&svc->state;
 
+	if (*state != new) {
+		dependents_stale = 1;
+		trace_state(svc, *state, new);
+		if (new == SVC_READY_STATE)
+			timeline_mark(TIMELINE_SVC_WAIT, svc_ident(svc, NULL, 0));
+		else if (new == SVC_DONE_STATE)
+			timeline_mark(TIMELINE_SVC_DONE, svc_ident(svc, NULL, 0));
+	}
 	*state = new;
 
 	/* if PID isn't collected within SVC_TERM_TIMEOUT msec, kill it! */
@@ -1667,6 +2345,103 @@ static void svc_set_state(svc_t *svc, svc_state_t new)
 	}
 }
 
+static svc_t *dependents_lookup(svc_t **tbl, size_t sz, const char *cond)
+{
+	char c[MAX_COND_LEN];
+	size_t i;
+
+	for (i = strhash(cond) & (sz - 1); tbl[i]; i = (i + 1) & (sz - 1)) {
+		if (!strcmp(mkcond(tbl[i], c, sizeof(c)), cond))
+			return tbl[i];
+	}
+
+	return NULL;
+}
+
+/*
+ * Count, for each service, the other services depending on it, i.e.,
+ * with its pid/ condition, that are still running or stopping.  Used
+ * at shutdown to stop services in reverse dependency order.  A single
+ * pass over all services, providers are looked up in a temporary hash
+ * of their pid/ conditions.
+ */
+static void service_count_dependents(void)
+{
+	char cond[MAX_COND_LEN], conds[MAX_COND_LEN];
+	svc_t **tbl, *s, *iter = NULL;
+	size_t num = 0, sz = 16, i;
+
+	for (s = svc_iterator(&iter, 1); s; s = svc_iterator(&iter, 0)) {
+		s->dependents = 0;
+		num++;
+	}
+
+	while (sz < 2 * num)
+		sz <<= 1;
+
+	tbl = calloc(sz, sizeof(*tbl));
+	if (!tbl) {
+		_pe("Failed counting dependents, not ordering shutdown");
+		dependents_stale = 0;
+		return;
+	}
+
+	for (s = svc_iterator(&iter, 1); s; s = svc_iterator(&iter, 0)) {
+		mkcond(s, cond, sizeof(cond));
+		for (i = strhash(cond) & (sz - 1); tbl[i]; i = (i + 1) & (sz - 1))
+			;
+		tbl[i] = s;
+	}
+
+	for (s = svc_iterator(&iter, 1); s; s = svc_iterator(&iter, 0)) {
+		char *ptr;
+
+		if (!svc_has_cond(s))
+			continue;
+
+		switch (s->state) {
+		case SVC_RUNNING_STATE:
+		case SVC_WAITING_STATE:
+			if (s->pid <= 1)
+				continue;
+			break;
+
+		case SVC_STOPPING_STATE:
+			break;
+
+		default:
+			continue;
+		}
+
+		strlcpy(conds, s->cond, sizeof(conds));
+		for (ptr = strtok(conds, ","); ptr; ptr = strtok(NULL, ",")) {
+			svc_t *provider;
+
+			if (strncmp(ptr, "pid/", 4))
+				continue;
+
+			provider = dependents_lookup(tbl, sz, ptr);
+			if (provider && provider != s)
+				provider->dependents++;
+		}
+	}
+
+	free(tbl);
+	dependents_stale = 0;
+}
+
+/*
+ * Check if any other service depending on @svc is still running or
+ * stopping.  The counts are refreshed only when stale.
+ */
+static int service_has_dependents(svc_t *svc)
+{
+	if (dependents_stale)
+		service_count_dependents();
+
+	return svc->dependents > 0;
+}
+
 /*
  * Transition task/run/service
  *
@@ -1697,6 +2472,17 @@ restart:
 				service_pre_script(svc);
 			} else
 				svc_set_state(svc, SVC_READY_STATE);
+		} else if (!svc_in_runlevel(svc, runlevel) || svc_is_removed(svc)) {
+			/*
+			 * Not in this runlevel, or removed on reload, release
+			 * any sockets.  Kept across initctl restart, the next
+			 * instance gets them, see sock_pass().
+			 */
+			sock_close(svc);
+			sock_store_clear(svc);
+		} else if (svc->block == SVC_BLOCK_USER) {
+			/* initctl stop, nothing to activate, keep the fd store */
+			sock_close(svc);
 		}
 		break;
 
@@ -1706,6 +2492,10 @@ restart:
 		break;
 
 	case SVC_STOPPING_STATE:
+		/* Main PID collected, wait for the rest of its cgroup */
+		if (!svc->pid && svc->timer_cb == service_kill && service_cgroup_busy(svc))
+			break;
+
 		if (!svc->pid) {
 			char cond[MAX_COND_LEN];
 
@@ -1754,6 +2544,20 @@ restart:
 			if (sm_is_in_teardown(&sm))
 				break;
 
+			/* System under pressure, start when it has been relieved */
+			if (pressure_defer(svc))
+				break;
+
+			/* Socket activated, wait for first connection */
+			if (svc_has_sockets(svc) && !svc->activated) {
+				if (!sock_listen(svc))
+					break;
+
+				logit(LOG_WARNING, "%s: failed socket activation, starting directly.",
+				      svc_ident(svc, NULL, 0));
+				sock_pause(svc);
+			}
+
 			err = service_start(svc);
 			if (err) {
 				if (svc_is_missing(svc)) {
@@ -1772,11 +2576,22 @@ restart:
 
 	case SVC_RUNNING_STATE:
 		if (!enabled) {
+			/* At shutdown, dependents are stopped before their providers */
+			if (sm_is_in_shutdown(&sm) && service_has_dependents(svc)) {
+				_d("%s: waiting for dependents to stop ...", svc->cmd);
+				break;
+			}
 			service_stop(svc);
 			break;
 		}
 
 		if (!svc->pid) {
+			/* Socket activated service exited cleanly, e.g. idle, re-arm */
+			if (svc_has_sockets(svc) && WIFEXITED(svc->status) && !WEXITSTATUS(svc->status)) {
+				svc_set_state(svc, SVC_HALTED_STATE);
+				break;
+			}
+
 			if (svc_is_daemon(svc) || svc_is_tty(svc)) {
 				svc_restarting(svc);
 				svc_set_state(svc, SVC_HALTED_STATE);
@@ -1809,7 +2624,10 @@ restart:
 			break;
 
 		case COND_FLUX:
-			kill(svc->pid, SIGSTOP);
+			/* Cannot send keepalives, or pass health checks, while stopped */
+			deadline_stop(&svc->watchdog_timer);
+			health_stop(svc);
+			service_signal(svc, SIGSTOP, 0);
 			svc_set_state(svc, SVC_WAITING_STATE);
 			break;
 
@@ -1835,7 +2653,7 @@ restart:
 
 	case SVC_WAITING_STATE:
 		if (!enabled) {
-			kill(svc->pid, SIGCONT);
+			service_signal(svc, SIGCONT, 0);
 			service_stop(svc);
 			break;
 		}
@@ -1849,8 +2667,10 @@ restart:
 		cond = cond_get_agg(svc->cond);
 		switch (cond) {
 		case COND_ON:
-			kill(svc->pid, SIGCONT);
+			service_signal(svc, SIGCONT, 0);
 			svc_set_state(svc, SVC_RUNNING_STATE);
+			service_watchdog_arm(svc);
+			health_start(svc);
 			/* Reassert condition if we go from waiting and no change */
 			if (!svc_is_changed(svc)) {
 				char name[MAX_COND_LEN];
@@ -1863,7 +2683,7 @@ restart:
 
 		case COND_OFF:
 			_d("Condition for %s is off, sending SIGCONT + SIGTERM", svc->name);
-			kill(svc->pid, SIGCONT);
+			service_signal(svc, SIGCONT, 0);
 			service_stop(svc);
 			break;
 
@@ -1891,9 +2711,35 @@ restart:
 
 void service_step_all(int types)
 {
+	dependents_stale = 1;
 	svc_foreach_type(types, service_step);
 }
 
+/**
+ * service_shutdown_expired - Shutdown deadline reached, kill all services
+ *
+ * Called when the shutdown-timeout has elapsed.  Services still held
+ * back by their dependents are stopped, and all stopping services are
+ * killed, without waiting for their kill:SEC delay.
+ */
+void service_shutdown_expired(void)
+{
+	svc_t *svc, *iter = NULL;
+
+	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
+		if (svc->state == SVC_RUNNING_STATE && !svc_enabled(svc))
+			service_stop(svc);
+
+		if (svc->state != SVC_STOPPING_STATE)
+			continue;
+
+		if (svc->pid > 1)
+			logit(LOG_CONSOLE | LOG_WARNING, "%s[%d] did not stop in time.",
+			      svc_ident(svc, NULL, 0), svc->pid);
+		service_kill(svc);
+	}
+}
+
 void service_worker(void *unused)
 {
 	service_step_all(SVC_TYPE_RESPAWN | SVC_TYPE_RUNTASK);
@@ -35,11 +35,19 @@ void      service_runtask_clean  (void);
 void      service_reload_dynamic (void);
 void      service_update_rdeps   (void);
 
+pid_t     service_fork           (svc_t *svc, struct cgroup *cg);
+void      service_track          (svc_t *svc);
+void      service_untrack        (svc_t *svc);
+void      service_cgroup_empty   (const char *path);
+void      service_kill_hung      (svc_t *svc);
+
 int       service_step           (svc_t *svc);
 void      service_step_all       (int types);
+void      service_shutdown_expired(void);
 void      service_worker         (void *unused);
 
 int       service_completed      (void);
+int       service_keepalive      (svc_t *svc);
 
 #endif	/* FINIT_SERVICE_H_ */
 
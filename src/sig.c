@@ -70,7 +70,10 @@
  */
 
 #include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <string.h>		/* strerror() */
+#include <time.h>
 #include <sys/reboot.h>
 #include <sys/wait.h>
 #include <lite/lite.h>
@@ -80,10 +83,14 @@
 #include "conf.h"
 #include "config.h"
 #include "helpers.h"
+#include "latency.h"
+#include "logstore.h"
+#include "pid.h"
 #include "plugin.h"
 #include "private.h"
 #include "sig.h"
 #include "service.h"
+#include "sm.h"
 #include "util.h"
 #include "utmp-api.h"
 
@@ -162,53 +169,155 @@ void unmount_tmpfs(void);
 void unmount_regular(void);
 
 /*
- * Kernel threads have no cmdline so fgets() returns NULL for them.  We
- * also skip "special" processes, e.g. mdadm/mdmon or watchdogd that must
- * not be stopped here, for various reasons.
+ * Kernel threads have no cmdline so read() returns nothing for them.
+ * We also skip "special" processes, e.g. mdadm/mdmon or watchdogd that
+ * must not be stopped here, for various reasons.
  *
  * https://www.freedesktop.org/wiki/Software/systemd/RootStorageDaemons/
+ *
+ * If @pfd is given, a pidfd for each signaled process is stored in it,
+ * or -1 on kernels without pidfd support, and its PID in @pids.  The
+ * arrays are grown as needed, and the caller must free them.
+ *
+ * Returns the number of signaled processes.
  */
-void do_kill(int signo)
+static int do_kill(int signo, struct pollfd **pfd, pid_t **pids)
 {
 	DIR *dirp;
+	int num = 0, max = 0;
 
 	dirp = opendir("/proc");
 	if (dirp) {
 		struct dirent *d;
 
 		while ((d = readdir(dirp))) {
-			int pid;
-			FILE *fp;
 			char file[LINE_SIZE] = "";
+			ssize_t len;
+			int pid, fd;
 
 			if (d->d_type != DT_DIR)
 				continue;
 
 			pid = atoi(d->d_name);
-			if (!pid)
+			if (pid <= 1)
 				continue;
 
 			snprintf(file, sizeof(file), "/proc/%s/cmdline", d->d_name);
-			fp = fopen(file, "r");
-			if (!fp)
+			fd = open(file, O_RDONLY | O_CLOEXEC);
+			if (fd == -1)
+				continue;
+
+			len = read(fd, file, sizeof(file) - 1);
+			close(fd);
+			if (len <= 0)
+				continue;
+			file[len] = 0;
+
+			if (strstr(file, "gdbserver")) {
+				_d("Skipping %s ...", file);
+				continue;
+			}
+			if (file[0] == '@') {
+				_d("Skipping %s ...", &file[1]);
+				continue;
+			}
+
+			if (kill(pid, signo) || !pfd)
 				continue;
 
-			if (fgets(file, sizeof(file), fp)) {
-				if (strstr(file, "gdbserver"))
-					_d("Skipping %s ...", file);
-				else if (file[0] == '@')
-					_d("Skipping %s ...", &file[1]);
-				else
-					kill(pid, signo);
+			if (num == max) {
+				struct pollfd *p;
+				pid_t *q;
+
+				max = max ? max * 2 : 64;
+				p = realloc(*pfd, max * sizeof(*p));
+				if (p)
+					*pfd = p;
+				q = realloc(*pids, max * sizeof(*q));
+				if (q)
+					*pids = q;
+				if (!p || !q)
+					break;
 			}
-			fclose(fp);
+
+			(*pfd)[num].fd      = pid_open(pid);
+			(*pfd)[num].events  = POLLIN;
+			(*pfd)[num].revents = 0;
+			(*pids)[num++]      = pid;
 		}
 		closedir(dirp);
 	}
+
+	return num;
+}
+
+/*
+ * Wait for the processes signaled by do_kill() to exit, at most @msec
+ * milliseconds.  Exit is detected by the pidfd becoming readable, or
+ * on older kernels by polling the PID.  Our own children, i.e., any
+ * orphaned processes, are reaped as we go.
+ *
+ * Returns the number of processes still alive.
+ */
+static int do_wait(struct pollfd *pfd, pid_t *pids, int num, int msec)
+{
+	struct timespec start, now;
+	int remain = num;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (remain) {
+		int tick = msec, i;
+
+		while (waitpid(-1, NULL, WNOHANG) > 0)
+			;
+
+		remain = 0;
+		for (i = 0; i < num; i++) {
+			if (!pids[i])
+				continue;
+
+			if (pfd[i].fd != -1) {
+				if (!(pfd[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+					remain++;
+					continue;
+				}
+				close(pfd[i].fd);
+				pfd[i].fd = -1;
+			} else if (!kill(pids[i], 0)) {
+				/* No pidfd, check again soon */
+				if (tick > 100)
+					tick = 100;
+				remain++;
+				continue;
+			}
+			pids[i] = 0;
+		}
+
+		if (!remain || tick <= 0)
+			break;
+
+		if (poll(pfd, num, tick) == -1 && errno != EINTR)
+			break;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		msec -= (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+		start = now;
+	}
+
+	for (int i = 0; i < num; i++) {
+		if (pfd[i].fd != -1)
+			close(pfd[i].fd);
+	}
+
+	return remain;
 }
 
 void do_shutdown(shutop_t op)
 {
+	struct pollfd *pfd = NULL;
+	pid_t *pids = NULL;
+	int num;
+
 	if (sdown)
 		run_interactive(sdown, "Calling shutdown hook: %s", sdown);
 
@@ -216,22 +325,31 @@ void do_shutdown(shutop_t op)
 	utmp_set_halt();
 
 	/*
-	 * Tell remaining non-monitored processes to exit, give them
-	 * time to exit gracefully, 2 sec was customary, we go for 1.
+	 * Tell remaining non-monitored processes to exit, give them time
+	 * to exit gracefully, but only until the shutdown deadline.  We
+	 * proceed as soon as all of them are gone.
 	 */
-	do_kill(SIGTERM);
-	do_sleep(1);
-	do_kill(SIGKILL);
+	num = do_kill(SIGTERM, &pfd, &pids);
+	if (num > 0)
+		num = do_wait(pfd, pids, num, sm_deadline_left(&sm));
+	free(pfd);
+	free(pids);
+
+	if (num > 0)
+		_d("%d processes did not exit in time, sending SIGKILL ...", num);
+	do_kill(SIGKILL, NULL, NULL);
 
 	/* Exit plugins and API gracefully */
 	plugin_exit();
 	api_exit();
+	logstore_exit();
 
 	/* Reap 'em */
 	while (waitpid(-1, NULL, WNOHANG) > 0)
 		;
 
 	/* Close all local non-console descriptors */
+	log_close();
 	for (int fd = 3; fd < 128; fd++)
 		close(fd);
 
@@ -293,10 +411,14 @@ void do_shutdown(shutop_t op)
  */
 static void sighup_cb(uev_t *w, void *arg, int events)
 {
+	static struct latency lat = { .stat.name = "sighup_cb" };
+	struct timespec start;
+
+	latency_start(&start);
 	_d("...");
 	if (UEV_ERROR == events) {
 		_e("Unrecoverable error in signal watcher");
-		return;
+		goto done;
 	}
 
 	/* Restart initctl API domain socket, similar to systemd/SysV init */
@@ -305,6 +427,8 @@ static void sighup_cb(uev_t *w, void *arg, int events)
 
 	/* INIT_CMD_RELOAD: 'init q', 'initctl reload', and SIGHUP */
 	service_reload_dynamic();
+done:
+	latency_stop(&lat, &start);
 }
 
 /*
@@ -314,13 +438,19 @@ static void sighup_cb(uev_t *w, void *arg, int events)
  */
 static void sigint_cb(uev_t *w, void *arg, int events)
 {
+	static struct latency lat = { .stat.name = "sigint_cb" };
+	struct timespec start;
+
+	latency_start(&start);
 	_d("...");
 	if (UEV_ERROR == events) {
 		_e("Unrecoverable error in signal watcher");
-		return;
+		goto done;
 	}
 
 	cond_set_oneshot_noupdate("sys/key/ctrlaltdel");
+done:
+	latency_stop(&lat, &start);
 }
 
 /*
@@ -330,13 +460,19 @@ static void sigint_cb(uev_t *w, void *arg, int events)
  */
 static void sigpwr_cb(uev_t *w, void *arg, int events)
 {
+	static struct latency lat = { .stat.name = "sigpwr_cb" };
+	struct timespec start;
+
+	latency_start(&start);
 	_d("...");
 	if (UEV_ERROR == events) {
 		_e("Unrecoverable error in signal watcher");
-		return;
+		goto done;
 	}
 
 	cond_set_oneshot_noupdate("sys/pwr/fail");
+done:
+	latency_stop(&lat, &start);
 }
 
 /*
@@ -344,15 +480,21 @@ static void sigpwr_cb(uev_t *w, void *arg, int events)
  */
 static void sigusr1_cb(uev_t *w, void *arg, int events)
 {
+	static struct latency lat = { .stat.name = "sigusr1_cb" };
+	struct timespec start;
+
+	latency_start(&start);
 	_d("...");
 	if (UEV_ERROR == events) {
 		_e("Unrecoverable error in signal watcher");
-		return;
+		goto done;
 	}
 
 	/* Restart initctl API domain socket, similar to systemd/SysV init */
 	api_exit();
 	api_init(w->ctx);
+done:
+	latency_stop(&lat, &start);
 }
 
 /*
@@ -360,14 +502,20 @@ static void sigusr1_cb(uev_t *w, void *arg, int events)
  */
 static void sigusr2_cb(uev_t *w, void *arg, int events)
 {
+	static struct latency lat = { .stat.name = "sigusr2_cb" };
+	struct timespec start;
+
+	latency_start(&start);
 	_d("...");
 	if (UEV_ERROR == events) {
 		_e("Unrecoverable error in signal watcher");
-		return;
+		goto done;
 	}
 
 	halt = SHUT_OFF;
 	service_runlevel(0);
+done:
+	latency_stop(&lat, &start);
 }
 
 /*
@@ -375,32 +523,38 @@ static void sigusr2_cb(uev_t *w, void *arg, int events)
  */
 static void sigterm_cb(uev_t *w, void *arg, int events)
 {
+	static struct latency lat = { .stat.name = "sigterm_cb" };
+	struct timespec start;
+
+	latency_start(&start);
 	_d("...");
 	if (UEV_ERROR == events) {
 		_e("Unrecoverable error in signal watcher");
-		return;
+		goto done;
 	}
 
 	halt = SHUT_REBOOT;
 	service_runlevel(6);
+done:
+	latency_stop(&lat, &start);
 }
 
-/*
- * SIGCHLD: one of our children has died
+/**
+ * sig_reap - Collect all terminated children
+ *
+ * Each zombie is peeked at before it is reaped, so the remains of its
+ * process group can be killed in service_collect() while the zombie
+ * still holds the PGID.  Since WNOWAIT returns the same zombie until it
+ * is reaped, processes with a pidfd watcher are collected here as well,
+ * service_collect() stops the watcher, instead of stalling the loop.
  */
-static void sigchld_cb(uev_t *w, void *arg, int events)
+void sig_reap(void)
 {
-	pid_t pid;
 	int status;
+	pid_t pid;
 
-	if (UEV_ERROR == events) {
-		_e("Unrecoverable error in signal watcher");
-		return;
-	}
-
-	/* Reap all the children! */
 	while (1) {
-		pid = waitpid(-1, &status, WNOHANG);
+		pid = pid_peek(-1, &status);
 		if (pid <= 0) {
 			if (pid == -1 && errno == EINTR)
 				continue;
@@ -409,7 +563,30 @@ static void sigchld_cb(uev_t *w, void *arg, int events)
 
 		_d("Collected child %d", pid);
 		service_monitor(pid, status);
+		while (waitpid(pid, NULL, WNOHANG) == -1 && errno == EINTR)
+			;
+	}
+}
+
+/*
+ * SIGCHLD: one of our children has died.  Supervised processes are
+ * collected by their pidfd, see service_track(), so this is orphans
+ * re-parented to us, health probes, and fallback on older kernels.
+ */
+static void sigchld_cb(uev_t *w, void *arg, int events)
+{
+	static struct latency lat = { .stat.name = "sigchld_cb" };
+	struct timespec start;
+
+	latency_start(&start);
+	if (UEV_ERROR == events) {
+		_e("Unrecoverable error in signal watcher");
+		goto done;
 	}
+
+	sig_reap();
+done:
+	latency_stop(&lat, &start);
 }
 
 /*
@@ -70,6 +70,7 @@ int  sig_num        (const char *name);
 void sig_init       (void);
 void sig_unblock    (void);
 void sig_setup      (uev_ctx_t *ctx);
+void sig_reap       (void);
 
 const char *sig_name(int signo);
 
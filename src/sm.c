@@ -24,21 +24,27 @@
 #include "config.h"		/* Generated by configure script */
 
 #include <paths.h>
+#include <time.h>
 #include <sys/types.h>
 
 #include "finit.h"
 #include "cond.h"
 #include "conf.h"
 #include "helpers.h"
+#include "latency.h"
 #include "private.h"
 #include "service.h"
 #include "sig.h"
+#include "timeline.h"
+#include "trace.h"
 #include "tty.h"
 #include "sm.h"
 #include "utmp-api.h"
 
 sm_t sm;
 
+static uev_t deadline_timer;
+
 #ifndef FINIT_NOLOGIN_PATH
 #define FINIT_NOLOGIN_PATH _PATH_NOLOGIN /* Stop user logging in. */
 #endif
@@ -49,6 +55,8 @@ void sm_init(sm_t *sm)
 	sm->newlevel = -1;
 	sm->reload = 0;
 	sm->in_teardown = 0;
+	sm->expired = 0;
+	sm->deadline = 0;
 }
 
 static char *sm_status(sm_state_t state)
@@ -93,6 +101,72 @@ static void nologin(void)
 		erase(FINIT_NOLOGIN_PATH);
 }
 
+static long long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * The shutdown-timeout has elapsed, services that have not stopped yet
+ * are killed and the state machine proceeds with the shutdown without
+ * waiting for them to be collected.
+ */
+static void sm_deadline_cb(uev_t *w, void *arg, int events)
+{
+	static struct latency lat = { .stat.name = "sm_deadline_cb" };
+	sm_t *sm = arg;
+	struct timespec start;
+
+	latency_start(&start);
+	if (sm->state != SM_RUNLEVEL_WAIT_STATE)
+		goto done;
+
+	logit(LOG_CONSOLE | LOG_WARNING, "Shutdown deadline, %d sec, reached, stopping remaining services ...",
+	      sdown_tmo);
+	sm->expired = 1;
+	service_shutdown_expired();
+	sm_step(sm);
+done:
+	latency_stop(&lat, &start);
+}
+
+/*
+ * Arm the overall deadline for stopping all services, and any remaining
+ * processes, at shutdown/reboot.
+ */
+static void sm_deadline_start(sm_t *sm)
+{
+	sm->expired  = 0;
+	sm->deadline = now_ms() + sdown_tmo * 1000;
+	uev_timer_init(ctx, &deadline_timer, sm_deadline_cb, sm, sdown_tmo * 1000, 0);
+}
+
+/**
+ * sm_deadline_left - Time left until the shutdown deadline
+ * @sm: State machine
+ *
+ * Returns:
+ * Number of milliseconds until the shutdown deadline, zero if it has
+ * passed, or the full shutdown-timeout if the deadline is not armed.
+ */
+int sm_deadline_left(sm_t *sm)
+{
+	long long left;
+
+	if (!sm->deadline)
+		return sdown_tmo * 1000;
+
+	left = sm->deadline - now_ms();
+	if (left < 0)
+		return 0;
+
+	return (int)left;
+}
+
 void sm_set_runlevel(sm_t *sm, int newlevel)
 {
 	sm->newlevel = newlevel;
@@ -108,6 +182,18 @@ int sm_is_in_teardown(sm_t *sm)
 	return sm->in_teardown;
 }
 
+/*
+ * Ordered shutdown, i.e., services are stopped in reverse dependency
+ * order, until the shutdown deadline expires.
+ */
+int sm_is_in_shutdown(sm_t *sm)
+{
+	if (!sm->in_teardown || sm->expired)
+		return 0;
+
+	return runlevel == 0 || runlevel == 6;
+}
+
 void sm_step(sm_t *sm)
 {
 	svc_t *svc;
@@ -147,6 +233,9 @@ restart:
 		prevlevel    = runlevel;
 		runlevel     = sm->newlevel;
 		sm->newlevel = -1;
+		trace_sm(TRACE_RUNLEVEL, prevlevel, runlevel);
+		if (prevlevel > 0)
+			timeline_stop();	/* boot is over */
 
 		/* Restore terse mode and run hooks before shutdown */
 		if (runlevel == 0 || runlevel == 6) {
@@ -173,6 +262,9 @@ restart:
 		/* Reset once flag of runtasks */
 		service_runtask_clean();
 
+		if (runlevel == 0 || runlevel == 6)
+			sm_deadline_start(sm);
+
 		_d("Stopping services not allowed in new runlevel ...");
 		sm->in_teardown = 1;
 		service_step_all(SVC_TYPE_ANY);
@@ -185,11 +277,16 @@ restart:
 		 * Need to wait for any services to stop? If so, exit early
 		 * and perform second stage from service_monitor later.
 		 */
+		/* Stop any services held back by their dependents */
+		if (sm_is_in_shutdown(sm))
+			service_step_all(SVC_TYPE_ANY);
+
 		svc = svc_stop_completed();
-		if (svc) {
+		if (svc && !sm->expired) {
 			_d("Waiting to collect %s(%d) ...", svc->cmd, svc->pid);
 			break;
 		}
+		uev_timer_stop(&deadline_timer);
 
 		/* Prev runlevel services stopped, call hooks before starting new runlevel ... */
 		_d("All services have been stopped, calling runlevel change hooks ...");
@@ -262,8 +359,10 @@ restart:
 		break;
 	}
 
-	if (sm->state != old_state)
+	if (sm->state != old_state) {
+		trace_sm(TRACE_SM_STATE, old_state, sm->state);
 		goto restart;
+	}
 }
 
 /**
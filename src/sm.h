@@ -38,6 +38,8 @@ typedef struct sm {
 	int newlevel;             /* Set on runlevel change to new runlevel, -1 if not change */
 	int reload;               /* Set on reload event, else 0  */
 	int in_teardown;          /* Set when waiting for all processes to be halted */
+	int expired;              /* Set when the shutdown deadline has expired */
+	long long deadline;       /* Shutdown deadline, msec CLOCK_MONOTONIC, or 0 */
 } sm_t;
 
 extern sm_t  sm;
@@ -47,6 +49,8 @@ void sm_step(sm_t *sm);
 void sm_set_runlevel(sm_t *sm, int newlevel);
 void sm_set_reload(sm_t *sm);
 int  sm_is_in_teardown(sm_t *sm);
+int  sm_is_in_shutdown(sm_t *sm);
+int  sm_deadline_left (sm_t *sm);
 
 #endif	/* FINIT_SM_H_ */
 
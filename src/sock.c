@@ -0,0 +1,469 @@
+/* Socket activation, listening sockets held by Finit for services
+ *
+ * Copyright (c) 2021  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <lite/lite.h>
+#include <uev/uev.h>
+
+#include "finit.h"
+#include "helpers.h"
+#include "latency.h"
+#include "log.h"
+#include "service.h"
+#include "sock.h"
+
+/*
+ * Open a listening socket, or FIFO, from one of the spec formats:
+ *
+ *     tcp:PORT, tcp:ADDR:PORT, tcp:[ADDR6]:PORT
+ *     udp:PORT, udp:ADDR:PORT, udp:[ADDR6]:PORT
+ *     unix:/path/to/socket
+ *     fifo:/path/to/fifo
+ *
+ * All descriptors are opened non-blocking with close-on-exec, the
+ * latter is cleared for the service in sock_pass().
+ */
+static int sock_open(char *spec)
+{
+	struct addrinfo hints = { 0 }, *ai;
+	char buf[MAX_ARG_LEN];
+	char *addr, *port;
+	int sd, rc, on = 1;
+
+	strlcpy(buf, spec, sizeof(buf));
+
+	if (!strncmp(buf, "fifo:", 5)) {
+		char *path = &buf[5];
+
+		if (mkfifo(path, 0600) && errno != EEXIST)
+			return -1;
+
+		/* O_RDWR to prevent EOF when the last writer closes */
+		return open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	}
+
+	if (!strncmp(buf, "unix:", 5)) {
+		struct sockaddr_un sun = { .sun_family = AF_UNIX };
+		char *path = &buf[5];
+
+		if (path[0] != '/' || strlen(path) >= sizeof(sun.sun_path)) {
+			errno = EINVAL;
+			return -1;
+		}
+		strlcpy(sun.sun_path, path, sizeof(sun.sun_path));
+
+		sd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (sd == -1)
+			return -1;
+
+		/* Stale socket from previous instance of Finit or service */
+		if (remove(path) && errno != ENOENT)
+			goto fail;
+		if (bind(sd, (struct sockaddr *)&sun, sizeof(sun)))
+			goto fail;
+		if (listen(sd, SOMAXCONN))
+			goto fail;
+
+		return sd;
+	}
+
+	if (!strncmp(buf, "tcp:", 4))
+		hints.ai_socktype = SOCK_STREAM;
+	else if (!strncmp(buf, "udp:", 4))
+		hints.ai_socktype = SOCK_DGRAM;
+	else {
+		errno = EPROTONOSUPPORT;
+		return -1;
+	}
+
+	addr = &buf[4];
+	port = strrchr(addr, ':');
+	if (port) {
+		*port++ = 0;
+		if (addr[0] == '[') {
+			char *end = strchr(++addr, ']');
+
+			if (end)
+				*end = 0;
+		}
+	} else {
+		port = addr;
+		addr = NULL;
+	}
+
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_flags  = AI_PASSIVE | AI_NUMERICHOST | AI_NUMERICSERV;
+	rc = getaddrinfo(addr, port, &hints, &ai);
+	if (rc) {
+		_e("Invalid listen address %s: %s", spec, gai_strerror(rc));
+		errno = EINVAL;
+		return -1;
+	}
+
+	sd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (sd == -1) {
+		freeaddrinfo(ai);
+		return -1;
+	}
+
+	setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	rc = bind(sd, ai->ai_addr, ai->ai_addrlen);
+	freeaddrinfo(ai);
+	if (rc)
+		goto fail;
+
+	if (hints.ai_socktype == SOCK_STREAM && listen(sd, SOMAXCONN))
+		goto fail;
+
+	return sd;
+fail:
+	rc = errno;
+	close(sd);
+	errno = rc;
+
+	return -1;
+}
+
+/*
+ * Backoff expired, let the state machine call sock_listen() to re-open
+ * any socket closed by sock_cb() after an error.
+ */
+static void sock_retry_cb(uev_t *w, void *arg, int events)
+{
+	static struct latency lat = { .stat.name = "sock_retry_cb" };
+	struct timespec start;
+
+	latency_start(&start);
+	service_step(arg);
+
+	latency_stop(&lat, &start);
+}
+
+/*
+ * Activity on one of the service's sockets, stop watching all of them
+ * and let the state machine start the service.  The service inherits
+ * the pending connection, or datagram, and the listening socket.
+ *
+ * On error the socket is closed, re-arming it would only busy-loop,
+ * and re-opened after 1, 2, 4 .. sec, see sock_listen().
+ */
+static void sock_cb(uev_t *w, void *arg, int events)
+{
+	static struct latency lat = { .stat.name = "sock_cb" };
+	struct svc_sock *sock = NULL;
+	svc_t *svc = arg;
+	int i;
+	struct timespec start;
+
+	latency_start(&start);
+	if (UEV_ERROR == events) {
+		for (i = 0; i < MAX_NUM_SOCKS; i++) {
+			if (&svc->sock[i].watcher == w)
+				sock = &svc->sock[i];
+		}
+		if (!sock)
+			goto done;
+
+		uev_io_stop(w);
+		close(sock->fd);
+		sock->fd = -1;
+
+		if (++sock->retries > SOCK_RETRY_MAX) {
+			logit(LOG_ERR, "%s: error on %s, giving up.", svc_ident(svc, NULL, 0), sock->spec);
+			goto done;
+		}
+
+		logit(LOG_WARNING, "%s: error on %s, re-opening in %d sec.", svc_ident(svc, NULL, 0),
+		      sock->spec, 1 << (sock->retries - 1));
+		uev_timer_stop(&svc->sock_timer);
+		uev_timer_init(ctx, &svc->sock_timer, sock_retry_cb, svc,
+			       1000 << (sock->retries - 1), 0);
+		goto done;
+	}
+
+	_d("%s: activity on listening socket, activating service.", svc_ident(svc, NULL, 0));
+	for (i = 0; i < MAX_NUM_SOCKS; i++)
+		svc->sock[i].retries = 0;
+	sock_pause(svc);
+	svc->activated = 1;
+	service_step(svc);
+done:
+	latency_stop(&lat, &start);
+}
+
+/**
+ * sock_parse - Parse listen:SPEC options for a service
+ * @svc:   Service the sockets belong to
+ * @specs: Array of listen specs, without the listen: prefix
+ * @num:   Number of entries in @specs
+ *
+ * Called on every (re)load of the .conf file.  Sockets with changed,
+ * or removed, specs are closed.  Unchanged sockets are kept open, so
+ * clients can keep connecting across a reload.
+ *
+ * Returns:
+ * Number of sockets configured for @svc.
+ */
+int sock_parse(svc_t *svc, char *specs[], int num)
+{
+	int i;
+
+	if (num > MAX_NUM_SOCKS) {
+		_e("%s: too many listen sockets, max %d", svc->cmd, MAX_NUM_SOCKS);
+		num = MAX_NUM_SOCKS;
+	}
+
+	for (i = 0; i < MAX_NUM_SOCKS; i++) {
+		struct svc_sock *sock = &svc->sock[i];
+		char *spec = i < num ? specs[i] : "";
+
+		if (!strcmp(sock->spec, spec))
+			continue;
+
+		if (sock->fd != -1) {
+			uev_io_stop(&sock->watcher);
+			close(sock->fd);
+			sock->fd = -1;
+		}
+		strlcpy(sock->spec, spec, sizeof(sock->spec));
+		sock->retries = 0;
+	}
+
+	return num;
+}
+
+/**
+ * sock_listen - Open and watch all listening sockets of a service
+ * @svc: Service to wait for connections to
+ *
+ * Opens any sockets not yet opened and adds all of them to the event
+ * loop.  When a client connects, or sends a datagram, sock_cb() sets
+ * @svc as activated and calls service_step() to start it.
+ *
+ * Returns:
+ * POSIX OK(0) on success, non-zero if any socket could not be opened.
+ */
+int sock_listen(svc_t *svc)
+{
+	int i, rc = 0;
+
+	for (i = 0; i < MAX_NUM_SOCKS; i++) {
+		struct svc_sock *sock = &svc->sock[i];
+
+		if (!sock->spec[0])
+			break;
+
+		if (sock->fd == -1) {
+			/* Closed after error, wait for backoff, or give up */
+			if (sock->retries > SOCK_RETRY_MAX) {
+				rc = 1;
+				continue;
+			}
+			if (sock->retries && uev_timer_active(&svc->sock_timer))
+				continue;
+
+			sock->fd = sock_open(sock->spec);
+			if (sock->fd == -1) {
+				logit(LOG_ERR, "%s: failed opening %s: %s", svc_ident(svc, NULL, 0),
+				      sock->spec, strerror(errno));
+				rc = 1;
+				continue;
+			}
+			_d("%s: listening on %s, fd %d", svc_ident(svc, NULL, 0), sock->spec, sock->fd);
+		}
+
+		if (uev_io_active(&sock->watcher))
+			continue;
+
+		if (uev_io_init(ctx, &sock->watcher, sock_cb, svc, sock->fd, UEV_READ)) {
+			_pe("%s: failed watching %s", svc_ident(svc, NULL, 0), sock->spec);
+			rc = 1;
+		}
+	}
+
+	return rc;
+}
+
+/**
+ * sock_pause - Stop watching listening sockets of a service
+ * @svc: Service to stop watching for
+ *
+ * Called when the service is started, the sockets are kept open and
+ * watched again by sock_listen() when the service has exited.
+ */
+void sock_pause(svc_t *svc)
+{
+	int i;
+
+	for (i = 0; i < MAX_NUM_SOCKS; i++) {
+		struct svc_sock *sock = &svc->sock[i];
+
+		if (sock->fd != -1)
+			uev_io_stop(&sock->watcher);
+	}
+}
+
+/**
+ * sock_close - Close all listening sockets of a service
+ * @svc: Service that leaves the runlevel, or is removed
+ */
+void sock_close(svc_t *svc)
+{
+	int i;
+
+	uev_timer_stop(&svc->sock_timer);
+	for (i = 0; i < MAX_NUM_SOCKS; i++) {
+		struct svc_sock *sock = &svc->sock[i];
+
+		sock->retries = 0;
+		if (sock->fd == -1)
+			continue;
+
+		_d("%s: closing %s, fd %d", svc_ident(svc, NULL, 0), sock->spec, sock->fd);
+		uev_io_stop(&sock->watcher);
+		close(sock->fd);
+		sock->fd = -1;
+
+		if (!strncmp(sock->spec, "unix:", 5))
+			remove(&sock->spec[5]);
+	}
+	svc->activated = 0;
+}
+
+/**
+ * sock_pass - Hand over listening sockets and stored fds to a service
+ * @svc: Service being started, called in the child process
+ *
+ * Moves all sockets, followed by any descriptors in the fd store, to
+ * consecutive descriptors starting at 3 and sets $LISTEN_FDS and
+ * $LISTEN_PID, see sd_listen_fds(3).
+ *
+ * Returns:
+ * Number of descriptors passed to the service.
+ */
+int sock_pass(svc_t *svc)
+{
+	int tmp[MAX_NUM_SOCKS + MAX_NUM_FDSTORE];
+	int base = SOCK_LISTEN_FDS_START + NELEMS(tmp);
+	int i, num = 0;
+	char val[16];
+
+	/* Move out of the way first, the fds may overlap the target range */
+	for (i = 0; i < MAX_NUM_SOCKS; i++) {
+		struct svc_sock *sock = &svc->sock[i];
+
+		if (!sock->spec[0] || sock->fd == -1)
+			continue;
+
+		tmp[num] = fcntl(sock->fd, F_DUPFD, base);
+		if (tmp[num] == -1)
+			continue;
+		num++;
+	}
+
+	for (i = 0; i < svc->fdstore_num; i++) {
+		tmp[num] = fcntl(svc->fdstore[i], F_DUPFD, base);
+		if (tmp[num] == -1)
+			continue;
+		num++;
+	}
+
+	for (i = 0; i < num; i++) {
+		/* dup2() clears FD_CLOEXEC on the new descriptor */
+		dup2(tmp[i], SOCK_LISTEN_FDS_START + i);
+		close(tmp[i]);
+	}
+
+	if (!num)
+		return 0;
+
+	snprintf(val, sizeof(val), "%d", num);
+	setenv("LISTEN_FDS", val, 1);
+	snprintf(val, sizeof(val), "%d", getpid());
+	setenv("LISTEN_PID", val, 1);
+
+	return num;
+}
+
+/**
+ * sock_store - Add descriptors to the fd store of a service
+ * @svc: Service handing over the descriptors
+ * @fds: Array of descriptors, received with %SCM_RIGHTS
+ * @num: Number of descriptors in @fds
+ *
+ * Takes ownership of all descriptors in @fds, any that do not fit are
+ * closed.  Descriptors are not de-duplicated, a service that hands over
+ * the same sockets every time should replace the store instead, using
+ * %INIT_CMD_FDSTORE_CLEAR.  The store is passed on to the next instance
+ * of the service, see sock_pass().
+ *
+ * Returns:
+ * POSIX OK(0) if all descriptors were stored, non-zero otherwise.
+ */
+int sock_store(svc_t *svc, int fds[], int num)
+{
+	int i, rc = 0;
+
+	for (i = 0; i < num; i++) {
+		if (svc->fdstore_num >= MAX_NUM_FDSTORE) {
+			_e("%s: fd store full, max %d", svc_ident(svc, NULL, 0), MAX_NUM_FDSTORE);
+			close(fds[i]);
+			rc = 1;
+			continue;
+		}
+
+		/* Must not leak to other processes started by Finit */
+		fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+		svc->fdstore[svc->fdstore_num++] = fds[i];
+	}
+	_d("%s: fd store now holds %d fds", svc_ident(svc, NULL, 0), svc->fdstore_num);
+
+	return rc;
+}
+
+/**
+ * sock_store_clear - Close all descriptors in the fd store of a service
+ * @svc: Service that leaves the runlevel, is removed, or asked for it
+ */
+void sock_store_clear(svc_t *svc)
+{
+	while (svc->fdstore_num > 0)
+		close(svc->fdstore[--svc->fdstore_num]);
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,51 @@
+/* Socket activation, listening sockets held by Finit for services
+ *
+ * Copyright (c) 2021  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef FINIT_SOCK_H_
+#define FINIT_SOCK_H_
+
+#include "svc.h"
+
+/* First fd passed to socket activated services, see sd_listen_fds(3) */
+#define SOCK_LISTEN_FDS_START 3
+
+/* Attempts to re-open a socket after error, with backoff, see sock_cb() */
+#define SOCK_RETRY_MAX        5
+
+int  sock_parse  (svc_t *svc, char *specs[], int num);
+int  sock_listen (svc_t *svc);
+void sock_pause  (svc_t *svc);
+void sock_close  (svc_t *svc);
+int  sock_pass   (svc_t *svc);
+
+int  sock_store  (svc_t *svc, int fds[], int num);
+void sock_store_clear(svc_t *svc);
+
+#endif /* FINIT_SOCK_H_ */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
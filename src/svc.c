@@ -145,6 +145,12 @@ svc_t *svc_new(char *cmd, char *id, int type)
 	/* Default delay between SIGTERM and SIGKILL */
 	svc->killdelay = SVC_TERM_TIMEOUT;
 
+	/* No listening sockets opened yet */
+	for (int i = 0; i < MAX_NUM_SOCKS; i++)
+		svc->sock[i].fd = -1;
+	svc->health.fd = -1;
+	svc->pidfd = -1;
+
 	TAILQ_INSERT_TAIL(&svc_list, svc, link);
 
 	return svc;
@@ -164,6 +170,9 @@ static struct wq work = {
  */
 int svc_del(svc_t *svc)
 {
+	if (svc->cgroup.leaf[0])
+		cgroup_leaf_release(svc->cgroup.leaf, svc);
+
 	TAILQ_REMOVE(&svc_list, svc, link);
 	TAILQ_INSERT_TAIL(&gc_list, svc, link);
 
@@ -324,17 +333,30 @@ void svc_foreach_type(int types, int (*cb)(svc_t *))
 /**
  * svc_stop_completed - Have all stopped services been collected?
  *
+ * At shutdown/reboot this also covers services not yet stopped, held
+ * back until their dependents have stopped, and services waiting for
+ * their cgroup to be emptied.
+ *
  * Returns:
  * %NULL if all stopped services have been collected, otherwise a
  * pointer to the first svc_t waiting to be collected.
  */
 svc_t *svc_stop_completed(void)
 {
+	int shutdown = runlevel == 0 || runlevel == 6;
 	svc_t *svc, *iter = NULL;
 
 	for (svc = svc_iterator(&iter, 1); svc; svc = svc_iterator(&iter, 0)) {
 		if (svc->state == SVC_STOPPING_STATE && svc->pid > 1)
 			return svc;
+
+		if (!shutdown)
+			continue;
+
+		if (svc->state == SVC_STOPPING_STATE && svc_is_daemon(svc))
+			return svc;
+		if (svc->state == SVC_RUNNING_STATE && svc->pid > 1 && !svc_enabled(svc))
+			return svc;
 	}
 
 	return NULL;
@@ -25,6 +25,7 @@
 #ifndef FINIT_SVC_H_
 #define FINIT_SVC_H_
 
+#include <sched.h>		/* cpu_set_t */
 #include <sys/ipc.h>		/* IPC_CREAT */
 #include <sys/resource.h>
 #include <sys/types.h>		/* pid_t */
@@ -33,6 +34,7 @@
 #include <uev/uev.h>
 
 #include "cgroup.h"
+#include "deadline.h"
 #include "helpers.h"
 
 typedef int svc_cmd_t;
@@ -83,13 +85,64 @@ typedef enum {
 #define MAX_USER_LEN     16
 #define MAX_NUM_FDS      64	     /* Max number of I/O plugins */
 #define MAX_NUM_SVC_ARGS 64
+#define MAX_NUM_SOCKS    4	     /* Max number of listen: per service */
+#define MAX_NUM_FDSTORE  16	     /* Max number of fds stored per service */
+#define MAX_NUM_PLACEMENT 8	     /* Max number of cpus:, sched: etc. per service */
+#define MAX_NUM_INSTANCES 1024	     /* Max number of instances:K per template */
 
 /* Default kill delay (msec) after SIGTERM (svc->sighalt) that we SIGKILL processes */
 #define SVC_TERM_TIMEOUT 3000
 
+/* Collected process that is not our child, matches none of the W*() macros */
+#define SVC_STATUS_UNKNOWN 0x00ff
+
 /* Prevent endless respawn of faulty services. */
 #define SVC_RESPAWN_MAX  10
 
+/* Listening socket, or FIFO, held by Finit for a socket activated service */
+struct svc_sock {
+	char           spec[MAX_ARG_LEN]; /* tcp:[ADDR:]PORT, udp:.., unix:/path, fifo:/path */
+	int            fd;
+	int            retries;           /* Re-opened after error, see sock_cb() */
+	uev_t          watcher;
+};
+
+/* Health check probe, run by Finit at an interval, see health.c */
+struct svc_health {
+	char           spec[MAX_ARG_LEN]; /* exec:/path, tcp:[ADDR:]PORT, unix:/path */
+	int            interval;          /* msec */
+	int            timeout;           /* msec */
+	int            retries;           /* Consecutive failures before action */
+	int            action;            /* HEALTH_ACTION_RESTART or _COND */
+	int            failures;          /* Consecutive failures, so far */
+	int            failed;            /* Condition withdrawn, waiting for recovery */
+	pid_t          pid;               /* exec: probe in progress */
+	LIST_ENTRY(svc_health) link;      /* in PID index of exec: probes */
+	int            fd;                /* tcp/unix: connect in progress */
+	struct deadline timer;            /* interval */
+	struct deadline tmo;              /* probe timeout */
+	uev_t          watcher;           /* connect completion */
+};
+
+/* CPU, NUMA placement and scheduling, applied before exec, see placement.c */
+#define PLACE_CPUS     0x01
+#define PLACE_MEMS     0x02
+#define PLACE_SCHED    0x04
+#define PLACE_NICE     0x08
+#define PLACE_IOPRIO   0x10
+#define PLACE_OOM      0x20
+
+struct svc_sched {
+	int            flags;             /* PLACE_*, settings to apply */
+	cpu_set_t      cpus;              /* cpus:LIST, or CPUs of numa:NODES */
+	unsigned long  mems;              /* numa:NODES, bitmask for set_mempolicy() */
+	int            policy;            /* sched:POLICY, SCHED_FIFO etc. */
+	int            prio;              /* sched:fifo:PRIO, or rr:PRIO */
+	int            nice;              /* nice:NUM */
+	int            ioprio;            /* ioprio:CLASS[:LEVEL], kernel format */
+	int            oom;               /* oom:ADJ, oom_score_adj */
+};
+
 /*
  * Default enable for all services, can be stopped by means
  * of issuing an initctl call. E.g.
@@ -110,6 +163,7 @@ typedef struct svc {
 	int            sighalt;        /* Signal to stop process, default: SIGTERM */
 	int            killdelay;      /* Delay in msec before sending SIGKILL */
 	pid_t          oldpid, pid;
+	int            pidfd;          /* Refers to pid, exit and signals without PID races */
 	char           pidfile[256];
 	long           start_time;     /* Start time, as seconds since boot, from sysinfo() */
 	int            started;	       /* Set for run/task/sysv to track if started */
@@ -120,15 +174,34 @@ typedef struct svc {
 	const int      dirty;	       /* 0: unmodified, 1: modified */
 	const int      removed;
 	int            starting;       /* ... waiting for pidfile to be re-asserted */
+	int            start_timeout;  /* Max time (msec) in starting, 0: disabled */
+	int            watchdog;       /* Max time (msec) between keepalives, 0: disabled */
+	int            critical;       /* Never deferred when system is under pressure */
+	int            oom_kills;      /* Last oom_kill count in memory.events of leaf */
 	int	       runlevels;
 	int            sighup;	       /* This service supports SIGHUP :) */
 	svc_block_t    block;	       /* Reason that this service is currently stopped */
 	char           cond[MAX_COND_LEN];
 
+	/* Socket activation, started on first connection to any socket */
+	struct svc_sock sock[MAX_NUM_SOCKS];
+	int            activated;
+
+	/* Descriptors handed to Finit by the service, passed on to next instance */
+	int            fdstore[MAX_NUM_FDSTORE];
+	int            fdstore_num;
+
+	/* Health check probe, restart or withdraw condition on failure */
+	struct svc_health health;
+
+	/* CPU affinity, NUMA placement and scheduling */
+	struct svc_sched sched;
+
 	/* Instance specifics */
 	int            job;	       /* For intenal use only, canonical ref is NAME:ID */
 	char           name[MAX_ARG_LEN];
 	char           id[MAX_ID_LEN]; /* :ID */
+	int            instance;       /* 1..K from instances:K template, or 0 */
 
 	/* Counters */
 	char           once;	       /* run/task, (at least) once per runlevel */
@@ -147,6 +220,10 @@ typedef struct svc {
 			char  file[64];
 			char  prio[20];
 			char  ident[20];
+			unsigned rate;	/* lines/s, 0: unlimited */
+			unsigned bytes;	/* bytes/s, 0: unlimited */
+			unsigned burst;	/* sec */
+			char  block;	/* backpressure, or drop */
 		} log;
 
 		/* Only for TTY type services */
@@ -182,6 +259,15 @@ typedef struct svc {
 	uev_t          timer;
 	void           (*timer_cb)(struct svc *svc);
 
+	/* Deadline for service to become ready, see start-timeout:SEC */
+	uev_t          start_timer;
+	struct deadline watchdog_timer;   /* Shared with health probes, see deadline.c */
+	uev_t          pidfd_watcher;
+	uev_t          sock_timer;        /* Backoff before re-opening sockets */
+
+	/* Running dependents at shutdown, see service_has_dependents() */
+	int            dependents;
+
 	/* time at svc_del(), used by gc timer */
 	struct timespec gc;
 } svc_t;
@@ -224,12 +310,14 @@ static inline int svc_is_sysv      (svc_t *svc) { return svc && SVC_TYPE_SYSV
 static inline int svc_is_tty       (svc_t *svc) { return svc && SVC_TYPE_TTY     == svc->type; }
 static inline int svc_is_runtask   (svc_t *svc) { return svc && (SVC_TYPE_RUNTASK & svc->type);}
 static inline int svc_is_forking   (svc_t *svc) { return (svc_is_daemon(svc) || svc_is_sysv(svc)) && svc->pidfile[0] == '!'; }
+static inline int svc_is_cgtracked (svc_t *svc) { return svc_is_forking(svc) && !svc->pidfile[1]; }
 
 static inline int svc_in_runlevel  (svc_t *svc, int runlevel) { return svc && ISSET(svc->runlevels, runlevel); }
 static inline int svc_nohup        (svc_t *svc) { return svc &&  (0 == svc->sighup || 0 != svc->args_dirty); }
 static inline int svc_has_pidfile  (svc_t *svc) { return svc_is_daemon(svc) && svc->pidfile[0] != 0 && svc->pidfile[0] != '!'; }
 static inline int svc_has_pre      (svc_t *svc) { return svc->pre_script[0];  }
 static inline int svc_has_post     (svc_t *svc) { return svc->post_script[0]; }
+static inline int svc_has_sockets  (svc_t *svc) { return svc_is_daemon(svc) && svc->sock[0].spec[0]; }
 
 static inline void svc_starting    (svc_t *svc) { if (svc) svc->starting = 1;       }
 static inline void svc_started     (svc_t *svc) { if (svc) svc->starting = 0;       }
@@ -324,6 +412,8 @@ static inline char *svc_status(svc_t *svc)
 		return "setup";
 
 	case SVC_READY_STATE:
+		if (svc_has_sockets(svc) && !svc->activated)
+			return "listen";
 		return "ready";
 
 	case SVC_RUNNING_STATE:
@@ -0,0 +1,150 @@
+/* Boot timeline, milestones for initctl analyze
+ *
+ * Copyright (c) 2021  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+
+#include "finit.h"
+#include "helpers.h"
+#include "private.h"
+#include "timeline.h"
+
+/*
+ * Recorded from start until the first runlevel change after boot, or
+ * TIMELINE_MAX events, and then kept for the lifetime of PID 1.
+ */
+static struct timeline_ev *events;
+static size_t num, max;
+static int    stopped;
+
+static uint64_t nsec(struct timespec *ts)
+{
+	return (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+static struct timeline_ev *add(int type, const char *name)
+{
+	struct timeline_ev *ev;
+
+	if (stopped)
+		return NULL;
+
+	if (num == max) {
+		if (max == TIMELINE_MAX) {
+			_d("Boot timeline full, %d events", TIMELINE_MAX);
+			stopped = 1;
+			return NULL;
+		}
+
+		ev = realloc(events, (max + TIMELINE_CHUNK) * sizeof(*ev));
+		if (!ev) {
+			stopped = 1;
+			return NULL;
+		}
+		events = ev;
+		max   += TIMELINE_CHUNK;
+	}
+
+	ev = &events[num++];
+	memset(ev, 0, sizeof(*ev));
+	ev->type = type;
+	strlcpy(ev->name, name, sizeof(ev->name));
+
+	return ev;
+}
+
+/**
+ * timeline_span - Record something that took time
+ * @name:  What, e.g., "fs_init" or "usr.so:hook/mount/all"
+ * @start: When it started, the end is now
+ */
+void timeline_span(const char *name, struct timespec *start)
+{
+	struct timeline_ev *ev;
+	struct timespec now;
+
+	ev = add(TIMELINE_SPAN, name);
+	if (!ev)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ev->start = nsec(start);
+	ev->end   = nsec(&now);
+}
+
+/**
+ * timeline_mark - Record a milestone
+ * @type: One of &timeline_type, except %TIMELINE_SPAN
+ * @name: Condition, or service identity NAME[:ID]
+ */
+void timeline_mark(int type, const char *name)
+{
+	struct timeline_ev *ev;
+	struct timespec now;
+
+	ev = add(type, name);
+	if (!ev)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ev->start = nsec(&now);
+}
+
+/**
+ * timeline_stop - Boot is over, stop recording
+ */
+void timeline_stop(void)
+{
+	if (!stopped)
+		_d("Boot timeline done, %zu events", num);
+	stopped = 1;
+}
+
+/**
+ * timeline_send - Send boot timeline to an initctl client
+ * @sd: Client socket, closed when done
+ */
+void timeline_send(int sd)
+{
+	struct timeline_ev *buf;
+
+	buf = malloc((num ? num : 1) * sizeof(*buf));
+	if (!buf) {
+		close(sd);
+		return;
+	}
+	if (num)
+		memcpy(buf, events, num * sizeof(*buf));
+
+	api_reply(sd, buf, num, sizeof(*buf));
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,63 @@
+/* Boot timeline, milestones for initctl analyze
+ *
+ * Copyright (c) 2021  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef FINIT_TIMELINE_H_
+#define FINIT_TIMELINE_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#define TIMELINE_MAX      2048	/* Max events recorded */
+#define TIMELINE_CHUNK    256	/* Events allocated at a time */
+#define TIMELINE_MIN      1000	/* usec, shorter callbacks are not recorded */
+#define TIMELINE_NAMELEN  44
+
+enum timeline_type {
+	TIMELINE_SPAN = 1,	/* start to end, e.g., hook, fsck, callback */
+	TIMELINE_COND,		/* condition asserted */
+	TIMELINE_SVC_WAIT,	/* service waiting for its conditions */
+	TIMELINE_SVC_FORK,	/* service started */
+	TIMELINE_SVC_DONE,	/* run/task completed */
+};
+
+/* Sent as-is to initctl analyze */
+struct timeline_ev {
+	uint64_t start;		/* nsec, CLOCK_MONOTONIC */
+	uint64_t end;		/* spans only */
+	uint32_t type;
+	char     name[TIMELINE_NAMELEN];
+};
+
+void timeline_span (const char *name, struct timespec *start);
+void timeline_mark (int type, const char *name);
+void timeline_stop (void);
+void timeline_send (int sd);
+
+#endif /* FINIT_TIMELINE_H_ */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
@@ -0,0 +1,317 @@
+/* Binary trace ring of PID 1 state changes, for initctl trace
+ *
+ * Copyright (c) 2021  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "config.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <lite/lite.h>
+#include <lite/queue.h>
+#include <uev/uev.h>
+
+#include "finit.h"
+#include "cond.h"
+#include "helpers.h"
+#include "latency.h"
+#include "trace.h"
+#include "util.h"
+
+#define ATOM_HASH (TRACE_ATOMS * 2)
+
+/* initctl trace client, sent everything up to next and atoms */
+struct tracer {
+	TAILQ_ENTRY(tracer) link;
+	int      sd;
+	int      follow;
+	uev_t    watcher;
+	uint32_t seq;		/* next record to send */
+	uint16_t atoms;		/* next atom to send */
+};
+
+static TAILQ_HEAD(, tracer) tracers = TAILQ_HEAD_INITIALIZER(tracers);
+static uev_t    flush_timer;
+
+static struct trace_rec ring[TRACE_NUM];
+static uint32_t next;		/* seq of next record */
+
+static char    *atoms[TRACE_ATOMS] = { "?" };
+static uint16_t natoms = 1;
+static uint16_t hash[ATOM_HASH];
+
+static unsigned int atom_hash(const char *name)
+{
+	return strhash(name) % ATOM_HASH;
+}
+
+/* Find or add @name, returns 0 if the table is full */
+static uint16_t atom(const char *str)
+{
+	char name[TRACE_NAMELEN];
+	unsigned int h;
+
+	strlcpy(name, str, sizeof(name));
+
+	for (h = atom_hash(name); hash[h]; h = (h + 1) % ATOM_HASH) {
+		if (!strcmp(atoms[hash[h]], name))
+			return hash[h];
+	}
+
+	if (natoms == TRACE_ATOMS)
+		return 0;
+
+	atoms[natoms] = strdup(name);
+	if (!atoms[natoms])
+		return 0;
+	hash[h] = natoms;
+
+	return natoms++;
+}
+
+static void add(uint8_t event, uint16_t atom, int job, int pid, int arg, int from, int to)
+{
+	struct trace_rec *rec = &ring[next % TRACE_NUM];
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	*rec = (struct trace_rec) {
+		.time  = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec,
+		.seq   = next++,
+		.atom  = atom,
+		.job   = job,
+		.pid   = pid,
+		.arg   = arg,
+		.event = event,
+		.from  = from,
+		.to    = to,
+	};
+}
+
+/**
+ * trace_state - Record service state change
+ * @svc:  Service
+ * @from: Previous state
+ * @to:   New state
+ */
+void trace_state(svc_t *svc, int from, int to)
+{
+	add(TRACE_SVC_STATE, atom(svc_ident(svc, NULL, 0)), svc->job, svc->pid, 0, from, to);
+}
+
+/**
+ * trace_collect - Record exit of a service process
+ * @svc:    Service
+ * @pid:    Process collected, may be a pre:/post: script
+ * @status: Wait status
+ */
+void trace_collect(svc_t *svc, pid_t pid, int status)
+{
+	add(TRACE_SVC_EXIT, atom(svc_ident(svc, NULL, 0)), svc->job, pid, status, 0, 0);
+}
+
+/**
+ * trace_cond - Record condition change
+ * @path: Path to condition, only the name is recorded
+ * @from: Previous state
+ * @to:   New state
+ */
+void trace_cond(const char *path, int from, int to)
+{
+	add(TRACE_COND, atom(cond_name(path)), 0, 0, 0, from, to);
+}
+
+/**
+ * trace_sm - Record state machine state, or runlevel, change
+ * @event: %TRACE_SM_STATE or %TRACE_RUNLEVEL
+ * @from:  Previous state
+ * @to:    New state
+ */
+void trace_sm(int event, int from, int to)
+{
+	add(event, 0, 0, 0, 0, from, to);
+}
+
+static void tracer_free(struct tracer *t)
+{
+	uev_io_stop(&t->watcher);
+	TAILQ_REMOVE(&tracers, t, link);
+	close(t->sd);
+	free(t);
+
+	if (TAILQ_EMPTY(&tracers))
+		uev_timer_stop(&flush_timer);
+}
+
+static int tracer_xmit(struct tracer *t, int type, void *items, size_t num, size_t sz)
+{
+	struct trace_msg hdr = { .type = type, .num = num };
+	char buf[INIT_LOG_CHUNK];
+
+	memcpy(buf, &hdr, sizeof(hdr));
+	memcpy(&buf[sizeof(hdr)], items, num * sz);
+	if (send(t->sd, buf, sizeof(hdr) + num * sz, MSG_DONTWAIT | MSG_NOSIGNAL) == -1)
+		return errno == EAGAIN ? 1 : -1;
+
+	return 0;
+}
+
+/*
+ * Send new atoms and records to @t.  Returns zero when it has caught
+ * up, one if the socket is full, and -1 on error.  Records overwritten
+ * before they could be sent are skipped, the client sees the gap.
+ */
+static int tracer_send(struct tracer *t)
+{
+	struct trace_atom list[(INIT_LOG_CHUNK - sizeof(struct trace_msg)) / sizeof(struct trace_atom)];
+	struct trace_rec  recs[(INIT_LOG_CHUNK - sizeof(struct trace_msg)) / sizeof(struct trace_rec)];
+	size_t num;
+	int rc;
+
+	while (t->atoms < natoms) {
+		for (num = 0; num < NELEMS(list) && t->atoms + num < natoms; num++) {
+			list[num].id = t->atoms + num;
+			strlcpy(list[num].name, atoms[t->atoms + num], sizeof(list[num].name));
+		}
+
+		rc = tracer_xmit(t, TRACE_MSG_ATOM, list, num, sizeof(list[0]));
+		if (rc)
+			return rc;
+		t->atoms += num;
+	}
+
+	if (next - t->seq > TRACE_NUM)
+		t->seq = next - TRACE_NUM;
+
+	while (t->seq != next) {
+		for (num = 0; num < NELEMS(recs) && t->seq + num != next; num++)
+			recs[num] = ring[(t->seq + num) % TRACE_NUM];
+
+		rc = tracer_xmit(t, TRACE_MSG_REC, recs, num, sizeof(recs[0]));
+		if (rc)
+			return rc;
+		t->seq += num;
+	}
+
+	return 0;
+}
+
+static void tracer_run(struct tracer *t)
+{
+	int rc;
+
+	rc = tracer_send(t);
+	if (rc == -1 || (!rc && !t->follow)) {
+		tracer_free(t);
+		return;
+	}
+
+	/* wait for room in socket, or for client to go away */
+	uev_io_set(&t->watcher, t->sd, rc ? UEV_READ | UEV_WRITE : UEV_READ);
+}
+
+static void tracer_cb(uev_t *w, void *arg, int events)
+{
+	static struct latency lat = { .stat.name = "tracer_cb" };
+	struct tracer *t = (struct tracer *)arg;
+	char buf[16];
+	struct timespec start;
+
+	latency_start(&start);
+	if (UEV_ERROR == events) {
+		tracer_free(t);
+		goto done;
+	}
+
+	/* client has nothing to say, this is EOF or an error */
+	if ((events & UEV_READ) && !(read(w->fd, buf, sizeof(buf)) == -1 && errno == EAGAIN)) {
+		tracer_free(t);
+		goto done;
+	}
+
+	if (events & UEV_WRITE)
+		tracer_run(t);
+done:
+	latency_stop(&lat, &start);
+}
+
+static void flush_cb(uev_t *w, void *arg, int events)
+{
+	static struct latency lat = { .stat.name = "flush_cb" };
+	struct tracer *t, *tmp;
+	struct timespec start;
+
+	latency_start(&start);
+	TAILQ_FOREACH_SAFE(t, &tracers, link, tmp) {
+		if (t->seq != next || t->atoms != natoms)
+			tracer_run(t);
+	}
+
+	latency_stop(&lat, &start);
+}
+
+/**
+ * trace_send - Send trace ring to an initctl client
+ * @sd:     Client socket, closed when done
+ * @follow: Keep @sd and send new records as they are added
+ *
+ * All atoms are sent before any record referring to them, each message
+ * is at most %INIT_LOG_CHUNK bytes.  The client is served from the
+ * event loop, so a slow reader never blocks PID 1; one that is too slow
+ * loses the records overwritten in the meantime.
+ */
+void trace_send(int sd, int follow)
+{
+	struct tracer *t;
+
+	t = calloc(1, sizeof(*t));
+	if (!t) {
+		close(sd);
+		return;
+	}
+
+	fcntl(sd, F_SETFL, fcntl(sd, F_GETFL) | O_NONBLOCK);
+	t->sd     = sd;
+	t->follow = follow;
+	t->seq    = next > TRACE_NUM ? next - TRACE_NUM : 0;
+	if (uev_io_init(ctx, &t->watcher, tracer_cb, t, sd, UEV_READ)) {
+		close(sd);
+		free(t);
+		return;
+	}
+
+	if (TAILQ_EMPTY(&tracers))
+		uev_timer_init(ctx, &flush_timer, flush_cb, NULL, TRACE_FLUSH, TRACE_FLUSH);
+	TAILQ_INSERT_TAIL(&tracers, t, link);
+
+	tracer_run(t);
+}
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
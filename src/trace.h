@@ -0,0 +1,90 @@
+/* Binary trace ring of PID 1 state changes, for initctl trace
+ *
+ * Copyright (c) 2021  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef FINIT_TRACE_H_
+#define FINIT_TRACE_H_
+
+#include <stdint.h>
+#include "svc.h"
+
+/*
+ * Records are fixed size and hold only numbers, names of services and
+ * conditions are interned as atoms on first use.  All formatting is
+ * done by initctl when the ring is read.
+ */
+#define TRACE_NUM      4096	/* Records in ring, power of two */
+#define TRACE_ATOMS    1024	/* Max interned names, atom 0 is unknown */
+#define TRACE_NAMELEN  62
+#define TRACE_FLUSH    250	/* msec, follow mode poll interval */
+
+enum trace_event {
+	TRACE_SVC_STATE = 1,	/* from/to: svc_state_t */
+	TRACE_SVC_EXIT,		/* arg: wait status */
+	TRACE_COND,		/* from/to: enum cond_state */
+	TRACE_SM_STATE,		/* from/to: sm_state_t */
+	TRACE_RUNLEVEL,		/* from/to: runlevel, 255 for none */
+};
+
+struct trace_rec {
+	uint64_t time;		/* nsec, CLOCK_MONOTONIC */
+	uint32_t seq;
+	uint16_t atom;		/* service ident or condition */
+	uint16_t job;
+	int32_t  pid;
+	int32_t  arg;
+	uint8_t  event;
+	uint8_t  from;
+	uint8_t  to;
+	uint8_t  pad[5];
+};
+
+struct trace_atom {
+	uint16_t id;
+	char     name[TRACE_NAMELEN];
+};
+
+/* Each message after the reply to INIT_CMD_TRACE, followed by num items */
+#define TRACE_MSG_ATOM 1
+#define TRACE_MSG_REC  2
+
+struct trace_msg {
+	uint16_t type;
+	uint16_t num;
+	uint32_t pad;
+};
+
+void trace_state  (svc_t *svc, int from, int to);
+void trace_collect(svc_t *svc, pid_t pid, int status);
+void trace_cond   (const char *path, int from, int to);
+void trace_sm     (int event, int from, int to);
+
+void trace_send   (int sd, int follow);
+
+#endif /* FINIT_TRACE_H_ */
+
+/**
+ * Local Variables:
+ *  indent-tabs-mode: t
+ *  c-file-style: "linux"
+ * End:
+ */
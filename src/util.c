@@ -394,6 +394,20 @@ char *sanitize(char *arg, size_t len)
 	return arg;
 }
 
+/*
+ * FNV-1a hash of a NUL terminated string, for the hash tables of PID 1.
+ * Callers mask, or take the modulo of, the result for their bucket.
+ */
+uint32_t strhash(const char *str)
+{
+	uint32_t hash = 2166136261u;
+
+	while (*str)
+		hash = (hash ^ (unsigned char)*str++) * 16777619u;
+
+	return hash;
+}
+
 #ifdef HAVE_TERMIOS_H
 /*
  * Called by initctl, and by finit at boot and shutdown, to
@@ -64,6 +64,7 @@ char *uptime       (long secs, char *buf, size_t len);
 char *memsz        (uint64_t sz, char *buf, size_t len);
 
 char *sanitize     (char *arg, size_t len);
+uint32_t strhash   (const char *str);
 
 #ifdef HAVE_TERMIOS_H
 int     ttinit     (void);
@@ -0,0 +1,9 @@
+#!/bin/sh
+# Socket activated service, reads one line from the FIFO and exits
+
+set -eu
+
+[ "$LISTEN_PID" = "$$" ]
+
+read -r line <&3
+echo "$LISTEN_FDS $line" >> /test_assets/activate.log
@@ -0,0 +1,11 @@
+#!/bin/sh
+# Logs each start to the file given as argument, then idles, never
+# creates a PID file or sends a keepalive
+
+set -eu
+
+echo "$$" >> "$1"
+
+while true; do
+    sleep 5
+done
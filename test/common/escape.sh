@@ -0,0 +1,11 @@
+#!/bin/sh
+# Starts a process that leaves the process group of the service, like
+# a daemon that detaches a helper with setsid(), then idles
+
+set -eu
+
+setsid sleep 4711 &
+
+while true; do
+    sleep 5
+done
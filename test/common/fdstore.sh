@@ -0,0 +1,19 @@
+#!/bin/sh
+# Hands over a file to the fd store on the first start, the next
+# instance gets it back and logs the line it reads from it
+
+set -eu
+
+if [ -n "${LISTEN_FDS:-}" ]; then
+    read -r line <&3
+    echo "$LISTEN_FDS $line" >> /test_assets/fdstore.log
+else
+    exec 3< /test_assets/fdstore.in
+    initctl -b fdstore 3
+    exec 3<&-
+    echo stored >> /test_assets/fdstore.log
+fi
+
+while true; do
+    sleep 5
+done
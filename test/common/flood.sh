@@ -0,0 +1,8 @@
+#!/bin/sh
+# Writes lines to stdout as fast as it can
+
+set -eu
+
+while true; do
+    echo flood
+done
@@ -0,0 +1,4 @@
+#!/bin/sh
+# Health probe that always fails
+
+exit 1
@@ -0,0 +1,6 @@
+#!/bin/sh
+# Feeds logit a line every second, slower than its flush interval
+
+set -eu
+
+/test_assets/ticker.sh | "$1" -f /test_assets/slow-log.log -i 1500
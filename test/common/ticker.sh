@@ -0,0 +1,11 @@
+#!/bin/sh
+# Writes a numbered line to stdout every second
+
+set -eu
+
+n=0
+while true; do
+    n=$((n + 1))
+    echo "tick $n"
+    sleep 1
+done
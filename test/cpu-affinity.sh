@@ -0,0 +1,45 @@
+#!/bin/sh
+
+set -eu
+
+TEST_DIR=$(dirname "$0")
+
+# shellcheck source=/dev/null
+. "$TEST_DIR/tenv/lib.sh"
+
+test_teardown() {
+    say "Test done $(date)"
+    say "Running test teardown."
+
+    texec rm -f "$FINIT_CONF"
+    texec rm -f /test_assets/service.sh
+}
+
+cpus_allowed() {
+    pid=$(texec pgrep -P 1 service.sh)
+    texec cat "/proc/$pid/status" | awk '/^Cpus_allowed_list:/ { print $2 }'
+}
+
+say "Test start $(date)"
+
+if [ "$(nproc)" -lt 2 ]; then
+    say 'Need at least two CPUs to tell affinity apart'
+    exit 77
+fi
+
+cp "$TEST_DIR"/common/service.sh "$TENV_ROOT"/test_assets/
+
+say "Add service bound to CPU 0 in $FINIT_CONF"
+texec sh -c "echo 'service [2345] cpus:0 /test_assets/service.sh' > $FINIT_CONF"
+
+say 'Reload Finit'
+texec sh -c "initctl reload"
+
+retry 'assert_num_children 1 service.sh'
+assert "Service runs on CPU 0 only" "$(cpus_allowed)" = "0"
+
+say 'Restart the service, it should still run on CPU 0 only'
+texec sh -c "initctl restart service.sh"
+
+retry 'assert_num_children 1 service.sh'
+assert "Service runs on CPU 0 only" "$(cpus_allowed)" = "0"
@@ -0,0 +1,127 @@
+/* Send descriptors to Finit with a malformed request, for fdstore tests
+ *
+ * Copyright (c) 2021  Joachim Wiberg <troglobit@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <err.h>
+#include <getopt.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "finit.h"
+
+static int usage(int code)
+{
+	fprintf(stderr, "Usage: fdsend [-bs] [-n NUM]\n"
+		"\n"
+		"Send NUM (4) descriptors with an INIT_CMD_FDSTORE request to Finit\n"
+		"\n"
+		"  -b      Bad magic\n"
+		"  -s      Short request\n"
+		"  -n NUM  Number of descriptors to send, max 16\n"
+		"\n"
+		"Prints ACK, NACK, or EOF if Finit closed the connection.\n");
+
+	return code;
+}
+
+int main(int argc, char *argv[])
+{
+	struct sockaddr_un sun = { .sun_family = AF_UNIX };
+	struct init_request rq = {
+		.magic = INIT_MAGIC,
+		.cmd   = INIT_CMD_FDSTORE,
+	};
+	char cbuf[CMSG_SPACE(sizeof(int) * 16)] = { 0 };
+	struct iovec iov = {
+		.iov_base = &rq,
+		.iov_len  = sizeof(rq),
+	};
+	struct msghdr msg = {
+		.msg_iov        = &iov,
+		.msg_iovlen     = 1,
+		.msg_control    = cbuf,
+	};
+	struct cmsghdr *cmsg;
+	int fds[16], num = 4;
+	int c, sd;
+	ssize_t len;
+
+	while ((c = getopt(argc, argv, "bhn:s")) != EOF) {
+		switch (c) {
+		case 'b':
+			rq.magic = ~INIT_MAGIC;
+			break;
+		case 'h':
+			return usage(0);
+		case 'n':
+			num = atoi(optarg);
+			if (num < 1 || num > (int)NELEMS(fds))
+				return usage(1);
+			break;
+		case 's':
+			iov.iov_len = sizeof(rq) / 2;
+			break;
+		default:
+			return usage(1);
+		}
+	}
+
+	for (int i = 0; i < num; i++) {
+		fds[i] = open("/dev/null", O_RDONLY);
+		if (fds[i] == -1)
+			err(1, "open /dev/null");
+	}
+
+	msg.msg_controllen = CMSG_SPACE(sizeof(int) * num);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type  = SCM_RIGHTS;
+	cmsg->cmsg_len   = CMSG_LEN(sizeof(int) * num);
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * num);
+
+	sd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	if (sd == -1)
+		err(1, "socket");
+
+	snprintf(sun.sun_path, sizeof(sun.sun_path), "%s", INIT_SOCKET);
+	if (connect(sd, (struct sockaddr *)&sun, sizeof(sun)))
+		err(1, "connect %s", INIT_SOCKET);
+
+	if (sendmsg(sd, &msg, 0) == -1)
+		err(1, "sendmsg");
+
+	len = recv(sd, &rq, sizeof(rq), 0);
+	if (len == -1)
+		err(1, "recv");
+
+	if (len == 0)
+		puts("EOF");
+	else if (rq.cmd == INIT_CMD_ACK)
+		puts("ACK");
+	else
+		puts("NACK");
+
+	close(sd);
+
+	return 0;
+}
@@ -0,0 +1,48 @@
+#!/bin/sh
+
+set -eu
+
+TEST_DIR=$(dirname "$0")
+
+# shellcheck source=/dev/null
+. "$TEST_DIR/tenv/lib.sh"
+
+test_teardown() {
+    say "Test done $(date)"
+    say "Running test teardown."
+
+    texec rm -f /test_assets/fdsend
+}
+
+# Descriptors held open by PID 1
+num_fds() {
+    texec ls /proc/1/fd | wc -l
+}
+
+assert_num_fds() {
+    assert "PID 1 holds $1 descriptors" "$(num_fds)" -eq "$1"
+}
+
+say "Test start $(date)"
+
+# shellcheck disable=SC2154
+cp "$top_builddir"/test/fdsend "$TENV_ROOT"/test_assets/
+
+before=$(num_fds)
+
+say 'Send descriptors with a request with bad magic'
+assert "Request is refused" "$(texec /test_assets/fdsend -b -n 8)" = "EOF"
+
+say 'Send descriptors with a short request'
+assert "Request is refused" "$(texec /test_assets/fdsend -s -n 8)" = "EOF"
+
+retry "assert_num_fds $before"
+
+say 'Store a descriptor from a process that is not a service'
+assert "Request is refused" "$(texec /test_assets/fdsend -n 8)" = "NACK"
+if texec sh -c "initctl fdstore 0"; then
+    say 'initctl fdstore from a non-service succeeded'
+    exit 1
+fi
+
+retry "assert_num_fds $before"
@@ -0,0 +1,42 @@
+#!/bin/sh
+
+set -eu
+
+TEST_DIR=$(dirname "$0")
+
+# shellcheck source=/dev/null
+. "$TEST_DIR/tenv/lib.sh"
+
+test_teardown() {
+    say "Test done $(date)"
+    say "Running test teardown."
+
+    texec rm -f "$FINIT_CONF"
+    texec rm -f /test_assets/fdstore.sh /test_assets/path.env
+    texec rm -f /test_assets/fdstore.in /test_assets/fdstore.log
+}
+
+say "Test start $(date)"
+
+cp "$TEST_DIR"/common/fdstore.sh "$TENV_ROOT"/test_assets/
+echo token > "$TENV_ROOT"/test_assets/fdstore.in
+
+# The service calls initctl
+echo "PATH=$TESTENV_PATH" > "$TENV_ROOT"/test_assets/path.env
+
+say "Add service stanza in $FINIT_CONF"
+texec sh -c "echo 'service [2345] env:/test_assets/path.env /test_assets/fdstore.sh' > $FINIT_CONF"
+
+say 'Reload Finit'
+texec sh -c "initctl reload"
+
+retry 'assert_num_children 1 fdstore.sh'
+retry 'assert_num_lines 1 /test_assets/fdstore.log'
+assert "Service stored its descriptor" "$(grep -c '^stored$' "$TENV_ROOT"/test_assets/fdstore.log)" -eq 1
+
+say 'Restart the service, it should get the descriptor back'
+texec sh -c "initctl restart fdstore.sh"
+
+retry 'assert_num_children 1 fdstore.sh'
+retry 'assert_num_lines 2 /test_assets/fdstore.log'
+assert "Service got its descriptor back" "$(grep -c '^1 token$' "$TENV_ROOT"/test_assets/fdstore.log)" -eq 1
@@ -0,0 +1,39 @@
+#!/bin/sh
+
+set -eu
+
+TEST_DIR=$(dirname "$0")
+
+# shellcheck source=/dev/null
+. "$TEST_DIR/tenv/lib.sh"
+
+test_teardown() {
+    say "Test done $(date)"
+    say "Running test teardown."
+
+    texec rm -f "$FINIT_CONF"
+    texec rm -f /test_assets/count.sh /test_assets/probe-ok.sh /test_assets/probe-fail.sh
+    texec rm -f /test_assets/healthy.log /test_assets/unhealthy.log
+}
+
+say "Test start $(date)"
+
+cp "$TEST_DIR"/common/count.sh "$TENV_ROOT"/test_assets/
+cp "$TEST_DIR"/common/probe-ok.sh "$TENV_ROOT"/test_assets/
+cp "$TEST_DIR"/common/probe-fail.sh "$TENV_ROOT"/test_assets/
+
+say "Add one healthy and one unhealthy service in $FINIT_CONF"
+texec sh -c "echo 'service :1 [2345] health:exec:/test_assets/probe-ok.sh,interval:1,retries:2 /test_assets/count.sh /test_assets/healthy.log' > $FINIT_CONF"
+texec sh -c "echo 'service :2 [2345] health:exec:/test_assets/probe-fail.sh,interval:1,retries:2 /test_assets/count.sh /test_assets/unhealthy.log' >> $FINIT_CONF"
+
+say 'Reload Finit'
+texec sh -c "initctl reload"
+
+retry 'assert_num_lines 1 /test_assets/healthy.log'
+retry 'assert_num_lines 1 /test_assets/unhealthy.log'
+
+say 'Unhealthy service should be killed after two failed probes and restarted'
+retry 'assert_min_lines 2 /test_assets/unhealthy.log' 100
+
+say 'Healthy service should still run its first instance'
+assert_num_lines 1 /test_assets/healthy.log
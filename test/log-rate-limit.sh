@@ -0,0 +1,47 @@
+#!/bin/sh
+
+set -eu
+
+TEST_DIR=$(dirname "$0")
+
+# shellcheck source=/dev/null
+. "$TEST_DIR/tenv/lib.sh"
+
+test_teardown() {
+    say "Test done $(date)"
+    say "Running test teardown."
+
+    texec rm -f "$FINIT_CONF"
+    texec rm -f /test_assets/flood.sh /test_assets/flood.log
+}
+
+num_logged() {
+    grep -c "$1" "$TENV_ROOT"/test_assets/flood.log || true
+}
+
+assert_suppressed() {
+    assert "Suppressed lines are reported" "$(num_logged 'messages suppressed')" -ge 1
+}
+
+say "Test start $(date)"
+
+cp "$TEST_DIR"/common/flood.sh "$TENV_ROOT"/test_assets/
+
+say "Add service limited to 10 lines/sec in $FINIT_CONF"
+texec sh -c "echo 'service [2345] log:/test_assets/flood.log,rate:10,burst:1 /test_assets/flood.sh' > $FINIT_CONF"
+
+say 'Reload Finit'
+texec sh -c "initctl reload"
+
+retry 'assert_num_children 1 flood.sh'
+sleep 3
+
+say 'Stop the service'
+texec sh -c "initctl stop flood.sh"
+
+retry 'assert_num_children 0 flood.sh'
+retry 'assert_suppressed'
+
+say 'At most 10 lines, plus 10 more per second, should have been logged'
+assert "Lines logged within limit" "$(num_logged flood)" -le 100
+assert "Lines logged within limit" "$(num_logged flood)" -ge 10
@@ -0,0 +1,52 @@
+#!/bin/sh
+
+set -eu
+
+TEST_DIR=$(dirname "$0")
+
+# shellcheck source=/dev/null
+. "$TEST_DIR/tenv/lib.sh"
+
+test_teardown() {
+    say "Test done $(date)"
+    say "Running test teardown."
+
+    texec rm -f "$FINIT_CONF"
+    texec rm -f /test_assets/ticker.sh /test_assets/ticker.log
+    texec rm -rf /test_assets/store
+}
+
+# Lines of service output in the log store, within initctl options $@
+num_stored() {
+    texec initctl -b "$@" log ticker.sh | grep -c ': tick ' || true
+}
+
+say "Test start $(date)"
+
+cp "$TEST_DIR"/common/ticker.sh "$TENV_ROOT"/test_assets/
+
+say "Enable log store and add a service that logs every second in $FINIT_CONF"
+texec sh -c "echo 'logstore /test_assets/store' > $FINIT_CONF"
+texec sh -c "echo 'service [2345] log:/test_assets/ticker.log /test_assets/ticker.sh' >> $FINIT_CONF"
+
+before=$(date +%s)
+sleep 1
+
+say 'Reload Finit'
+texec sh -c "initctl reload"
+
+retry 'assert_min_lines 1 /test_assets/ticker.log'
+
+sleep 1
+since=$(date +%s)
+sleep 3
+until=$(date +%s)
+sleep 2
+
+say "Query log store for output between $since and $until"
+assert "Three lines in window" "$(num_stored --since "@$since" --until "@$until")" -ge 2
+assert "Three lines in window" "$(num_stored --since "@$since" --until "@$until")" -le 4
+
+say 'Query log store for output before and after window'
+assert "No lines before start" "$(num_stored --until "@$before")" -eq 0
+assert "Lines after window" "$(num_stored --since "@$until")" -ge 1
@@ -0,0 +1,32 @@
+#!/bin/sh
+
+set -eu
+
+TEST_DIR=$(dirname "$0")
+
+# shellcheck source=/dev/null
+. "$TEST_DIR/tenv/lib.sh"
+
+test_teardown() {
+    say "Test done $(date)"
+    say "Running test teardown."
+
+    texec rm -f "$FINIT_CONF"
+    texec rm -f /test_assets/ticker.sh /test_assets/slow-log.sh /test_assets/slow-log.log
+}
+
+say "Test start $(date)"
+
+cp "$TEST_DIR"/common/ticker.sh "$TEST_DIR"/common/slow-log.sh "$TENV_ROOT"/test_assets/
+
+say "Add service feeding logit -i 1500 a line per second in $FINIT_CONF"
+texec sh -c "echo 'service [2345] /test_assets/slow-log.sh $TESTENV_LOGIT' > $FINIT_CONF"
+
+say 'Reload Finit'
+texec sh -c "initctl reload"
+
+retry 'assert_num_children 1 slow-log.sh'
+
+say 'Lines arrive faster than the interval, they must still be flushed within it'
+retry 'assert_min_lines 1 /test_assets/slow-log.log' 30
+retry 'assert_min_lines 3 /test_assets/slow-log.log' 50
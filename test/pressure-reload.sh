@@ -0,0 +1,52 @@
+#!/bin/sh
+
+set -eu
+
+TEST_DIR=$(dirname "$0")
+
+# shellcheck source=/dev/null
+. "$TEST_DIR/tenv/lib.sh"
+
+test_teardown() {
+    say "Test done $(date)"
+    say "Running test teardown."
+
+    texec rm -f "$FINIT_CONF"
+}
+
+# PSI triggers held open by PID 1
+num_triggers() {
+    texec ls -l /proc/1/fd | grep -c /proc/pressure/ || true
+}
+
+assert_num_triggers() {
+    assert "$1 pressure triggers open" "$(num_triggers)" -eq "$1"
+}
+
+say "Test start $(date)"
+
+if ! texec sh -c "test -e /proc/pressure/memory"; then
+    say 'No pressure stall information (PSI) in this kernel'
+    exit 77
+fi
+
+say "Set memory pressure threshold in $FINIT_CONF"
+texec sh -c "echo 'pressure memory:50' > $FINIT_CONF"
+
+say 'Reload Finit'
+texec sh -c "initctl reload"
+
+if ! retry 'assert_num_triggers 1' 10; then
+    say 'Not allowed to set up pressure triggers here'
+    exit 77
+fi
+
+say 'Add io threshold on a separate line, both should be armed'
+texec sh -c "echo 'pressure io:50' >> $FINIT_CONF"
+texec sh -c "initctl reload"
+retry 'assert_num_triggers 2'
+
+say 'Remove all pressure lines, all triggers should be closed'
+texec rm -f "$FINIT_CONF"
+texec sh -c "initctl reload"
+retry 'assert_num_triggers 0'
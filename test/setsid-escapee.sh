@@ -0,0 +1,44 @@
+#!/bin/sh
+
+set -eu
+
+TEST_DIR=$(dirname "$0")
+
+# shellcheck source=/dev/null
+. "$TEST_DIR/tenv/lib.sh"
+
+test_teardown() {
+    say "Test done $(date)"
+    say "Running test teardown."
+
+    texec rm -f "$FINIT_RCSD/escape.conf"
+    texec rm -f /test_assets/escape.sh
+}
+
+assert_num_escaped() {
+    assert "$1 escaped processes are running" "$(texec pgrep -f 'sleep 4711' | wc -l)" -eq "$1"
+}
+
+say "Test start $(date)"
+
+if ! texec sh -c "[ -d /sys/fs/cgroup/system ]"; then
+    say 'No cgroup support in test environment, skipping.'
+    exit 77
+fi
+
+cp "$TEST_DIR"/common/escape.sh "$TENV_ROOT"/test_assets/
+
+say "Add service with a cgroup of its own in $FINIT_RCSD/escape.conf"
+texec sh -c "echo 'service [2345] kill:5 /test_assets/escape.sh' > $FINIT_RCSD/escape.conf"
+
+say 'Reload Finit'
+texec sh -c "initctl reload"
+
+retry 'assert_num_children 1 escape.sh'
+retry 'assert_num_escaped 1'
+
+say 'Stop the service, the process that called setsid() should be killed too'
+texec sh -c "initctl stop escape.sh"
+
+retry 'assert_num_children 0 escape.sh'
+retry 'assert_num_escaped 0'
@@ -0,0 +1,42 @@
+#!/bin/sh
+
+set -eu
+
+TEST_DIR=$(dirname "$0")
+
+# shellcheck source=/dev/null
+. "$TEST_DIR/tenv/lib.sh"
+
+test_teardown() {
+    say "Test done $(date)"
+    say "Running test teardown."
+
+    texec rm -f "$FINIT_CONF"
+    texec rm -f /test_assets/activate.sh /test_assets/activate.fifo /test_assets/activate.log
+}
+
+say "Test start $(date)"
+
+cp "$TEST_DIR"/common/activate.sh "$TENV_ROOT"/test_assets/
+
+say "Add socket activated service in $FINIT_CONF"
+texec sh -c "echo 'service [2345] listen:fifo:/test_assets/activate.fifo log /test_assets/activate.sh' > $FINIT_CONF"
+
+say 'Reload Finit'
+texec sh -c "initctl reload"
+
+retry "assert 'FIFO is created' -p $TENV_ROOT/test_assets/activate.fifo"
+assert_num_children 0 activate.sh
+
+say 'Write to the FIFO, the service should be started'
+texec sh -c "echo hello > /test_assets/activate.fifo"
+
+retry 'assert_num_lines 1 /test_assets/activate.log'
+assert "Service got the FIFO" "$(grep -c '^1 hello$' "$TENV_ROOT"/test_assets/activate.log)" -eq 1
+
+say 'Service has exited, write again to activate it again'
+retry 'assert_num_children 0 activate.sh'
+texec sh -c "echo again > /test_assets/activate.fifo"
+
+retry 'assert_num_lines 2 /test_assets/activate.log'
+assert "Service got the FIFO again" "$(grep -c '^1 again$' "$TENV_ROOT"/test_assets/activate.log)" -eq 1
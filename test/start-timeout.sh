@@ -0,0 +1,31 @@
+#!/bin/sh
+
+set -eu
+
+TEST_DIR=$(dirname "$0")
+
+# shellcheck source=/dev/null
+. "$TEST_DIR/tenv/lib.sh"
+
+test_teardown() {
+    say "Test done $(date)"
+    say "Running test teardown."
+
+    texec rm -f "$FINIT_CONF"
+    texec rm -f /test_assets/count.sh /test_assets/start-timeout.log
+}
+
+say "Test start $(date)"
+
+cp "$TEST_DIR"/common/count.sh "$TENV_ROOT"/test_assets/
+
+say "Add service that never creates its PID file in $FINIT_CONF"
+texec sh -c "echo 'service [2345] pid:!/run/never.pid start-timeout:1 /test_assets/count.sh /test_assets/start-timeout.log' > $FINIT_CONF"
+
+say 'Reload Finit'
+texec sh -c "initctl reload"
+
+retry 'assert_num_lines 1 /test_assets/start-timeout.log'
+
+say 'Service should be killed after 1 sec and restarted'
+retry 'assert_min_lines 2 /test_assets/start-timeout.log' 100
@@ -25,6 +25,23 @@ assert_num_children() {
     assert "$1 services are running" "$(texec pgrep -P 1 "$2" | wc -l)" -eq "$1"
 }
 
+# Lines in a file of the test environment, zero if it does not exist
+num_lines() {
+    if [ -f "$TENV_ROOT/$1" ]; then
+        wc -l < "$TENV_ROOT/$1"
+    else
+        echo 0
+    fi
+}
+
+assert_num_lines() {
+    assert "$1 lines in $2" "$(num_lines "$2")" -eq "$1"
+}
+
+assert_min_lines() {
+    assert "At least $1 lines in $2" "$(num_lines "$2")" -ge "$1"
+}
+
 texec() {
     # shellcheck disable=SC2154
     "$TEST_DIR/tenv/exec.sh" "$finit_pid" "$@"
@@ -102,6 +119,8 @@ teardown() {
     log "$color_reset" '--' ''
     if [ "$test_status" -eq 0 ]; then
         log "$fg_green" 'TEST PASS' ''
+    elif [ "$test_status" -eq 77 ]; then
+        log "$fg_yellow" 'TEST SKIP' ''
     else
         log "$fg_red" 'TEST FAIL' ''
     fi
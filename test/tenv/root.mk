@@ -47,6 +47,7 @@ binaries = $(DEST)/bin/cat \
 	$(DEST)/bin/pgrep \
 	$(DEST)/bin/ps \
 	$(DEST)/bin/rm \
+	$(DEST)/bin/setsid \
 	$(DEST)/bin/sh \
 	$(DEST)/bin/sleep \
 	$(DEST)/bin/top \
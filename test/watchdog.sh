@@ -0,0 +1,41 @@
+#!/bin/sh
+
+set -eu
+
+TEST_DIR=$(dirname "$0")
+
+# shellcheck source=/dev/null
+. "$TEST_DIR/tenv/lib.sh"
+
+test_teardown() {
+    say "Test done $(date)"
+    say "Running test teardown."
+
+    texec rm -f "$FINIT_CONF"
+    texec rm -f /test_assets/count.sh /test_assets/keepalive.sh /test_assets/path.env
+    texec rm -f /test_assets/silent.log /test_assets/alive.log
+}
+
+say "Test start $(date)"
+
+cp "$TEST_DIR"/common/count.sh "$TENV_ROOT"/test_assets/
+cp "$TEST_DIR"/common/keepalive.sh "$TENV_ROOT"/test_assets/
+
+# The service calls initctl
+echo "PATH=$TESTENV_PATH" > "$TENV_ROOT"/test_assets/path.env
+
+say "Add one silent and one service that sends keepalives in $FINIT_CONF"
+texec sh -c "echo 'service [2345] watchdog:1 /test_assets/count.sh /test_assets/silent.log' > $FINIT_CONF"
+texec sh -c "echo 'service [2345] watchdog:1 env:/test_assets/path.env /test_assets/keepalive.sh /test_assets/alive.log' >> $FINIT_CONF"
+
+say 'Reload Finit'
+texec sh -c "initctl reload"
+
+retry 'assert_num_lines 1 /test_assets/silent.log'
+retry 'assert_num_lines 1 /test_assets/alive.log'
+
+say 'Silent service should be killed after 1 sec and restarted'
+retry 'assert_min_lines 2 /test_assets/silent.log' 100
+
+say 'Service that sends keepalives should still run its first instance'
+assert_num_lines 1 /test_assets/alive.log